@@ -0,0 +1,135 @@
+#include "SampleSources.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+
+bool preprocessImage(const Pipeline& pipeline, const Image& image, u8* inputs, size_t input_size) {
+  if (image.getPixelType() != Image::PixelType::U8 or image.getNChannels() != 1) return false;
+
+  FeatureShape shape = {(size_t) image.getWidth(), (size_t) image.getHeight(), 1};
+  if (check_pipeline(&pipeline, shape)) return false;
+
+  FeatureShape features = pipeline_output_shape(&pipeline, shape);
+  if (features.width * features.height * features.channels != input_size) return false;
+
+  // apply_pipeline runs the stages in place, in two scratch buffers
+  size_t scratch_size = pipeline_buffer_size(&pipeline, shape);
+  std::vector<u8> image_buffer(scratch_size), buffer(scratch_size);
+  std::memcpy(image_buffer.data(), image.bytes(), image.getByteSize());
+
+  u8* features_ptr = apply_pipeline(&pipeline, image_buffer.data(), buffer.data(), shape.width,
+                                    shape.height);
+  std::memcpy(inputs, features_ptr, input_size);
+  free(features_ptr);
+  return true;
+}
+
+BatchLoader::Preprocess pipelinePreprocess(const Pipeline& pipeline, size_t input_size) {
+  return [&pipeline, input_size](const Image& image, float* inputs) {
+    // one buffer per producer thread
+    thread_local std::vector<u8> features;
+    features.resize(input_size);
+    if (not preprocessImage(pipeline, image, features.data(), input_size)) return false;
+
+    std::transform(features.begin(), features.end(), inputs,
+                   [](u8 v) { return (float) v * (1.f / 255.f); });
+    return true;
+  };
+}
+
+static bool fitsCrop(const Pipeline& pipeline) {
+  return pipeline.size > 0 and pipeline.stages[0].type == STAGE_CROP and
+         pipeline.stages[0].crop_mode == CROP_DATASET;
+}
+
+static void fitCrop(Pipeline& pipeline, const Image& image) {
+  if (image.getPixelType() != Image::PixelType::U8 or image.getNChannels() != 1) return;
+  pipeline_fit_crop(&pipeline, image.bytes(), image.getWidth(), image.getHeight());
+}
+
+void fitCrop(Pipeline& pipeline, const DatasetView& view) {
+  if (not fitsCrop(pipeline)) return;
+  for (size_t i = 0; i < view.getSize(); i++) fitCrop(pipeline, view.getImage(i));
+}
+
+void fitCrop(Pipeline& pipeline, LazyDataset& dataset) {
+  // Every image is loaded, only do it for a crop that needs them
+  if (not fitsCrop(pipeline)) return;
+  for (size_t i = 0; i < dataset.getSize(); i++) {
+    if (auto image = dataset.get(i)) fitCrop(pipeline, *image);
+  }
+}
+
+ViewSamples::ViewSamples(const DatasetView& view, const Pipeline& pipeline, size_t input_size)
+    : input_size(input_size), inputs(view.getSize() * input_size), labels(view.getSize()) {
+  for (size_t i = 0; i < view.getSize(); i++) {
+    if (preprocessImage(pipeline, view.getImage(i), &inputs[i * input_size], input_size)) {
+      labels[i] = view.getLabel(i);
+    } else {
+      labels[i] = -1;
+      failures++;
+    }
+  }
+}
+
+SampleSource ViewSamples::source() {
+  return {this, (u64) labels.size(), &ViewSamples::startEpoch, &ViewSamples::nextSample};
+}
+
+void ViewSamples::startEpoch(void* data, const u64* order, u64 size) {
+  auto* self = static_cast<ViewSamples*>(data);
+  self->order = order;
+  self->size = size;
+  self->position = 0;
+}
+
+int ViewSamples::nextSample(void* data, Layer* input_layer) {
+  auto* self = static_cast<ViewSamples*>(data);
+
+  while (self->position < self->size) {
+    u64 p = self->order ? self->order[self->position] : self->position;
+    self->position++;
+
+    if (self->labels[p] < 0) continue;
+    fill_input(input_layer, self->input_size, &self->inputs[p * self->input_size]);
+    return self->labels[p];
+  }
+  return -1;
+}
+
+LoaderSamples::LoaderSamples(LazyDataset& dataset, const Pipeline& pipeline,
+                             const BatchLoader::Options& options)
+    : size(dataset.getSize()), input_size(options.input_size),
+      loader(dataset, options, pipelinePreprocess(pipeline, options.input_size)) {}
+
+SampleSource LoaderSamples::source() {
+  return {this, (u64) size, &LoaderSamples::startEpoch, &LoaderSamples::nextSample};
+}
+
+void LoaderSamples::startEpoch(void* data, const u64* order, u64 size) {
+  auto* self = static_cast<LoaderSamples*>(data);
+
+  std::vector<size_t> positions(size);
+  if (order) std::copy(order, order + size, positions.begin());
+  else
+    std::iota(positions.begin(), positions.end(), 0);
+
+  self->batch = nullptr;
+  self->in_batch = 0;
+  self->loader.startEpoch(std::move(positions));
+}
+
+int LoaderSamples::nextSample(void* data, Layer* input_layer) {
+  auto* self = static_cast<LoaderSamples*>(data);
+
+  if (not self->batch or self->in_batch == self->batch->size()) {
+    self->batch = self->loader.next();
+    self->in_batch = 0;
+    if (not self->batch) return -1;
+  }
+
+  size_t k = self->in_batch++;
+  fill_input_f32(input_layer, self->input_size, &self->batch->inputs[k * self->input_size]);
+  return self->batch->labels[k];
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "BatchLoader.hpp"
+#include "DatasetView.hpp"
+#include "LazyDataset.hpp"
+#include <cstddef>
+#include <vector>
+
+// C headers
+
+extern "C" {
+#include "sample_source.h"
+}
+
+/**
+ * @brief Applies the preprocessing pipeline of the context to an image, as the C training does
+ * @param inputs Receives the input_size features of the image
+ * @return False if the image is not a single channel 8 bits image, or if its features do not
+ * match the input_size inputs of the network
+ */
+bool preprocessImage(const Pipeline& pipeline, const Image& image, u8* inputs, size_t input_size);
+
+/**
+ * @brief A preprocessing of the BatchLoader running the pipeline of the context, see
+ * preprocessImage. The features are scaled to [0, 1], as Image::toFloat and fill_input do
+ */
+BatchLoader::Preprocess pipelinePreprocess(const Pipeline& pipeline, size_t input_size);
+
+/**
+ * @brief Centers a dataset wide crop of the pipeline on the training images, see
+ * pipeline_fit_crop. Does nothing for the other pipelines
+ */
+void fitCrop(Pipeline& pipeline, const DatasetView& view);
+void fitCrop(Pipeline& pipeline, LazyDataset& dataset);
+
+/**
+ * @brief The images of a view, preprocessed once, as a source of samples for train_samples
+ * The images that cannot be preprocessed are left out of the epochs
+ */
+class ViewSamples {
+public:
+  ViewSamples(const DatasetView& view, const Pipeline& pipeline, size_t input_size);
+
+  ViewSamples(const ViewSamples&) = delete;
+  ViewSamples& operator=(const ViewSamples&) = delete;
+
+  /**
+   * @return The source reading the samples, valid as long as this object
+   */
+  [[nodiscard]] SampleSource source();
+
+  /**
+   * @return The number of images left out
+   */
+  [[nodiscard]] size_t getFailures() const { return failures; }
+
+private:
+  static void startEpoch(void* data, const u64* order, u64 size);
+  static int nextSample(void* data, Layer* input_layer);
+
+  size_t input_size;
+  std::vector<u8> inputs;// input_size features per image
+  std::vector<int> labels;// -1 for the images left out
+  size_t failures = 0;
+
+  const u64* order = nullptr;
+  u64 size = 0;
+  u64 position = 0;
+};
+
+/**
+ * @brief The images of a lazy dataset as a source of samples for train_samples. A BatchLoader
+ * loads and preprocesses the next batches of the epoch in the background while the network
+ * trains on the current one. The images that fail to load or to be preprocessed are left out
+ */
+class LoaderSamples {
+public:
+  /**
+   * @param dataset The dataset the images are read from, which must outlive the samples
+   * @param options The options of the loader, whose input_size is the one of the network
+   */
+  LoaderSamples(LazyDataset& dataset, const Pipeline& pipeline,
+                const BatchLoader::Options& options);
+
+  /**
+   * @return The source reading the samples, valid as long as this object
+   */
+  [[nodiscard]] SampleSource source();
+
+  [[nodiscard]] BatchLoader::Stats getStats() const { return loader.getStats(); }
+
+private:
+  static void startEpoch(void* data, const u64* order, u64 size);
+  static int nextSample(void* data, Layer* input_layer);
+
+  size_t size;
+  size_t input_size;
+  BatchLoader loader;
+
+  const Batch* batch = nullptr;
+  size_t in_batch = 0;// next sample of the batch
+};
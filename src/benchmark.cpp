@@ -0,0 +1,131 @@
+#include "ImageKernels.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// C headers
+
+extern "C" {
+#include "conv_layer.h"
+#include "convolution_layer.h"
+#include "neural_network.h"
+}
+
+// Compares the Winograd F(2x2, 3x3) and FFT paths with the direct ones, to find where they
+// pay off. Not built by default : make benchmark
+
+namespace {
+
+  template<typename F>
+  double bestOf(int runs, F&& f) {
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+    }
+    return best;
+  }
+
+  void benchmarkImageKernels(std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    float kernel[9];
+    for (auto& w: kernel) w = uniform(rng);
+    kernels::WinogradFilter filter(kernel);
+
+    std::printf("float 3x3 image convolution, 1 channel (ms)\n");
+    std::printf("%8s %10s %10s\n", "size", "direct", "winograd");
+    for (int size = 16; size <= 1024; size *= 2) {
+      std::vector<float> image((size_t) size * size), out((size_t) (size - 2) * (size - 2));
+      for (auto& v: image) v = uniform(rng);
+      auto in = kernels::ImageView<float>::planar(image.data(), size, size, 1);
+      auto output = kernels::ImageView<float>::planar(out.data(), size - 2, size - 2, 1);
+
+      int runs = 1 + (1 << 20) / (size * size);
+      double direct = bestOf(runs, [&] { kernels::convolve<float>(in, output, kernel, 3); });
+      double winograd = bestOf(runs, [&] { kernels::convolveWinograd(in, output, filter); });
+      std::printf("%8d %10.4f %10.4f\n", size, direct, winograd);
+    }
+  }
+
+  void benchmarkConvLayers(std::mt19937& rng) {
+    std::uniform_real_distribution<double> uniform(-0.5, 0.5);
+    const u64 size = 64;
+
+    std::printf("\n3x3 convolution layer forward pass on %llux%llu feature maps (ms)\n", size, size);
+    std::printf("%8s %8s %10s %10s\n", "channels", "filters", "im2col", "winograd");
+    for (u64 channels: {1, 2, 4, 8}) {
+      for (u64 filters: {1, 4, 8, 16, 32}) {
+        Layer* layer = create_conv_layer(channels, size, size, filters, 3, 1);
+        ConvShape* conv = layer->conv;
+        // built whatever the number of channels, for the comparison
+        Winograd* winograd = conv->winograd ? conv->winograd : create_winograd(conv);
+
+        for (u64 i = 0; i < layer->size; i++) layer->neurons[i] = uniform(rng);
+        for (u64 i = 0; i < layer_weights_size(layer, 0); i++) layer->weights[i] = uniform(rng);
+        for (u64 i = 0; i < filters; i++) layer->bias[i] = uniform(rng);
+
+        Layer next{};
+        std::vector<f64> neurons(filters * conv->out_height * conv->out_width);
+        next.neurons = neurons.data();
+
+        conv->winograd = nullptr;
+        double im2col = bestOf(5, [&] { compute_conv_layer(layer, &next); });
+        conv->winograd = winograd;
+        double fast = bestOf(5, [&] { compute_conv_layer(layer, &next); });
+
+        std::printf("%8llu %8llu %10.4f %10.4f\n", channels, filters, im2col, fast);
+
+        Layer** layers = (Layer**) malloc(sizeof(Layer*));
+        layers[0] = layer;
+        free_neural_network(layers, 1);
+      }
+    }
+  }
+
+  void benchmarkFilterBanks(std::mt19937& rng) {
+    const size_t width = 176, height = 208, kernels = 4;
+    std::vector<u8> image(width * height);
+    for (auto& v: image) v = (u8) rng();
+
+    std::printf("\n%zu kernels filter bank on %zux%zu images (ms)\n", kernels, width, height);
+    std::printf("%8s %10s %10s\n", "kernel", "direct", "fft");
+    for (u64 size = 3; size <= 31; size += 2) {
+      FilterBank bank{};
+      bank.size = kernels;
+      bank.kernels = (Kernel*) calloc(kernels, sizeof(Kernel));
+      for (size_t k = 0; k < kernels; k++) {
+        gabor_kernel(&bank.kernels[k], size, (f32) size / 4.f, (f32) k * 0.785f, (f32) size / 2.f,
+                     0.5f, 0.f);
+      }
+      BankFft fft;
+      init_bank_fft(&fft);
+      bank.fft = &fft;
+
+      size_t plane = (width - size + 1) * (height - size + 1);
+      std::vector<u8> output(kernels * plane);
+      double direct = bestOf(3, [&] {
+        apply_filter_bank_direct(image.data(), output.data(), height, width, &bank, 1, plane);
+      });
+      double spectral = bestOf(3, [&] {
+        apply_filter_bank_fft(image.data(), output.data(), height, width, &bank, 1, plane);
+      });
+      std::printf("%8llu %10.4f %10.4f\n", size, direct, spectral);
+
+      free_bank_fft(&fft);
+      for (size_t k = 0; k < kernels; k++) free_kernel(&bank.kernels[k]);
+      free(bank.kernels);
+    }
+  }
+
+}// namespace
+
+int main() {
+  std::mt19937 rng(42);
+  benchmarkImageKernels(rng);
+  benchmarkConvLayers(rng);
+  benchmarkFilterBanks(rng);
+  return 0;
+}
@@ -4,6 +4,129 @@
 
 // https://github.com/hyperrealm/libconfig/blob/master/examples/c/example1.c
 
+// Numbers of a list may be written either as integers or as floats
+static double get_number_elem(const config_setting_t* setting, int i) {
+  config_setting_t* elem = config_setting_get_elem(setting, i);
+  if (config_setting_type(elem) == CONFIG_TYPE_INT) return config_setting_get_int(elem);
+  return config_setting_get_float(elem);
+}
+
+// Number member of a group, written either as an integer or as a float
+static int lookup_number(const config_setting_t* setting, const char* name, double* value) {
+  config_setting_t* member = config_setting_get_member(setting, name);
+  if (member == NULL) return 0;
+  if (config_setting_type(member) == CONFIG_TYPE_INT) *value = config_setting_get_int(member);
+  else
+    *value = config_setting_get_float(member);
+  return 1;
+}
+
+// A kernel is either the name of a predefined kernel, or a group holding
+// its size and its size * size weights, or the parameters of a generated kernel
+static int load_kernel(const config_setting_t* setting, Kernel* kernel) {
+  if (config_setting_type(setting) == CONFIG_TYPE_STRING) {
+    const char* name = config_setting_get_string(setting);
+    if (kernel_from_name(name, kernel)) {
+      fprintf(stderr, "unknown kernel '%s'\n", name);
+      return -1;
+    }
+    return 0;
+  }
+
+  int size = 0;
+  config_setting_lookup_int(setting, "size", &size);
+
+  const char* type = NULL;
+  if (config_setting_lookup_string(setting, "type", &type)) {
+    double sigma = size / 6.0, theta = 0.0, lambda = size / 2.0, gamma = 0.5, psi = 0.0;
+    lookup_number(setting, "sigma", &sigma);
+    lookup_number(setting, "theta", &theta);
+    lookup_number(setting, "lambda", &lambda);
+    lookup_number(setting, "gamma", &gamma);
+    lookup_number(setting, "psi", &psi);
+
+    if (size <= 0 || sigma <= 0.0 || lambda <= 0.0) {
+      fprintf(stderr, "generated kernels need a positive size, sigma and lambda\n");
+      return -1;
+    }
+    if (strcmp(type, "gaussian") == 0) gaussian_kernel(kernel, size, sigma);
+    else if (strcmp(type, "gabor") == 0)
+      gabor_kernel(kernel, size, sigma, theta, lambda, gamma, psi);
+    else {
+      fprintf(stderr, "unknown kernel type '%s'\n", type);
+      return -1;
+    }
+    return 0;
+  }
+
+  config_setting_t* weights = config_setting_get_member(setting, "weights");
+
+  if (size <= 0 || weights == NULL || config_setting_length(weights) != size * size) {
+    fprintf(stderr, "custom kernels need a size and size * size weights\n");
+    return -1;
+  }
+
+  kernel->size = size;
+  kernel->weights = malloc(size * size * sizeof(f32));
+  for (int i = 0; i < size * size; i++) { kernel->weights[i] = get_number_elem(weights, i); }
+  return 0;
+}
+
+// A stage is either the name of a filter, or a group holding
+// the name of the filter (type) and its parameters
+static int load_stage(const config_setting_t* setting, Stage* stage) {
+  const char* name = NULL;
+
+  if (config_setting_type(setting) == CONFIG_TYPE_STRING) name = config_setting_get_string(setting);
+  else
+    config_setting_lookup_string(setting, "type", &name);
+
+  if (name == NULL || stage_from_name(name, stage)) {
+    fprintf(stderr, "unknown image filter '%s'\n", name ? name : "");
+    return -1;
+  }
+
+  if (config_setting_type(setting) != CONFIG_TYPE_GROUP) return 0;
+
+  // poolings tile the image unless a stride is given
+  if (config_setting_lookup_int(setting, "window", &stage->window)) stage->stride = stage->window;
+  config_setting_lookup_int(setting, "stride", &stage->stride);
+  config_setting_lookup_int(setting, "dilation", &stage->dilation);
+  config_setting_lookup_int(setting, "threshold", &stage->threshold);
+
+  int crop_width = 0, crop_height = 0;
+  if (config_setting_lookup_int(setting, "width", &crop_width)) stage->crop_width = crop_width;
+  if (config_setting_lookup_int(setting, "height", &crop_height)) stage->crop_height = crop_height;
+
+  const char* mode = NULL;
+  if (config_setting_lookup_string(setting, "mode", &mode))
+    stage->crop_mode = (strcmp(mode, "dataset") == 0) ? CROP_DATASET : CROP_IMAGE;
+
+  const char* magnitude = NULL;
+  if (config_setting_lookup_string(setting, "magnitude", &magnitude)) {
+    if (strcmp(magnitude, "l1") == 0) stage->magnitude = SOBEL_L1;
+    else if (strcmp(magnitude, "approx") == 0)
+      stage->magnitude = SOBEL_APPROX;
+    else
+      stage->magnitude = SOBEL_EXACT;
+  }
+
+  if (stage->type == STAGE_FILTER_BANK) {
+    const char* layout = "planar";
+    config_setting_lookup_string(setting, "layout", &layout);
+    stage->bank.layout = (strcmp(layout, "interleaved") == 0) ? BANK_INTERLEAVED : BANK_PLANAR;
+
+    config_setting_t* kernels = config_setting_get_member(setting, "kernels");
+    stage->bank.size = kernels ? config_setting_length(kernels) : 0;
+    stage->bank.kernels = calloc(stage->bank.size, sizeof(Kernel));
+
+    for (u64 k = 0; k < stage->bank.size; k++) {
+      if (load_kernel(config_setting_get_elem(kernels, k), &stage->bank.kernels[k])) return -1;
+    }
+  }
+  return 0;
+}
+
 int load_context(Context* context, const char* filename) {
 
   config_t cfg;
@@ -29,6 +152,14 @@ int load_context(Context* context, const char* filename) {
   config_lookup_string(&cfg, "output.storage", &buffer);
   strncpy(context->storage_dir, buffer, STRING_SIZE - 1);
 
+  context->compression = 0;
+  config_lookup_int(&cfg, "output.compression", &context->compression);
+  if (context->compression < 0 || context->compression > 9) {
+    fprintf(stderr, "output.compression must be a zlib level between 0 and 9\n");
+    config_destroy(&cfg);
+    return (EXIT_FAILURE);
+  }
+
   config_lookup_string(&cfg, "output.train_dat", &buffer);
   strncpy(context->train_dat_path, buffer, STRING_SIZE - 1);
 
@@ -38,6 +169,17 @@ int load_context(Context* context, const char* filename) {
 
   // dataset
   config_lookup_int(&cfg, "dataset.max_per_folder", &context->max_per_folder);
+  context->memory_mb = 0;
+  config_lookup_int(&cfg, "dataset.memory_mb", &context->memory_mb);
+  context->read_ahead = 64;
+  config_lookup_int(&cfg, "dataset.read_ahead", &context->read_ahead);
+  context->split_seed = 1234;
+  config_lookup_int(&cfg, "dataset.split_seed", &context->split_seed);
+  if (context->memory_mb < 0 || context->read_ahead < 0) {
+    fprintf(stderr, "dataset.memory_mb and dataset.read_ahead cannot be negative\n");
+    config_destroy(&cfg);
+    return (EXIT_FAILURE);
+  }
   // Train
   setting = config_lookup(&cfg, "dataset.train_dirs");
   context->train_dirs = malloc(2 * sizeof(char*));
@@ -58,11 +200,63 @@ int load_context(Context* context, const char* filename) {
 
 
   // nn
+  // the input geometry defaults to a single channel "line" of topology[0] neurons
   setting = config_lookup(&cfg, "nn.topology");
-  context->nn_size = config_setting_length(setting);
-  context->topology = malloc(context->nn_size * sizeof(int));
-  for (int i = 0; i < context->nn_size; i++) {
-    context->topology[i] = config_setting_get_int_elem(setting, i);
+  int dense_size = config_setting_length(setting);
+  context->input_channels = 1;
+  context->input_height = 1;
+  context->input_width = config_setting_get_int_elem(setting, 0);
+  config_lookup_int(&cfg, "nn.input.width", &context->input_width);
+  config_lookup_int(&cfg, "nn.input.height", &context->input_height);
+  config_lookup_int(&cfg, "nn.input.channels", &context->input_channels);
+
+  config_setting_t* conv_setting = config_lookup(&cfg, "nn.convolution");
+  context->conv_size = conv_setting ? config_setting_length(conv_setting) : 0;
+  context->conv = malloc((context->conv_size + 1) * sizeof(ConvSpec));
+
+  // topology[0] is the input, the output of each convolution layer is inserted after it.
+  // The extra trailing 0 is the "next size" of the output layer
+  context->nn_size = dense_size + context->conv_size;
+  context->topology = malloc((context->nn_size + 1) * sizeof(int));
+  context->topology[0] = context->input_channels * context->input_height * context->input_width;
+  context->topology[context->nn_size] = 0;
+
+  if (context->topology[0] != config_setting_get_int_elem(setting, 0)) {
+    fprintf(stderr, "nn.input (%d neurons) does not match nn.topology[0] (%d neurons)\n",
+            context->topology[0], config_setting_get_int_elem(setting, 0));
+    config_destroy(&cfg);
+    return (EXIT_FAILURE);
+  }
+
+  int channels = context->input_channels;
+  int height = context->input_height;
+  int width = context->input_width;
+
+  for (int i = 0; i < context->conv_size; i++) {
+    config_setting_t* layer = config_setting_get_elem(conv_setting, i);
+    ConvSpec* spec = &context->conv[i];
+    spec->filters = 1;
+    spec->kernel = 3;
+    spec->stride = 1;
+    config_setting_lookup_int(layer, "filters", &spec->filters);
+    config_setting_lookup_int(layer, "kernel", &spec->kernel);
+    config_setting_lookup_int(layer, "stride", &spec->stride);
+
+    if (spec->kernel > height || spec->kernel > width || spec->stride < 1) {
+      fprintf(stderr, "nn.convolution[%d] : kernel %d does not fit a %dx%d input\n", i,
+              spec->kernel, width, height);
+      config_destroy(&cfg);
+      return (EXIT_FAILURE);
+    }
+
+    channels = spec->filters;
+    height = (height - spec->kernel) / spec->stride + 1;
+    width = (width - spec->kernel) / spec->stride + 1;
+    context->topology[i + 1] = channels * height * width;
+  }
+
+  for (int i = 1; i < dense_size; i++) {
+    context->topology[context->conv_size + i] = config_setting_get_int_elem(setting, i);
   }
 
   // training
@@ -71,6 +265,53 @@ int load_context(Context* context, const char* filename) {
   config_lookup_float(&cfg, "training.precision", &context->precision);
   config_lookup_float(&cfg, "training.alpha", &context->alpha_);
   config_lookup_float(&cfg, "training.eta", &context->eta_);
+  context->checkpoint_every = 0;
+  config_lookup_int(&cfg, "training.checkpoint_every", &context->checkpoint_every);
+
+  // image
+  context->width = IMAGE_WIDTH;
+  context->height = IMAGE_HEIGHT;
+  config_lookup_int(&cfg, "image.width", &context->width);
+  config_lookup_int(&cfg, "image.height", &context->height);
+
+  int tile_kb = 0;
+  config_lookup_int(&cfg, "image.tile_kb", &tile_kb);
+  int batch = 1;
+  config_lookup_int(&cfg, "image.batch", &batch);
+
+  setting = config_lookup(&cfg, "image.filters");
+  if (setting == NULL) {
+    default_pipeline(&context->pipeline);
+  } else {
+    init_pipeline(&context->pipeline);
+    for (int i = 0; i < config_setting_length(setting); i++) {
+      // freed with the pipeline even when it fails to load before its type is known
+      Stage stage = {0};
+      int err = load_stage(config_setting_get_elem(setting, i), &stage);
+      pipeline_add_stage(&context->pipeline, &stage);
+      if (err) {
+        config_destroy(&cfg);
+        return (EXIT_FAILURE);
+      }
+    }
+  }
+
+  context->pipeline.tile_bytes = (size_t) tile_kb * 1024;
+  context->pipeline.batch = batch;
+
+  FeatureShape image_shape = {context->width, context->height, 1};
+  if (check_pipeline(&context->pipeline, image_shape)) {
+    config_destroy(&cfg);
+    return (EXIT_FAILURE);
+  }
+
+  FeatureShape features = pipeline_output_shape(&context->pipeline, image_shape);
+  if (features.width * features.height * features.channels != (size_t) context->topology[0]) {
+    fprintf(stderr, "image.filters produce %zu features but the network takes %d inputs\n",
+            features.width * features.height * features.channels, context->topology[0]);
+    config_destroy(&cfg);
+    return (EXIT_FAILURE);
+  }
 
   config_destroy(&cfg);
   return 0;
@@ -90,8 +331,18 @@ int info_context(Context* context) {
   for (int i = 0; i < 2; i++) { printf("-> '%s' \n", context->test_dirs[i]); }
 
 
+  printf("\n");
+  if (context->memory_mb > 0) {
+    printf("dataset memory : %d MB, read ahead %d images \n", context->memory_mb,
+           context->read_ahead);
+  } else {
+    printf("dataset memory : whole dataset \n");
+  }
+  printf("split seed : %d \n", context->split_seed);
+
   printf("\n");
   printf("storage dirs : '%s' \n", context->storage_dir);
+  printf("model compression : %d \n", context->compression);
   printf("train dat dirs : '%s' \n", context->train_dat_path);
   printf("test  dat dirs : '%s' \n", context->test_dat_path);
 
@@ -100,6 +351,12 @@ int info_context(Context* context) {
   printf(" NN : \n ");
   for (int i = 0; i < context->nn_size; i++) { printf(" %d ", context->topology[i]); }
   printf("\nnn size : %d \n", context->nn_size);
+  printf("input : %dx%dx%d \n", context->input_channels, context->input_height,
+         context->input_width);
+  for (int i = 0; i < context->conv_size; i++) {
+    printf("conv %d : %d filters, kernel %d, stride %d \n", i, context->conv[i].filters,
+           context->conv[i].kernel, context->conv[i].stride);
+  }
 
 
   printf("\n");
@@ -108,6 +365,12 @@ int info_context(Context* context) {
   printf("precision : %f \n", context->precision);
   printf("alpha : %f \n", context->alpha_);
   printf("eta : %f \n", context->eta_);
+  printf("checkpoint every : %d epochs \n", context->checkpoint_every);
+
+
+  printf("\n");
+  printf("image : %dx%d, %llu filters \n", context->width, context->height,
+         context->pipeline.size);
 
 
   return 0;
@@ -125,6 +388,8 @@ int free_context(Context* context) {
   free(context->train_dat_path);
   free(context->test_dat_path);
   free(context->topology);
+  free(context->conv);
+  free_pipeline(&context->pipeline);
 
 
   return 0;
@@ -7,38 +7,58 @@
 #include <libconfig.h>
 
 #include "global.h"
+#include "pipeline.h"
 #include "type.h"
 
 #define STRING_SIZE 50
 
+// Trainable convolution layer, see nn.convolution in the config
+typedef struct {
+  int filters;
+  int kernel;
+  int stride;
+} ConvSpec;
+
 typedef struct {
   const char* context_path;
 
   // ouput
   char* storage_dir;
+  int compression;// zlib level of the stored model, 1 (fastest) to 9 (smallest), 0 stores it raw
   char* train_dat_path;
   char* test_dat_path;
 
   // dataset
   int max_per_folder;
+  int memory_mb; // decoded images kept in memory, 0 loads the whole dataset at once
+  int read_ahead;// images decoded ahead of the training when memory_mb is set
+  int split_seed;// seed of the training / testing split (1234), a resumed training keeps its split
   char** train_dirs;
   char** test_dirs;
 
   // nn
-  int* topology;
+  int* topology;// neurons per layer, including the outputs of the convolution layers
   int nn_size;
 
+  // convolution layers, placed between the input and the dense layers
+  ConvSpec* conv;
+  int conv_size;
+  int input_width;
+  int input_height;
+  int input_channels;
+
   // training
   int do_test;
   int max_epoch;
   double precision;
   double alpha_;
   double eta_;
+  int checkpoint_every;// epochs between two checkpoints of the model, 0 to disable
 
-  //
+  // image preprocessing
   int width;
   int height;
-  int filters;// TODO
+  Pipeline pipeline;
 
 } Context;
 
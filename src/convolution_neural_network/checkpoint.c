@@ -0,0 +1,118 @@
+#include "checkpoint.h"
+
+/*  Copies every array stored in a model file from one network to another of the same topology */
+static void copy_neural_network(Context* context, Layer** dst, Layer** src) {
+  for (u64 i = 0; i < (u64) context->nn_size - 1; i++) {
+    u64 next_size = context->topology[i + 1];
+    u64 weights_size = layer_weights_size(src[i], next_size) * sizeof(f64);
+    u64 bias_size = layer_bias_size(src[i], next_size) * sizeof(f64);
+    u64 size = src[i]->size * sizeof(f64);
+
+    memcpy(dst[i]->weights, src[i]->weights, weights_size);
+    memcpy(dst[i]->bias, src[i]->bias, bias_size);
+    memcpy(dst[i]->delta_weights, src[i]->delta_weights, weights_size);
+    memcpy(dst[i]->delta_bias, src[i]->delta_bias, bias_size);
+    memcpy(dst[i]->neurons, src[i]->neurons, size);
+    memcpy(dst[i]->delta_neurons, src[i]->delta_neurons, size);
+  }
+}
+
+/*  Background thread : stores each snapshot it is handed, until stopped */
+static void* checkpoint_thread(void* arg) {
+  Checkpointer* checkpointer = arg;
+
+  pthread_mutex_lock(&checkpointer->lock);
+  while (1) {
+    while (!checkpointer->pending && !checkpointer->stop) {
+      pthread_cond_wait(&checkpointer->cond, &checkpointer->lock);
+    }
+    if (!checkpointer->pending) break;
+
+    checkpointer->pending = 0;
+    checkpointer->writing = 1;
+    pthread_mutex_unlock(&checkpointer->lock);
+
+    int stored = store_neural_network(checkpointer->context, checkpointer->snapshot,
+                                      &checkpointer->state);
+
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->writing = 0;
+    if (stored) checkpointer->written++;
+    else
+      checkpointer->failed++;
+  }
+  pthread_mutex_unlock(&checkpointer->lock);
+
+  return NULL;
+}
+
+void init_checkpointer(Checkpointer* checkpointer, Context* context) {
+  memset(checkpointer, 0, sizeof(Checkpointer));
+  checkpointer->context = context;
+  checkpointer->snapshot = init_neural_network_from_context(context);
+  init_training_state(&checkpointer->state);
+
+  pthread_mutex_init(&checkpointer->lock, NULL);
+  pthread_cond_init(&checkpointer->cond, NULL);
+  pthread_create(&checkpointer->thread, NULL, checkpoint_thread, checkpointer);
+}
+
+/*  The thread only reads the snapshot between pending and the end of its write,
+    so it can be refilled without holding the lock */
+int checkpoint(Checkpointer* checkpointer, Layer** layers, const TrainingState* state) {
+  pthread_mutex_lock(&checkpointer->lock);
+  int busy = checkpointer->pending || checkpointer->writing;
+  if (busy) checkpointer->skipped++;
+  checkpointer->skipped_layers = busy ? layers : NULL;
+  checkpointer->skipped_state = busy ? state : NULL;
+  pthread_mutex_unlock(&checkpointer->lock);
+
+  if (busy) return 0;
+
+  copy_neural_network(checkpointer->context, checkpointer->snapshot, layers);
+
+  TrainingState* snapshot_state = &checkpointer->state;
+  if (snapshot_state->size != state->size) {
+    free(snapshot_state->permutation);
+    snapshot_state->permutation = malloc(state->size * sizeof(u64));
+    snapshot_state->size = state->size;
+  }
+  memcpy(snapshot_state->permutation, state->permutation, state->size * sizeof(u64));
+  snapshot_state->epoch = state->epoch;
+  snapshot_state->rng = state->rng;
+
+  pthread_mutex_lock(&checkpointer->lock);
+  checkpointer->pending = 1;
+  pthread_cond_signal(&checkpointer->cond);
+  pthread_mutex_unlock(&checkpointer->lock);
+
+  return 1;
+}
+
+void free_checkpointer(Checkpointer* checkpointer) {
+  pthread_mutex_lock(&checkpointer->lock);
+  checkpointer->stop = 1;
+  pthread_cond_signal(&checkpointer->cond);
+  pthread_mutex_unlock(&checkpointer->lock);
+
+  pthread_join(checkpointer->thread, NULL);
+
+  // the training may be over : a skipped checkpoint is not left for the next one
+  if (checkpointer->skipped_layers) {
+    if (store_neural_network(checkpointer->context, checkpointer->skipped_layers,
+                             checkpointer->skipped_state))
+      checkpointer->written++;
+    else
+      checkpointer->failed++;
+  }
+
+  if (checkpointer->failed || checkpointer->skipped) {
+    fprintf(stderr, "checkpoints : %llu written, %llu skipped, %llu failed\n",
+            checkpointer->written, checkpointer->skipped, checkpointer->failed);
+  }
+
+  pthread_mutex_destroy(&checkpointer->lock);
+  pthread_cond_destroy(&checkpointer->cond);
+  free_neural_network(checkpointer->snapshot, checkpointer->context->nn_size);
+  free_training_state(&checkpointer->state);
+}
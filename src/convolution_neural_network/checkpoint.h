@@ -0,0 +1,49 @@
+#pragma once
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/type.h"
+#include "context.h"
+#include "neural_network.h"
+#include "store.h"
+
+// Periodic saves of the model during the training, see training.checkpoint_every.
+// The trainer copies the network and its training state into a snapshot, which a background
+// thread stores with store_neural_network while the training goes on : a checkpoint only costs
+// the training loop that copy. When the previous snapshot is still being written, the new
+// checkpoint is skipped rather than waited for, the next one will be more recent anyway.
+// When the last checkpoint of the training was skipped, free_checkpointer stores the network
+// and the state it was given itself, so the latest weights are always saved
+
+typedef struct {
+  Context* context;
+  Layer** snapshot;
+  TrainingState state;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  int pending;// the snapshot waits for the thread
+  int writing;// the thread is storing the snapshot
+  int stop;
+
+  // the arguments of the last checkpoint when it was skipped, NULL otherwise
+  Layer** skipped_layers;
+  const TrainingState* skipped_state;
+
+  u64 written;
+  u64 skipped;
+  u64 failed;
+} Checkpointer;
+
+void init_checkpointer(Checkpointer* checkpointer, Context* context);
+// Returns 1 if a snapshot of the layers and the state was taken,
+// 0 if the previous one is still written : the layers and the state must then stay alive
+// until the next checkpoint or free_checkpointer
+int checkpoint(Checkpointer* checkpointer, Layer** layers, const TrainingState* state);
+// Waits for the last snapshot to be written, then stores the layers and the state of the last
+// checkpoint if it was skipped
+void free_checkpointer(Checkpointer* checkpointer);
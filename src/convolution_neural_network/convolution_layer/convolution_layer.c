@@ -10,7 +10,7 @@ https://github.com/randy408/libspng/blob/v0.7.2/examples/example.c
 
 #include "convolution_layer.h"
 
-i32 convolve_baseline(u8* m, i32* f, u64 fh, u64 fw, size_t height, size_t width) {
+i32 convolve_baseline(u8* m, i32* f, u64 fh, u64 fw, size_t width) {
   i32 r = 0;
 
   for (u64 i = 0; i < fh; i++)
@@ -22,29 +22,114 @@ i32 convolve_baseline(u8* m, i32* f, u64 fh, u64 fw, size_t height, size_t width
   return r;
 }
 
-//
-void sobel_3X3(u8** image, u8** buffer, size_t* height, size_t* width, int threshold) {
-  f64 gx, gy;
-  f32 mag = 0.0;
-
-  i32 f1[9] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};// 3x3 matrix
+/*  Sobel magnitude of one pixel, scalar version of sobel_row */
+static u8 sobel_pixel(const u8* r0, const u8* r1, const u8* r2, int threshold,
+                      SobelMagnitude magnitude) {
+  i32 gx = (r0[2] - r0[0]) + 2 * (r1[2] - r1[0]) + (r2[2] - r2[0]);
+  i32 gy = (r2[0] + 2 * r2[1] + r2[2]) - (r0[0] + 2 * r0[1] + r0[2]);
+  i32 ax = abs(gx), ay = abs(gy);
+  i32 mag;
+
+  switch (magnitude) {
+    case SOBEL_L1:
+      mag = ax + ay;
+      break;
+    case SOBEL_APPROX:
+      // alpha max plus beta min, with alpha = 1 and beta = 3/8
+      mag = (ax > ay) ? ax + ((3 * ay) >> 3) : ay + ((3 * ax) >> 3);
+      break;
+    default:
+      if (gx * gx + gy * gy > threshold * threshold) return 255;
+      mag = (i32) sqrtf((f32) (gx * gx + gy * gy));
+      break;
+  }
 
-  i32 f2[9] = {-1, -2, -1, 0, 0, 0, 1, 2, 1};// 3x3 matrix
+  if (mag > threshold) return 255;
+  return (mag > 255) ? 255 : mag;
+}
 
-  //
-  for (u64 i = 0; i < (*height - 3); i++) {
-    for (u64 j = 0; j < (*width - 3); j++) {
-      // printf("gx : %d\n", (*image)[ i * (*width) + j ] );
-      gx = convolve_baseline(&((*image)[i * (*width) + j]), f1, 3, 3, *height, *width);
-      gy = convolve_baseline(&((*image)[i * (*width) + j]), f2, 3, 3, *height, *width);
+#ifdef __SSE2__
+/*  Absolute value of 8 signed 16 bits integers (SSE2 has no pabsw) */
+static inline __m128i abs_epi16(__m128i v) {
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
 
-      mag = sqrt((gx * gx) + (gy * gy));
-      // printf("gx : %f\n",gy);
-      // printf("gy : %f\n",gx);
-      // printf("mag : %f\n",mag);
-      (*buffer)[i * (*width - 2) + j] = (mag > threshold) ? 255 : mag;
+/*  Loads 8 pixels as 16 bits integers */
+static inline __m128i load_epu8_epi16(const u8* p) {
+  return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) p), _mm_setzero_si128());
+}
+#endif
+
+/*  Sobel magnitude of a row of output pixels.
+    Gradients are computed on 16 bits integers, 8 pixels at a time, and the threshold
+    is applied in register : the exact magnitude is compared squared, so only
+    the pixels under the threshold need their square root */
+static void sobel_row(const u8* r0, const u8* r1, const u8* r2, u8* out, size_t n,
+                      int threshold, SobelMagnitude magnitude) {
+  size_t x = 0;
+
+#ifdef __SSE2__
+  const __m128i thr = _mm_set1_epi16((short) (threshold < 32767 ? threshold : 32767));
+  const __m128i thr_sq = _mm_set1_epi32(threshold * threshold);
+  const __m128i white = _mm_set1_epi16(255);
+
+  for (; x + 8 <= n; x += 8) {
+    __m128i a0 = load_epu8_epi16(r0 + x), a1 = load_epu8_epi16(r0 + x + 1),
+            a2 = load_epu8_epi16(r0 + x + 2);
+    __m128i b0 = load_epu8_epi16(r1 + x), b2 = load_epu8_epi16(r1 + x + 2);
+    __m128i c0 = load_epu8_epi16(r2 + x), c1 = load_epu8_epi16(r2 + x + 1),
+            c2 = load_epu8_epi16(r2 + x + 2);
+
+    // gx = (a2 - a0) + 2 (b2 - b0) + (c2 - c0), gy = (c0 + 2 c1 + c2) - (a0 + 2 a1 + a2)
+    __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(a2, a0), _mm_sub_epi16(c2, c0)),
+                               _mm_slli_epi16(_mm_sub_epi16(b2, b0), 1));
+    __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(c0, c2), _mm_slli_epi16(c1, 1)),
+                               _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_slli_epi16(a1, 1)));
+
+    __m128i mag, above;
+
+    if (magnitude == SOBEL_EXACT) {
+      // gx^2 + gy^2 as 32 bits integers, pairs (gx, gy) through madd
+      __m128i lo = _mm_unpacklo_epi16(gx, gy);
+      __m128i hi = _mm_unpackhi_epi16(gx, gy);
+      __m128i sq_lo = _mm_madd_epi16(lo, lo);
+      __m128i sq_hi = _mm_madd_epi16(hi, hi);
+
+      above = _mm_packs_epi32(_mm_cmpgt_epi32(sq_lo, thr_sq), _mm_cmpgt_epi32(sq_hi, thr_sq));
+      mag = _mm_packs_epi32(_mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_lo))),
+                            _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_hi))));
+    } else {
+      __m128i ax = abs_epi16(gx), ay = abs_epi16(gy);
+
+      if (magnitude == SOBEL_L1) {
+        mag = _mm_add_epi16(ax, ay);
+      } else {
+        __m128i mx = _mm_max_epi16(ax, ay), mn = _mm_min_epi16(ax, ay);
+        mag = _mm_add_epi16(mx, _mm_srli_epi16(_mm_add_epi16(mn, _mm_slli_epi16(mn, 1)), 3));
+      }
+      above = _mm_cmpgt_epi16(mag, thr);
     }
+
+    // 255 above the threshold, the saturated magnitude otherwise
+    mag = _mm_or_si128(_mm_andnot_si128(above, mag), _mm_and_si128(above, white));
+    _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(mag, mag));
+  }
+#endif
+
+  for (; x < n; x++) { out[x] = sobel_pixel(r0 + x, r1 + x, r2 + x, threshold, magnitude); }
+}
+
+/*  Sobel edge detection, pixels whose gradient magnitude is above the threshold are set to 255 */
+void sobel_3X3_magnitude(u8** image, u8** buffer, size_t* height, size_t* width, int threshold,
+                         SobelMagnitude magnitude) {
+  size_t out_width = *width - 2;
+
+  for (u64 i = 0; i < (*height - 2); i++) {
+    const u8* r0 = (*image) + i * (*width);
+    sobel_row(r0, r0 + *width, r0 + 2 * (*width), (*buffer) + i * out_width, out_width, threshold,
+              magnitude);
   }
+
   // update size
   *height = *height - 2;
   *width = *width - 2;
@@ -56,29 +141,52 @@ void sobel_3X3(u8** image, u8** buffer, size_t* height, size_t* width, int thres
   *buffer = tmp;
 }
 
-/*  Convolution using a 3x3 kernel filter (unused at the moment) */
-void convolution_3X3(u8** image, u8** buffer, size_t* height, size_t* width,
-                     const u8* kernel_filter, int stride) {
-  for (u64 i = 0; i < *height - 2; i += stride) {
-    for (u64 j = 0; j < *width - 2; j += stride) {
-
-      u64 s = 0;
-      for (size_t ik = 0; ik < 3; ik++) {
-        for (size_t jk = 0; jk < 3; jk++) {
-          u64 filter_idx = ik * 3 + jk;
-          u64 image_idx = (i + ik) * (*width) + (j + jk);
-          s += (*image)[image_idx] * kernel_filter[filter_idx];
+//
+void sobel_3X3(u8** image, u8** buffer, size_t* height, size_t* width, int threshold) {
+  sobel_3X3_magnitude(image, buffer, height, width, threshold, SOBEL_EXACT);
+}
+
+/*  Convolution using a kernel_size x kernel_size kernel filter, the sum being divided by divisor.
+    The kernel taps are spaced by dilation pixels, and only one output pixel out of stride
+    is computed in each direction : the output is
+    ((height - span) / stride + 1) x ((width - span) / stride + 1), span = (kernel_size - 1) * dilation + 1
+    Sums are accumulated a whole output row at a time, skipping the zero weights of the kernel */
+void convolution(u8** image, u8** buffer, size_t* height, size_t* width, const u8* kernel_filter,
+                 size_t kernel_size, u32 divisor, int stride, int dilation) {
+  size_t span = (kernel_size - 1) * dilation + 1;
+  size_t out_height = (*height - span) / stride + 1;
+  size_t out_width = (*width - span) / stride + 1;
+
+  u32* acc = malloc(out_width * sizeof(u32));
+
+  for (u64 i = 0; i < out_height; i++) {
+    memset(acc, 0, out_width * sizeof(u32));
+
+    for (size_t ik = 0; ik < kernel_size; ik++) {
+      const u8* row = (*image) + (i * stride + ik * dilation) * (*width);
+
+      for (size_t jk = 0; jk < kernel_size; jk++) {
+        u32 weight = kernel_filter[ik * kernel_size + jk];
+        if (weight == 0) continue;
+
+        const u8* src = row + jk * dilation;
+        if (stride == 1) {
+          for (u64 j = 0; j < out_width; j++) { acc[j] += weight * src[j]; }
+        } else {
+          for (u64 j = 0; j < out_width; j++) { acc[j] += weight * src[j * stride]; }
         }
       }
-
-      u64 buffer_idx = i * (*width - 2) + j;
-      (*buffer)[buffer_idx] = (u8) (s / 5);
     }
+
+    u8* out = (*buffer) + i * out_width;
+    for (u64 j = 0; j < out_width; j++) { out[j] = (u8) (acc[j] / divisor); }
   }
 
+  free(acc);
+
   // update size
-  *height = *height - 2;
-  *width = *width - 2;
+  *height = out_height;
+  *width = out_width;
 
   // swap buffer <=> image
   u8* tmp;
@@ -87,32 +195,96 @@ void convolution_3X3(u8** image, u8** buffer, size_t* height, size_t* width,
   *buffer = tmp;
 }
 
+/*  Convolution using a 3x3 kernel filter */
+void convolution_3X3(u8** image, u8** buffer, size_t* height, size_t* width,
+                     const u8* kernel_filter, int stride) {
+  convolution(image, buffer, height, width, kernel_filter, 3, 5, stride, 1);
+}
+
 
 /*  Convolution using a 5x5 kernel filter */
 void convolution_5X5(u8** image, u8** buffer, size_t* height, size_t* width,
                      const u8* kernel_filter, int stride) {
+  convolution(image, buffer, height, width, kernel_filter, 5, 9, stride, 1);
+}
+
+/*  dst = max(a, b) for n pixels */
+static void max_rows(const u8* a, const u8* b, u8* dst, size_t n) {
+  size_t x = 0;
+#ifdef __SSE2__
+  for (; x + 16 <= n; x += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i*) (a + x));
+    __m128i vb = _mm_loadu_si128((const __m128i*) (b + x));
+    _mm_storeu_si128((__m128i*) (dst + x), _mm_max_epu8(va, vb));
+  }
+#endif
+  for (; x < n; x++) dst[x] = (a[x] > b[x]) ? a[x] : b[x];
+}
 
+/*  Maxpool over window x window tiles, one tile every stride pixels.
+    The output is ((height - window) / stride + 1) x ((width - window) / stride + 1).
+    Uses the van Herk / Gil-Werman running maximum : the input is cut in blocks of window
+    rows (columns), whose prefix and suffix maxima give the maximum of any window with
+    a single comparison, so the cost per pixel does not depend on the size of the window.
+    The vertical pass works on whole rows with byte wise max instructions */
+void max_pool(u8** image, u8** buffer, size_t* height, size_t* width, size_t window,
+              size_t stride) {
+  size_t out_height = (*height - window) / stride + 1;
+  size_t out_width = (*width - window) / stride + 1;
+  size_t w = *width;
+
+  // prefix and suffix maxima of the rows inside each block of window rows
+  u8* prefix = malloc(*height * w);
+  u8* suffix = malloc(*height * w);
+  for (size_t i = 0; i < *height; i++) {
+    const u8* row = (*image) + i * w;
+    if (i % window == 0) memcpy(prefix + i * w, row, w);
+    else
+      max_rows(prefix + (i - 1) * w, row, prefix + i * w, w);
+  }
+  for (size_t i = *height; i-- > 0;) {
+    const u8* row = (*image) + i * w;
+    if (i % window == window - 1 || i == *height - 1) memcpy(suffix + i * w, row, w);
+    else
+      max_rows(suffix + (i + 1) * w, row, suffix + i * w, w);
+  }
 
-  for (u64 i = 0; i < *height - 4; i += stride) {
-    for (u64 j = 0; j < *width - 4; j += stride) {
+  u8* column_max = malloc(w);
+  u8* hprefix = malloc(w);
+  u8* hsuffix = malloc(w);
 
-      u64 s = 0;
-      for (size_t ik = 0; ik < 5; ik++) {
-        for (size_t jk = 0; jk < 5; jk++) {
-          u64 filter_idx = ik * 5 + jk;
-          u64 image_idx = (i + ik) * (*width) + (j + jk);
-          s += (*image)[image_idx] * kernel_filter[filter_idx];
-        }
-      }
+  for (size_t y = 0; y < out_height; y++) {
+    // maximum of each column over the rows [r, r + window)
+    size_t r = y * stride;
+    max_rows(suffix + r * w, prefix + (r + window - 1) * w, column_max, w);
 
-      u64 buffer_idx = i * (*width - 4) + j;
-      (*buffer)[buffer_idx] = (u8) (s / 9);
+    // same on the columns of the row
+    for (size_t x = 0; x < w; x++) {
+      hprefix[x] = (x % window == 0 || column_max[x] > hprefix[x - 1]) ? column_max[x]
+                                                                       : hprefix[x - 1];
+    }
+    for (size_t x = w; x-- > 0;) {
+      hsuffix[x] = (x % window == window - 1 || x == w - 1 || column_max[x] > hsuffix[x + 1])
+                           ? column_max[x]
+                           : hsuffix[x + 1];
+    }
+
+    u8* out = (*buffer) + y * out_width;
+    for (size_t x = 0; x < out_width; x++) {
+      size_t c = x * stride;
+      out[x] = (hsuffix[c] > hprefix[c + window - 1]) ? hsuffix[c] : hprefix[c + window - 1];
     }
   }
 
+  free(prefix);
+  free(suffix);
+  free(column_max);
+  free(hprefix);
+  free(hsuffix);
+
   // update size
-  *height = *height - 4;
-  *width = *width - 4;
+  *height = out_height;
+  *width = out_width;
 
   // swap buffer <=> image
   u8* tmp;
@@ -121,24 +293,66 @@ void convolution_5X5(u8** image, u8** buffer, size_t* height, size_t* width,
   *buffer = tmp;
 }
 
-/*  Maxpool using a 3x3 sized tile (unused at the moment) */
-// void max_pool_3X3(unsigned char * conv_image, size_t height, size_t width, unsigned char *
-// pool_image) {
-//     int max = 0;
-//     for (size_t i = 1; i < height-1; i++) {
-//         for (size_t j = 1; j < width-1; j++) {
-//             max = 0;
-//             for (int ik = -1; ik < 2; ik++) {
-//                 for (int jk = -1; jk < 2; jk++) {
-//                     if (conv_image[(i+ik)*width + (j+jk)] > max) {
-//                         max = conv_image[(i+ik)*width + (j+jk)];
-//                     }
-//                 }
-//             }
-//             pool_image[(i-1)*(width-2) + (j-1)] = max;
-//         }
-//     }
-// }
+/*  Avgpool over window x window tiles, one tile every stride pixels, the average is truncated.
+    The column sums of the window are updated from one output row to the next by adding the
+    rows entering the window and subtracting the rows leaving it, then each output pixel is
+    the difference of two prefix sums of the row : every input row is added and subtracted
+    once, whatever the size of the window */
+void avg_pool(u8** image, u8** buffer, size_t* height, size_t* width, size_t window,
+              size_t stride) {
+  size_t out_height = (*height - window) / stride + 1;
+  size_t out_width = (*width - window) / stride + 1;
+  size_t w = *width;
+  u32 area = (u32) (window * window);
+
+  u32* column_sum = calloc(w, sizeof(u32));
+  u32* prefix = malloc((w + 1) * sizeof(u32));
+
+  // rows [begin, end) are summed in column_sum
+  size_t begin = 0, end = 0;
+
+  for (size_t y = 0; y < out_height; y++) {
+    size_t r = y * stride;
+
+    for (; begin < r && begin < end; begin++) {
+      const u8* row = (*image) + begin * w;
+      for (size_t x = 0; x < w; x++) column_sum[x] -= row[x];
+    }
+    begin = r;
+    if (end < begin) end = begin;
+    for (; end < r + window; end++) {
+      const u8* row = (*image) + end * w;
+      for (size_t x = 0; x < w; x++) column_sum[x] += row[x];
+    }
+
+    prefix[0] = 0;
+    for (size_t x = 0; x < w; x++) prefix[x + 1] = prefix[x] + column_sum[x];
+
+    u8* out = (*buffer) + y * out_width;
+    for (size_t x = 0; x < out_width; x++) {
+      size_t c = x * stride;
+      out[x] = (u8) ((prefix[c + window] - prefix[c]) / area);
+    }
+  }
+
+  free(column_sum);
+  free(prefix);
+
+  // update size
+  *height = out_height;
+  *width = out_width;
+
+  // swap buffer <=> image
+  u8* tmp;
+  tmp = *image;
+  *image = *buffer;
+  *buffer = tmp;
+}
+
+/*  Maxpool using a 3x3 sized tile, moving one pixel at a time */
+void max_pool_3X3(u8** image, u8** buffer, size_t* height, size_t* width) {
+  max_pool(image, buffer, height, width, 3, 1);
+}
 
 /*  Maxpool using a 2x2 sized tile */
 void max_pool_2X2(u8** image, u8** buffer, size_t* height, size_t* width) {
@@ -155,7 +369,7 @@ void max_pool_2X2(u8** image, u8** buffer, size_t* height, size_t* width) {
         }
       }
 
-      (*buffer)[(i / 2) * ((*width) / 2) + (j / 2)] = val;
+      (*buffer)[(i / 2) * ((*width) / 2) + (j / 2)] = max;
     }
   }
 
@@ -195,14 +409,494 @@ void avg_pool_2X2(u8** image, u8** buffer, size_t* height, size_t* width) {
 }
 
 
+/*  Bounding box of the pixels above threshold, returns 0 (and an empty box) if there are none.
+    Each row is compared 16 pixels at a time with a saturated subtraction, which is non zero
+    exactly above the threshold. The results are or'ed into a column mask, so the left and
+    right bounds are found with a single scan of the mask at the end */
+int foreground_box(const u8* image, size_t height, size_t width, int threshold, BoundingBox* box) {
+  u8 thr = (u8) ((threshold < 0) ? 0 : (threshold > 255) ? 255 : threshold);
+  u8* columns = calloc(width, sizeof(u8));
+
+  box->left = box->top = box->right = box->bottom = 0;
+  int found = 0;
+
+  for (size_t i = 0; i < height; i++) {
+    const u8* row = image + i * width;
+    u8 any = 0;
+    size_t x = 0;
+
+#ifdef __SSE2__
+    __m128i vthr = _mm_set1_epi8((char) thr);
+    __m128i row_any = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+      __m128i above = _mm_subs_epu8(_mm_loadu_si128((const __m128i*) (row + x)), vthr);
+      __m128i cols = _mm_loadu_si128((const __m128i*) (columns + x));
+      _mm_storeu_si128((__m128i*) (columns + x), _mm_or_si128(cols, above));
+      row_any = _mm_or_si128(row_any, above);
+    }
+    any = _mm_movemask_epi8(_mm_cmpeq_epi8(row_any, _mm_setzero_si128())) != 0xFFFF;
+#endif
+
+    for (; x < width; x++) {
+      u8 above = row[x] > thr;
+      columns[x] |= above;
+      any |= above;
+    }
+
+    if (any) {
+      if (!found) box->top = i;
+      box->bottom = i + 1;
+      found = 1;
+    }
+  }
+
+  if (found) {
+    size_t left = 0, right = width;
+    while (columns[left] == 0) left++;
+    while (columns[right - 1] == 0) right--;
+    box->left = left;
+    box->right = right;
+  }
+
+  free(columns);
+  return found;
+}
+
+/*  Interleaves count images of size pixels into a batch, the missing lanes are set to 0 */
+void interleave_batch(const u8* const* images, u64 count, size_t size, u8* batch) {
+  for (size_t p = 0; p < size; p++) {
+    u8* dst = batch + p * FILTER_BATCH;
+    for (u64 b = 0; b < FILTER_BATCH; b++) { dst[b] = (b < count) ? images[b][p] : 0; }
+  }
+}
+
+/*  Batched version of convolution, on FILTER_BATCH interleaved images.
+    The innermost loops run over the images with the same weight, so they are plain
+    vector multiply-adds without any border or shuffle */
+void convolution_batch(const u8* image, u8* buffer, size_t height, size_t width,
+                       const u8* kernel_filter, size_t kernel_size, u32 divisor, int stride,
+                       int dilation) {
+  size_t span = (kernel_size - 1) * dilation + 1;
+  size_t out_height = (height - span) / stride + 1;
+  size_t out_width = (width - span) / stride + 1;
+
+  // The sums are exact as floats below 2^24, and then so is the truncated quotient
+  // (a vector division instead of a scalar one per pixel)
+  u32 max_sum = 0;
+  for (size_t k = 0; k < kernel_size * kernel_size; k++) max_sum += 255 * kernel_filter[k];
+  int float_division = max_sum < (1u << 24);
+
+  u32* acc = malloc(out_width * FILTER_BATCH * sizeof(u32));
+
+  for (u64 i = 0; i < out_height; i++) {
+    memset(acc, 0, out_width * FILTER_BATCH * sizeof(u32));
+
+    for (size_t ik = 0; ik < kernel_size; ik++) {
+      const u8* row = image + (i * stride + ik * dilation) * width * FILTER_BATCH;
+
+      for (size_t jk = 0; jk < kernel_size; jk++) {
+        u32 weight = kernel_filter[ik * kernel_size + jk];
+        if (weight == 0) continue;
+
+        const u8* src = row + jk * dilation * FILTER_BATCH;
+        for (u64 j = 0; j < out_width; j++) {
+          const u8* s = src + j * stride * FILTER_BATCH;
+          u32* a = acc + j * FILTER_BATCH;
+          for (u64 b = 0; b < FILTER_BATCH; b++) { a[b] += weight * s[b]; }
+        }
+      }
+    }
+
+    u8* out = buffer + i * out_width * FILTER_BATCH;
+    if (float_division) {
+      for (u64 j = 0; j < out_width * FILTER_BATCH; j++) {
+        out[j] = (u8) (i32) ((f32) (i32) acc[j] / (f32) divisor);
+      }
+    } else {
+      for (u64 j = 0; j < out_width * FILTER_BATCH; j++) { out[j] = (u8) (acc[j] / divisor); }
+    }
+  }
+
+  free(acc);
+}
+
+/*  Batched version of max_pool_2X2 */
+void max_pool_2X2_batch(const u8* image, u8* buffer, size_t height, size_t width) {
+  size_t out_height = height / 2;
+  size_t out_width = width / 2;
+
+  for (u64 i = 0; i < out_height; i++) {
+    const u8* r0 = image + 2 * i * width * FILTER_BATCH;
+    const u8* r1 = r0 + width * FILTER_BATCH;
+    u8* out = buffer + i * out_width * FILTER_BATCH;
+
+    for (u64 j = 0; j < out_width; j++) {
+      const u8* a = r0 + 2 * j * FILTER_BATCH;
+      const u8* c = r1 + 2 * j * FILTER_BATCH;
+      u8* o = out + j * FILTER_BATCH;
+      for (u64 b = 0; b < FILTER_BATCH; b++) {
+        u8 top = (a[b] > a[b + FILTER_BATCH]) ? a[b] : a[b + FILTER_BATCH];
+        u8 bottom = (c[b] > c[b + FILTER_BATCH]) ? c[b] : c[b + FILTER_BATCH];
+        o[b] = (top > bottom) ? top : bottom;
+      }
+    }
+  }
+}
+
+/*  Batched version of avg_pool_2X2, the average is truncated the same way */
+void avg_pool_2X2_batch(const u8* image, u8* buffer, size_t height, size_t width) {
+  size_t out_height = height / 2;
+  size_t out_width = width / 2;
+
+  for (u64 i = 0; i < out_height; i++) {
+    const u8* r0 = image + 2 * i * width * FILTER_BATCH;
+    const u8* r1 = r0 + width * FILTER_BATCH;
+    u8* out = buffer + i * out_width * FILTER_BATCH;
+
+    for (u64 j = 0; j < out_width; j++) {
+      const u8* a = r0 + 2 * j * FILTER_BATCH;
+      const u8* c = r1 + 2 * j * FILTER_BATCH;
+      u8* o = out + j * FILTER_BATCH;
+      for (u64 b = 0; b < FILTER_BATCH; b++) {
+        u32 sum = (u32) a[b] + a[b + FILTER_BATCH] + c[b] + c[b + FILTER_BATCH];
+        o[b] = (u8) (sum >> 2);
+      }
+    }
+  }
+}
+
+/*  Named kernels usable in a filter bank.
+    The blurs are normalized like convolution_3X3 and convolution_5X5 */
+static const struct {
+  const char* name;
+  u64 size;
+  f32 weights[25];
+} named_kernels[] = {
+        {"identity", 3, {0, 0, 0, 0, 1, 0, 0, 0, 0}},
+        {"blur_3x3", 3, {.2f, 0, .2f, 0, .2f, 0, .2f, 0, .2f}},
+        {"blur_5x5",
+         5,
+         {1 / 9.f, 0, 0,       0,       1 / 9.f, 0,       1 / 9.f, 0, 1 / 9.f,
+          0,       0, 0,       1 / 9.f, 0,       0,       0,       1 / 9.f, 0,
+          1 / 9.f, 0, 1 / 9.f, 0,       0,       0,       1 / 9.f}},
+        {"box_3x3", 3, {1 / 9.f, 1 / 9.f, 1 / 9.f, 1 / 9.f, 1 / 9.f, 1 / 9.f, 1 / 9.f, 1 / 9.f, 1 / 9.f}},
+        {"sobel_x", 3, {-1, 0, 1, -2, 0, 2, -1, 0, 1}},
+        {"sobel_y", 3, {-1, -2, -1, 0, 0, 0, 1, 2, 1}},
+        {"laplacian", 3, {0, 1, 0, 1, -4, 1, 0, 1, 0}},
+};
+
+/*  Fills a kernel from its name, returns -1 if the name is unknown */
+int kernel_from_name(const char* name, Kernel* kernel) {
+  for (u64 i = 0; i < sizeof(named_kernels) / sizeof(named_kernels[0]); i++) {
+    if (strcmp(name, named_kernels[i].name) != 0) continue;
+
+    u64 size = named_kernels[i].size;
+    kernel->size = size;
+    kernel->weights = malloc(size * size * sizeof(f32));
+    memcpy(kernel->weights, named_kernels[i].weights, size * size * sizeof(f32));
+    return 0;
+  }
+  return -1;
+}
+
+/*  Normalized size x size gaussian kernel */
+void gaussian_kernel(Kernel* kernel, u64 size, f32 sigma) {
+  kernel->size = size;
+  kernel->weights = malloc(size * size * sizeof(f32));
+
+  f32 center = (f32) (size - 1) / 2.f;
+  f32 sum = 0.f;
+  for (u64 y = 0; y < size; y++) {
+    for (u64 x = 0; x < size; x++) {
+      f32 dx = (f32) x - center, dy = (f32) y - center;
+      kernel->weights[y * size + x] = expf(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+      sum += kernel->weights[y * size + x];
+    }
+  }
+  for (u64 i = 0; i < size * size; i++) kernel->weights[i] /= sum;
+}
+
+/*  size x size Gabor kernel : a gaussian envelope (sigma, aspect ratio gamma) modulating
+    a cosine of wavelength lambda and phase psi, in the direction theta (radians).
+    The mean is removed so that flat regions give no response, and the positive weights
+    sum to 1 so that the response stays within the pixel range */
+void gabor_kernel(Kernel* kernel, u64 size, f32 sigma, f32 theta, f32 lambda, f32 gamma,
+                  f32 psi) {
+  kernel->size = size;
+  kernel->weights = malloc(size * size * sizeof(f32));
+
+  f32 center = (f32) (size - 1) / 2.f;
+  f32 mean = 0.f;
+  for (u64 y = 0; y < size; y++) {
+    for (u64 x = 0; x < size; x++) {
+      f32 dx = (f32) x - center, dy = (f32) y - center;
+      f32 xr = dx * cosf(theta) + dy * sinf(theta);
+      f32 yr = -dx * sinf(theta) + dy * cosf(theta);
+      f32 w = expf(-(xr * xr + gamma * gamma * yr * yr) / (2.f * sigma * sigma)) *
+              cosf(2.f * (f32) M_PI * xr / lambda + psi);
+      kernel->weights[y * size + x] = w;
+      mean += w;
+    }
+  }
+  mean /= (f32) (size * size);
+
+  f32 positive = 0.f;
+  for (u64 i = 0; i < size * size; i++) {
+    kernel->weights[i] -= mean;
+    if (kernel->weights[i] > 0.f) positive += kernel->weights[i];
+  }
+  if (positive > 0.f) {
+    for (u64 i = 0; i < size * size; i++) kernel->weights[i] /= positive;
+  }
+}
+
+void free_kernel(Kernel* kernel) {
+  free(kernel->weights);
+  kernel->weights = NULL;
+}
+
+void init_bank_fft(BankFft* fft) {
+  pthread_mutex_init(&fft->lock, NULL);
+  fft->spectra = NULL;
+}
+
+static void free_bank_spectra(BankSpectra* spectra) {
+  free_fft2d(&spectra->plan);
+  free(spectra->kernels);
+  free(spectra);
+}
+
+/*  Frees the spectra of a bank, the structure itself is left to the caller */
+void free_bank_fft(BankFft* fft) {
+  if (fft == NULL) return;
+  while (fft->spectra) {
+    BankSpectra* next = fft->spectra->next;
+    free_bank_spectra(fft->spectra);
+    fft->spectra = next;
+  }
+  pthread_mutex_destroy(&fft->lock);
+}
+
+/*  Size of the largest kernel of the bank, which sets the output geometry */
+u64 filter_bank_kernel_size(const FilterBank* bank) {
+  u64 size = 0;
+  for (u64 k = 0; k < bank->size; k++) {
+    if (bank->kernels[k].size > size) size = bank->kernels[k].size;
+  }
+  return size;
+}
+
+#define BANK_TILE 64
+
+/*  Applies every kernel of the bank to the image, directly or through FFT for large kernels.
+    Output value (k, p) is written at output[k * channel_stride + p * pixel_stride],
+    the absolute value of the response is kept (edges are signed) and saturated to 255 */
+void apply_filter_bank(const u8* image, u8* output, size_t height, size_t width,
+                       const FilterBank* bank, size_t pixel_stride, size_t channel_stride) {
+  if (filter_bank_kernel_size(bank) >= FFT_MIN_KERNEL)
+    apply_filter_bank_fft(image, output, height, width, bank, pixel_stride, channel_stride);
+  else
+    apply_filter_bank_direct(image, output, height, width, bank, pixel_stride, channel_stride);
+}
+
+/*  Applies every kernel of the bank in a single traversal of the image.
+    Each tile of input pixels is converted once into a small floating point window,
+    which is then reused by all the kernels while it sits in L1 */
+void apply_filter_bank_direct(const u8* image, u8* output, size_t height, size_t width,
+                              const FilterBank* bank, size_t pixel_stride,
+                              size_t channel_stride) {
+  u64 ksize = filter_bank_kernel_size(bank);
+  u64 out_height = height - ksize + 1;
+  u64 out_width = width - ksize + 1;
+  u64 tile_width = BANK_TILE + ksize - 1;
+
+  f32* tile = malloc(ksize * tile_width * sizeof(f32));
+  f32 acc[BANK_TILE];
+
+  for (u64 y = 0; y < out_height; y++) {
+    for (u64 x0 = 0; x0 < out_width; x0 += BANK_TILE) {
+      u64 n = (out_width - x0 < BANK_TILE) ? out_width - x0 : BANK_TILE;
+
+      // load the window once
+      for (u64 ky = 0; ky < ksize; ky++) {
+        const u8* src = image + (y + ky) * width + x0;
+        for (u64 i = 0; i < n + ksize - 1; i++) { tile[ky * tile_width + i] = src[i]; }
+      }
+
+      for (u64 k = 0; k < bank->size; k++) {
+        const Kernel* kernel = &bank->kernels[k];
+        u64 offset = (ksize - kernel->size) / 2;
+
+        for (u64 i = 0; i < n; i++) acc[i] = 0.f;
+
+        for (u64 ky = 0; ky < kernel->size; ky++) {
+          const f32* row = tile + (ky + offset) * tile_width + offset;
+          for (u64 kx = 0; kx < kernel->size; kx++) {
+            f32 w = kernel->weights[ky * kernel->size + kx];
+            if (w == 0.f) continue;
+            for (u64 i = 0; i < n; i++) { acc[i] += w * row[i + kx]; }
+          }
+        }
+
+        u8* dst = output + k * channel_stride + (y * out_width + x0) * pixel_stride;
+        for (u64 i = 0; i < n; i++) {
+          f32 v = fabsf(acc[i]);
+          dst[i * pixel_stride] = (v >= 255.f) ? 255 : (u8) (v + 0.5f);
+        }
+      }
+    }
+  }
+
+  free(tile);
+}
+
+/*  Computes the spectra of the kernels for images padded to height x width */
+static BankSpectra* create_bank_spectra(const FilterBank* bank, u64 height, u64 width) {
+  BankSpectra* spectra = malloc(sizeof(BankSpectra));
+  init_fft2d(&spectra->plan, height, width);
+  spectra->next = NULL;
+
+  u64 spectrum_size = 2 * height * spectra->plan.spectrum_width;
+  u64 ksize = filter_bank_kernel_size(bank);
+  f32 scale = 1.f / (f32) (height * width);
+
+  spectra->kernels = malloc(bank->size * spectrum_size * sizeof(f32));
+  f32* real = malloc(height * width * sizeof(f32));
+  f32* scratch = malloc(height * width * sizeof(f32));
+
+  for (u64 k = 0; k < bank->size; k++) {
+    const Kernel* kernel = &bank->kernels[k];
+    u64 offset = (ksize - kernel->size) / 2;
+
+    memset(real, 0, height * width * sizeof(f32));
+    for (u64 ky = 0; ky < kernel->size; ky++) {
+      for (u64 kx = 0; kx < kernel->size; kx++) {
+        real[(ky + offset) * width + kx + offset] = kernel->weights[ky * kernel->size + kx];
+      }
+    }
+
+    // a correlation is a product with the conjugated spectrum of the kernel
+    f32* spectrum = spectra->kernels + k * spectrum_size;
+    fft2d_forward(&spectra->plan, real, spectrum, scratch);
+    for (u64 i = 0; i < spectrum_size; i += 2) {
+      spectrum[i] *= scale;
+      spectrum[i + 1] *= -scale;
+    }
+  }
+
+  free(real);
+  free(scratch);
+  return spectra;
+}
+
+/*  Spectra of the bank for images padded to height x width, built on first use */
+static const BankSpectra* bank_spectra(BankFft* fft, const FilterBank* bank, u64 height,
+                                       u64 width) {
+  pthread_mutex_lock(&fft->lock);
+
+  BankSpectra* spectra = fft->spectra;
+  while (spectra && (spectra->plan.height != height || spectra->plan.width != width))
+    spectra = spectra->next;
+
+  if (spectra == NULL) {
+    spectra = create_bank_spectra(bank, height, width);
+    spectra->next = fft->spectra;
+    fft->spectra = spectra;
+  }
+
+  pthread_mutex_unlock(&fft->lock);
+  return spectra;
+}
+
+/*  Same as apply_filter_bank_direct through FFT : the image is transformed once, then each
+    kernel costs a product of spectra and an inverse transform, whatever its size.
+    The image is padded to powers of 2 at least as large, the circular convolution then
+    matches the valid one on the output pixels. Results may differ by one from the direct
+    path where the response is rounded (floating point sums in another order).
+    The spectra of the kernels come from the cache of the bank, all the other buffers belong
+    to the call */
+void apply_filter_bank_fft(const u8* image, u8* output, size_t height, size_t width,
+                           const FilterBank* bank, size_t pixel_stride, size_t channel_stride) {
+  u64 ksize = filter_bank_kernel_size(bank);
+  u64 out_height = height - ksize + 1;
+  u64 out_width = width - ksize + 1;
+  u64 fft_height = next_power_of_2(height < 2 ? 2 : height);
+  u64 fft_width = next_power_of_2(width < 2 ? 2 : width);
+
+  BankSpectra* local = NULL;
+  const BankSpectra* spectra;
+  if (bank->fft) spectra = bank_spectra(bank->fft, bank, fft_height, fft_width);
+  else
+    spectra = local = create_bank_spectra(bank, fft_height, fft_width);
+
+  const Fft2d* plan = &spectra->plan;
+  u64 spectrum_size = 2 * fft_height * plan->spectrum_width;
+  f32* real = malloc(fft_height * fft_width * sizeof(f32));
+  f32* scratch = malloc(fft_height * fft_width * sizeof(f32));
+  f32* spectrum = malloc(spectrum_size * sizeof(f32));
+  f32* product = malloc(spectrum_size * sizeof(f32));
+
+  memset(real, 0, fft_height * fft_width * sizeof(f32));
+  for (u64 y = 0; y < height; y++) {
+    for (u64 x = 0; x < width; x++) real[y * fft_width + x] = image[y * width + x];
+  }
+  fft2d_forward(plan, real, spectrum, scratch);
+
+  for (u64 k = 0; k < bank->size; k++) {
+    const f32* kernel = spectra->kernels + k * spectrum_size;
+    for (u64 i = 0; i < spectrum_size; i += 2) {
+      f32 ar = spectrum[i], ai = spectrum[i + 1];
+      f32 br = kernel[i], bi = kernel[i + 1];
+      product[i] = ar * br - ai * bi;
+      product[i + 1] = ar * bi + ai * br;
+    }
+    fft2d_inverse(plan, product, real, scratch);
+
+    for (u64 y = 0; y < out_height; y++) {
+      u8* dst = output + k * channel_stride + y * out_width * pixel_stride;
+      const f32* src = real + y * fft_width;
+      for (u64 x = 0; x < out_width; x++) {
+        f32 v = fabsf(src[x]);
+        dst[x * pixel_stride] = (v >= 255.f) ? 255 : (u8) (v + 0.5f);
+      }
+    }
+  }
+
+  free(real);
+  free(scratch);
+  free(spectrum);
+  free(product);
+  if (local) free_bank_spectra(local);
+}
+
+/*  Filter bank on a single channel image, the result holds bank->size channels */
+void filter_bank(u8** image, u8** buffer, size_t* height, size_t* width, const FilterBank* bank) {
+  u64 ksize = filter_bank_kernel_size(bank);
+  size_t out_size = (*height - ksize + 1) * (*width - ksize + 1);
+
+  if (bank->layout == BANK_INTERLEAVED)
+    apply_filter_bank(*image, *buffer, *height, *width, bank, bank->size, 1);
+  else
+    apply_filter_bank(*image, *buffer, *height, *width, bank, 1, out_size);
+
+  // update size
+  *height = *height - ksize + 1;
+  *width = *width - ksize + 1;
+
+  // swap buffer <=> image
+  u8* tmp;
+  tmp = *image;
+  *image = *buffer;
+  *buffer = tmp;
+}
+
+
 /*  Main image processing function, calling the functions previously
     defined in this file to process a given file to feed it to the NN
 */
 unsigned char* apply_convolution_filters(u8* image_ptr, u8* buffer_ptr, size_t image_width,
                                          size_t image_height) {
 
-  size_t image_size = image_height * image_width;
-
   // open and decode the image
   // process_img(filename, &image_ptr, &image_size, &image_width, &image_height);
 
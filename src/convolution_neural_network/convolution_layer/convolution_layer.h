@@ -4,23 +4,121 @@
 
 // #include <spng.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
 #include "../../../src/global.h"
 #include "../../../src/type.h"
+#include "fft.h"
+
+
+// How the magnitude of the sobel gradient is computed :
+// exact euclidean norm, L1 norm |gx| + |gy|, or the integer alpha max plus beta min approximation
+typedef enum { SOBEL_EXACT = 0, SOBEL_L1 = 1, SOBEL_APPROX = 2 } SobelMagnitude;
+
+// Floating point kernel of a filter bank, size x size weights
+typedef struct {
+  u64 size;
+  f32* weights;
+} Kernel;
+
+// Output layout of a filter bank :
+// planar writes one feature map after the other, interleaved writes the K values of each pixel
+// next to each other
+typedef enum { BANK_PLANAR = 0, BANK_INTERLEAVED = 1 } BankLayout;
+
+// Filter banks whose largest kernel is at least this size are convolved through FFT,
+// whose cost does not depend on the kernel size (see the benchmark target)
+#define FFT_MIN_KERNEL 11
+
+// Spectra of the kernels of a filter bank, for images padded to plan.height x plan.width
+typedef struct BankSpectra {
+  Fft2d plan;
+  f32* kernels;// conjugated spectra, scaled by the inverse transform factor
+  struct BankSpectra* next;
+} BankSpectra;
 
+// Spectra of a filter bank for each padded size met so far : the bands of the tiled pipeline
+// and the whole images are padded to different sizes. Each one is built once, under the lock,
+// and only read afterwards, so a bank can be applied by several threads at once
+typedef struct {
+  pthread_mutex_t lock;
+  BankSpectra* spectra;
+} BankFft;
+
+// Set of kernels applied together to the same image
+// Every output channel has the geometry of the largest (valid) convolution, smaller kernels are
+// centered on the same pixels
+typedef struct {
+  u64 size;
+  Kernel* kernels;
+  BankLayout layout;
+  BankFft* fft;// cache of the FFT path, when NULL the spectra are recomputed on each call
+} FilterBank;
+
+// Pixels [left, right) x [top, bottom) of an image, empty when right <= left
+typedef struct {
+  size_t left;
+  size_t top;
+  size_t right;
+  size_t bottom;
+} BoundingBox;
+
+// Number of images processed together by the batched filters.
+// Batched feature maps are interleaved : value p of image b is stored at p * FILTER_BATCH + b,
+// so that each SIMD lane processes the same pixel of a different image
+#define FILTER_BATCH 16
 
 // int * process_img(char *img);
 unsigned char* apply_convolution_filters(u8* image_ptr, u8* buffer_ptr, size_t image_width,
                                          size_t image_height);
 
 
+void convolution(u8** image, u8** buffer, size_t* height, size_t* width, const u8* kernel_filter,
+                 size_t kernel_size, u32 divisor, int stride, int dilation);
 void convolution_5X5(u8** image, u8** buffer, size_t* height, size_t* width,
                      const u8* kernel_filter, int stride);
 void convolution_3X3(u8** image, u8** buffer, size_t* height, size_t* width,
                      const u8* kernel_filter, int stride);
+void sobel_3X3(u8** image, u8** buffer, size_t* height, size_t* width, int threshold);
+void sobel_3X3_magnitude(u8** image, u8** buffer, size_t* height, size_t* width, int threshold,
+                         SobelMagnitude magnitude);
+void max_pool(u8** image, u8** buffer, size_t* height, size_t* width, size_t window,
+              size_t stride);
+void avg_pool(u8** image, u8** buffer, size_t* height, size_t* width, size_t window,
+              size_t stride);
 void max_pool_3X3(u8** image, u8** buffer, size_t* height, size_t* width);
 void max_pool_2X2(u8** image, u8** buffer, size_t* height, size_t* width);
 void avg_pool_2X2(u8** image, u8** buffer, size_t* height, size_t* width);
+
+int foreground_box(const u8* image, size_t height, size_t width, int threshold, BoundingBox* box);
+
+// batched filters, on FILTER_BATCH interleaved images
+void interleave_batch(const u8* const* images, u64 count, size_t size, u8* batch);
+void convolution_batch(const u8* image, u8* buffer, size_t height, size_t width,
+                       const u8* kernel_filter, size_t kernel_size, u32 divisor, int stride,
+                       int dilation);
+void max_pool_2X2_batch(const u8* image, u8* buffer, size_t height, size_t width);
+void avg_pool_2X2_batch(const u8* image, u8* buffer, size_t height, size_t width);
+
+// filter banks
+int kernel_from_name(const char* name, Kernel* kernel);
+void gaussian_kernel(Kernel* kernel, u64 size, f32 sigma);
+void gabor_kernel(Kernel* kernel, u64 size, f32 sigma, f32 theta, f32 lambda, f32 gamma, f32 psi);
+void free_kernel(Kernel* kernel);
+void init_bank_fft(BankFft* fft);
+void free_bank_fft(BankFft* fft);
+u64 filter_bank_kernel_size(const FilterBank* bank);
+void apply_filter_bank(const u8* image, u8* output, size_t height, size_t width,
+                       const FilterBank* bank, size_t pixel_stride, size_t channel_stride);
+void apply_filter_bank_direct(const u8* image, u8* output, size_t height, size_t width,
+                              const FilterBank* bank, size_t pixel_stride, size_t channel_stride);
+void apply_filter_bank_fft(const u8* image, u8* output, size_t height, size_t width,
+                           const FilterBank* bank, size_t pixel_stride, size_t channel_stride);
+void filter_bank(u8** image, u8** buffer, size_t* height, size_t* width, const FilterBank* bank);
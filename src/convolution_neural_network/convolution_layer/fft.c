@@ -0,0 +1,150 @@
+#include "fft.h"
+
+u64 next_power_of_2(u64 n) {
+  u64 p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+static f32* make_twiddles(u64 n) {
+  f32* twiddles = malloc((n / 2 + 1) * 2 * sizeof(f32));
+  for (u64 k = 0; k < n / 2; k++) {
+    f64 angle = -2.0 * M_PI * (f64) k / (f64) n;
+    twiddles[2 * k] = (f32) cos(angle);
+    twiddles[2 * k + 1] = (f32) sin(angle);
+  }
+  return twiddles;
+}
+
+void init_fft2d(Fft2d* fft, u64 height, u64 width) {
+  fft->height = height;
+  fft->width = width;
+  fft->spectrum_width = width / 2 + 1;
+  fft->row_twiddles = make_twiddles(width);
+  fft->column_twiddles = make_twiddles(height);
+}
+
+void free_fft2d(Fft2d* fft) {
+  free(fft->row_twiddles);
+  free(fft->column_twiddles);
+  memset(fft, 0, sizeof(Fft2d));
+}
+
+/*  In place radix-2 FFTs of the columns of a n x (columns) matrix of interleaved complex values.
+    The butterflies are applied to whole rows, with the same twiddle for every column, so the
+    inner loops run over contiguous memory and vectorize.
+    The inverse transform conjugates the twiddles and is not scaled */
+static void fft_columns(f32* data, u64 n, u64 columns, const f32* twiddles, int inverse) {
+  u64 row = 2 * columns;
+
+  // bit reversal permutation of the rows
+  for (u64 i = 1, j = 0; i < n; i++) {
+    u64 bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      f32* a = data + i * row;
+      f32* b = data + j * row;
+      for (u64 x = 0; x < row; x++) {
+        f32 tmp = a[x];
+        a[x] = b[x];
+        b[x] = tmp;
+      }
+    }
+  }
+
+  f32 sign = inverse ? -1.f : 1.f;
+  for (u64 len = 2; len <= n; len <<= 1) {
+    u64 half = len / 2;
+    u64 step = n / len;
+
+    for (u64 i = 0; i < n; i += len) {
+      for (u64 k = 0; k < half; k++) {
+        f32 wr = twiddles[2 * k * step], wi = sign * twiddles[2 * k * step + 1];
+        f32* restrict a = data + (i + k) * row;
+        f32* restrict b = data + (i + k + half) * row;
+
+        for (u64 x = 0; x < row; x += 2) {
+          f32 tr = b[x] * wr - b[x + 1] * wi;
+          f32 ti = b[x] * wi + b[x + 1] * wr;
+          b[x] = a[x] - tr;
+          b[x + 1] = a[x + 1] - ti;
+          a[x] += tr;
+          a[x + 1] += ti;
+        }
+      }
+    }
+  }
+}
+
+/*  Spectrum of a height x width real array.
+    Rows are transformed two at a time, as the real and imaginary parts of a single complex
+    row, and separated with the symmetries of real spectra. The complex rows are stored
+    transposed in the scratch buffer, so that they are transformed with fft_columns too */
+void fft2d_forward(const Fft2d* fft, const f32* input, f32* spectrum, f32* scratch) {
+  u64 w = fft->width, sw = fft->spectrum_width, pairs = fft->height / 2;
+  f32* packed = scratch;
+
+  // packed[x][p] = input[2p][x] + i input[2p + 1][x]
+  for (u64 p = 0; p < pairs; p++) {
+    const f32* a = input + 2 * p * w;
+    const f32* b = a + w;
+    for (u64 x = 0; x < w; x++) {
+      packed[2 * (x * pairs + p)] = a[x];
+      packed[2 * (x * pairs + p) + 1] = b[x];
+    }
+  }
+  fft_columns(packed, w, pairs, fft->row_twiddles, 0);
+
+  // A[k] = (Z[k] + conj(Z[-k])) / 2, B[k] = (Z[k] - conj(Z[-k])) / 2i
+  for (u64 k = 0; k < sw; k++) {
+    const f32* z = packed + 2 * k * pairs;
+    const f32* nz = packed + 2 * ((w - k) & (w - 1)) * pairs;
+    for (u64 p = 0; p < pairs; p++) {
+      f32 zr = z[2 * p], zi = z[2 * p + 1];
+      f32 nr = nz[2 * p], ni = nz[2 * p + 1];
+      f32* sa = spectrum + 2 * (2 * p * sw + k);
+      f32* sb = sa + 2 * sw;
+      sa[0] = 0.5f * (zr + nr);
+      sa[1] = 0.5f * (zi - ni);
+      sb[0] = 0.5f * (zi + ni);
+      sb[1] = 0.5f * (nr - zr);
+    }
+  }
+
+  fft_columns(spectrum, fft->height, sw, fft->column_twiddles, 0);
+}
+
+/*  Real array of a spectrum, multiplied by height * width. The spectrum is overwritten.
+    Two rows are rebuilt at once as Z = A + iB, whose inverse holds them in its real
+    and imaginary parts */
+void fft2d_inverse(const Fft2d* fft, f32* spectrum, f32* output, f32* scratch) {
+  u64 w = fft->width, sw = fft->spectrum_width, pairs = fft->height / 2;
+  f32* packed = scratch;
+
+  fft_columns(spectrum, fft->height, sw, fft->column_twiddles, 1);
+
+  for (u64 k = 0; k < w; k++) {
+    // the upper half of a real spectrum is the conjugate of the lower one
+    u64 j = (k < sw) ? k : w - k;
+    f32 sign = (k < sw) ? 1.f : -1.f;
+    f32* z = packed + 2 * k * pairs;
+
+    for (u64 p = 0; p < pairs; p++) {
+      const f32* sa = spectrum + 2 * (2 * p * sw + j);
+      const f32* sb = sa + 2 * sw;
+      z[2 * p] = sa[0] - sign * sb[1];
+      z[2 * p + 1] = sign * sa[1] + sb[0];
+    }
+  }
+  fft_columns(packed, w, pairs, fft->row_twiddles, 1);
+
+  for (u64 p = 0; p < pairs; p++) {
+    f32* a = output + 2 * p * w;
+    f32* b = a + w;
+    for (u64 x = 0; x < w; x++) {
+      a[x] = packed[2 * (x * pairs + p)];
+      b[x] = packed[2 * (x * pairs + p) + 1];
+    }
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../src/type.h"
+
+// Radix-2 FFT of real 2D arrays, used to convolve images with large kernels.
+// Spectra of height x width real arrays are stored height x (width / 2 + 1), as interleaved
+// (real, imaginary) pairs : the other half of each row is the conjugate of this one.
+// The inverse transform is not scaled (the result is multiplied by height * width).
+// A plan is only read by the transforms, which work in a scratch buffer of height * width floats
+// given by the caller : several threads can share a plan.
+
+typedef struct {
+  u64 height;// powers of 2
+  u64 width;
+  u64 spectrum_width;// width / 2 + 1
+
+  f32* row_twiddles;   // exp(-2 i pi k / width), k < width / 2
+  f32* column_twiddles;// exp(-2 i pi k / height), k < height / 2
+} Fft2d;
+
+u64 next_power_of_2(u64 n);
+
+void init_fft2d(Fft2d* fft, u64 height, u64 width);
+void free_fft2d(Fft2d* fft);
+
+void fft2d_forward(const Fft2d* fft, const f32* input, f32* spectrum, f32* scratch);
+void fft2d_inverse(const Fft2d* fft, f32* spectrum, f32* output, f32* scratch);
@@ -0,0 +1,671 @@
+#include "pipeline.h"
+#include <unistd.h>
+
+#define DEFAULT_TILE_BYTES (256 * 1024)
+
+// Rows [begin, end) of a feature map
+typedef struct {
+  size_t begin;
+  size_t end;
+} RowRange;
+
+void init_pipeline(Pipeline* pipeline) {
+  pipeline->size = 0;
+  pipeline->stages = NULL;
+  pipeline->tile_bytes = 0;
+  pipeline->batch = 1;
+}
+
+/*  Same filters as apply_convolution_filters */
+void default_pipeline(Pipeline* pipeline) {
+  const char* names[] = {"convolution_5X5", "max_pool_2X2", "convolution_5X5", "max_pool_2X2",
+                         "max_pool_2X2"};
+  Stage stage;
+
+  init_pipeline(pipeline);
+  for (u64 i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    stage_from_name(names[i], &stage);
+    pipeline_add_stage(pipeline, &stage);
+  }
+}
+
+/*  Fills a stage from the name of its filter, with the default parameters.
+    Returns -1 if the name is unknown */
+int stage_from_name(const char* name, Stage* stage) {
+  memset(stage, 0, sizeof(Stage));
+  stage->stride = 1;
+  stage->dilation = 1;
+
+  if (strcmp(name, "convolution_5X5") == 0) {
+    stage->type = STAGE_CONVOLUTION_5X5;
+    stage->kernel_filter = blur_5x5;
+  } else if (strcmp(name, "convolution_3X3") == 0) {
+    stage->type = STAGE_CONVOLUTION_3X3;
+    stage->kernel_filter = blur_3x3;
+  } else if (strcmp(name, "max_pool_2X2") == 0) {
+    stage->type = STAGE_MAX_POOL_2X2;
+  } else if (strcmp(name, "avg_pool_2X2") == 0) {
+    stage->type = STAGE_AVG_POOL_2X2;
+  } else if (strcmp(name, "max_pool") == 0) {
+    stage->type = STAGE_MAX_POOL;
+    stage->window = 2;
+    stage->stride = 2;
+  } else if (strcmp(name, "avg_pool") == 0) {
+    stage->type = STAGE_AVG_POOL;
+    stage->window = 2;
+    stage->stride = 2;
+  } else if (strcmp(name, "sobel_3X3") == 0) {
+    stage->type = STAGE_SOBEL_3X3;
+    stage->threshold = 200;
+    stage->magnitude = SOBEL_EXACT;
+  } else if (strcmp(name, "crop") == 0) {
+    stage->type = STAGE_CROP;
+    stage->threshold = 16;
+    stage->crop_mode = CROP_IMAGE;
+  } else if (strcmp(name, "filter_bank") == 0) {
+    stage->type = STAGE_FILTER_BANK;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/*  The pipeline takes ownership of the stage (and of its kernels) */
+void pipeline_add_stage(Pipeline* pipeline, const Stage* stage) {
+  pipeline->stages = realloc(pipeline->stages, (pipeline->size + 1) * sizeof(Stage));
+  pipeline->stages[pipeline->size] = *stage;
+
+  // the spectra of large filter banks are computed once, for every image
+  if (stage->type == STAGE_FILTER_BANK && stage->bank.fft == NULL) {
+    pipeline->stages[pipeline->size].bank.fft = malloc(sizeof(BankFft));
+    init_bank_fft(pipeline->stages[pipeline->size].bank.fft);
+  }
+  pipeline->size++;
+}
+
+void free_pipeline(Pipeline* pipeline) {
+  for (u64 i = 0; i < pipeline->size; i++) {
+    FilterBank* bank = &pipeline->stages[i].bank;
+    for (u64 k = 0; k < bank->size; k++) { free_kernel(&bank->kernels[k]); }
+    free(bank->kernels);
+    free_bank_fft(bank->fft);
+    free(bank->fft);
+  }
+  free(pipeline->stages);
+  init_pipeline(pipeline);
+}
+
+/*  Width (and height) of the input window needed by one output pixel */
+static u64 stage_window(const Stage* stage) {
+  switch (stage->type) {
+    case STAGE_CONVOLUTION_5X5:
+      return 4 * stage->dilation + 1;
+    case STAGE_CONVOLUTION_3X3:
+      return 2 * stage->dilation + 1;
+    case STAGE_SOBEL_3X3:
+      return 3;
+    case STAGE_FILTER_BANK:
+      return filter_bank_kernel_size(&stage->bank);
+    case STAGE_MAX_POOL:
+    case STAGE_AVG_POOL:
+      return stage->window;
+    case STAGE_CROP:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+/*  Step between the input windows of two neighbouring output pixels */
+static u64 stage_stride(const Stage* stage) {
+  switch (stage->type) {
+    case STAGE_CONVOLUTION_5X5:
+    case STAGE_CONVOLUTION_3X3:
+    case STAGE_MAX_POOL:
+    case STAGE_AVG_POOL:
+      return stage->stride;
+    case STAGE_MAX_POOL_2X2:
+    case STAGE_AVG_POOL_2X2:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+/*  Input rows of a stage needed to compute its output rows */
+static RowRange stage_input_rows(const Stage* stage, RowRange output) {
+  RowRange input;
+  input.begin = output.begin * stage_stride(stage);
+  input.end = (output.end - 1) * stage_stride(stage) + stage_window(stage);
+  return input;
+}
+
+FeatureShape stage_output_shape(const Stage* stage, FeatureShape input) {
+  FeatureShape output = input;
+  u64 ksize;
+
+  switch (stage->type) {
+    case STAGE_CONVOLUTION_5X5:
+    case STAGE_CONVOLUTION_3X3:
+    case STAGE_MAX_POOL:
+    case STAGE_AVG_POOL:
+      output.height = (input.height - stage_window(stage)) / stage->stride + 1;
+      output.width = (input.width - stage_window(stage)) / stage->stride + 1;
+      break;
+    case STAGE_SOBEL_3X3:
+      output.height = input.height - 2;
+      output.width = input.width - 2;
+      break;
+    case STAGE_MAX_POOL_2X2:
+    case STAGE_AVG_POOL_2X2:
+      output.height = input.height / 2;
+      output.width = input.width / 2;
+      break;
+    case STAGE_FILTER_BANK:
+      ksize = filter_bank_kernel_size(&stage->bank);
+      output.height = input.height - ksize + 1;
+      output.width = input.width - ksize + 1;
+      output.channels = input.channels * stage->bank.size;
+      break;
+    case STAGE_CROP:
+      output.height = stage->crop_height;
+      output.width = stage->crop_width;
+      break;
+  }
+  return output;
+}
+
+FeatureShape pipeline_output_shape(const Pipeline* pipeline, FeatureShape input) {
+  for (u64 i = 0; i < pipeline->size; i++) {
+    input = stage_output_shape(&pipeline->stages[i], input);
+  }
+  return input;
+}
+
+/*  Number of bytes needed by each of the two buffers of apply_pipeline.
+    A filter bank can make a feature map larger than the original image */
+size_t pipeline_buffer_size(const Pipeline* pipeline, FeatureShape input) {
+  size_t size = input.width * input.height * input.channels;
+  for (u64 i = 0; i < pipeline->size; i++) {
+    input = stage_output_shape(&pipeline->stages[i], input);
+    size_t stage_size = input.width * input.height * input.channels;
+    if (stage_size > size) size = stage_size;
+  }
+  return size;
+}
+
+/*  Checks that every stage gets a non empty input, and that interleaved
+    filter banks are only used as the last stage.
+    Returns -1 on error */
+int check_pipeline(const Pipeline* pipeline, FeatureShape input) {
+  for (u64 i = 0; i < pipeline->size; i++) {
+    const Stage* stage = &pipeline->stages[i];
+
+    if (stage->type == STAGE_FILTER_BANK) {
+      if (stage->bank.size == 0) {
+        fprintf(stderr, "pipeline stage %llu : empty filter bank\n", i);
+        return -1;
+      }
+      if (stage->bank.layout == BANK_INTERLEAVED && i != pipeline->size - 1) {
+        fprintf(stderr, "pipeline stage %llu : interleaved filter banks must be the last stage\n",
+                i);
+        return -1;
+      }
+    }
+
+    if (stage->stride < 1 || stage->dilation < 1) {
+      fprintf(stderr, "pipeline stage %llu : stride and dilation must be positive\n", i);
+      return -1;
+    }
+
+    if (stage->type == STAGE_CROP) {
+      if (i != 0) {
+        fprintf(stderr, "pipeline stage %llu : crop must be the first stage\n", i);
+        return -1;
+      }
+      if (stage->crop_width == 0 || stage->crop_height == 0 || stage->crop_width > input.width ||
+          stage->crop_height > input.height) {
+        fprintf(stderr, "pipeline stage %llu : crop of %zux%zu does not fit in %zux%zu images\n", i,
+                stage->crop_width, stage->crop_height, input.width, input.height);
+        return -1;
+      }
+    }
+
+    if ((stage->type == STAGE_MAX_POOL || stage->type == STAGE_AVG_POOL) && stage->window < 1) {
+      fprintf(stderr, "pipeline stage %llu : pooling window must be positive\n", i);
+      return -1;
+    }
+
+    u64 window = stage_window(stage);
+    if (input.width < window || input.height < window) {
+      fprintf(stderr, "pipeline stage %llu : %zux%zu feature map is too small\n", i, input.width,
+              input.height);
+      return -1;
+    }
+    input = stage_output_shape(stage, input);
+  }
+  return 0;
+}
+
+/*  Extends the box of a dataset wide crop with the foreground of an image,
+    nothing is done if the pipeline does not start with such a crop */
+void pipeline_fit_crop(Pipeline* pipeline, const u8* image, size_t image_width,
+                       size_t image_height) {
+  if (pipeline->size == 0 || pipeline->stages[0].type != STAGE_CROP ||
+      pipeline->stages[0].crop_mode != CROP_DATASET)
+    return;
+
+  BoundingBox* box = &pipeline->stages[0].crop_box;
+  BoundingBox image_box;
+  if (!foreground_box(image, image_height, image_width, pipeline->stages[0].threshold, &image_box))
+    return;
+
+  if (box->right <= box->left) {
+    *box = image_box;
+    return;
+  }
+  if (image_box.left < box->left) box->left = image_box.left;
+  if (image_box.top < box->top) box->top = image_box.top;
+  if (image_box.right > box->right) box->right = image_box.right;
+  if (image_box.bottom > box->bottom) box->bottom = image_box.bottom;
+}
+
+/*  Origin of a window of size pixels centered on center, kept inside [0, limit) */
+static size_t centered_origin(size_t center, size_t size, size_t limit) {
+  size_t origin = (center < size / 2) ? 0 : center - size / 2;
+  return (origin + size > limit) ? limit - size : origin;
+}
+
+/*  Copies the crop window of the image to output. The window is centered on the foreground box
+    (of the image or of the dataset), or on the image when there is no foreground */
+static void crop_image(const Stage* stage, const u8* image, size_t width, size_t height,
+                       u8* output) {
+  BoundingBox box = stage->crop_box;
+  if (stage->crop_mode == CROP_IMAGE) foreground_box(image, height, width, stage->threshold, &box);
+
+  size_t cx = width / 2, cy = height / 2;
+  if (box.right > box.left) {
+    cx = (box.left + box.right) / 2;
+    cy = (box.top + box.bottom) / 2;
+  }
+  size_t x = centered_origin(cx, stage->crop_width, width);
+  size_t y = centered_origin(cy, stage->crop_height, height);
+
+  for (size_t i = 0; i < stage->crop_height; i++) {
+    memcpy(output + i * stage->crop_width, image + (y + i) * width + x, stage->crop_width);
+  }
+}
+
+/*  True if the pipeline starts with a crop, which only selects the window processed by
+    the other stages */
+static int pipeline_has_crop(const Pipeline* pipeline) {
+  return pipeline->size > 0 && pipeline->stages[0].type == STAGE_CROP;
+}
+
+/*  The stages following the crop */
+static Pipeline pipeline_tail(const Pipeline* pipeline) {
+  Pipeline tail = *pipeline;
+  tail.size--;
+  tail.stages++;
+  return tail;
+}
+
+/*  Applies a stage on each channel of the image feature map, writing the result in buffer */
+static void run_stage(const Stage* stage, u8* image, u8* buffer, FeatureShape shape) {
+  FeatureShape output = stage_output_shape(stage, shape);
+  size_t in_plane = shape.width * shape.height;
+  size_t out_plane = output.width * output.height;
+
+  for (size_t c = 0; c < shape.channels; c++) {
+    u8* in = image + c * in_plane;
+    u8* out = buffer + c * out_plane;
+    size_t height = shape.height;
+    size_t width = shape.width;
+
+    switch (stage->type) {
+      case STAGE_CONVOLUTION_5X5:
+        convolution(&in, &out, &height, &width, stage->kernel_filter, 5, 9, stage->stride,
+                    stage->dilation);
+        break;
+      case STAGE_CONVOLUTION_3X3:
+        convolution(&in, &out, &height, &width, stage->kernel_filter, 3, 5, stage->stride,
+                    stage->dilation);
+        break;
+      case STAGE_SOBEL_3X3:
+        sobel_3X3_magnitude(&in, &out, &height, &width, stage->threshold, stage->magnitude);
+        break;
+      case STAGE_MAX_POOL_2X2:
+        max_pool_2X2(&in, &out, &height, &width);
+        break;
+      case STAGE_AVG_POOL_2X2:
+        avg_pool_2X2(&in, &out, &height, &width);
+        break;
+      case STAGE_CROP:
+        crop_image(stage, in, width, height, out);
+        break;
+      case STAGE_MAX_POOL:
+        max_pool(&in, &out, &height, &width, stage->window, stage->stride);
+        break;
+      case STAGE_AVG_POOL:
+        avg_pool(&in, &out, &height, &width, stage->window, stage->stride);
+        break;
+      case STAGE_FILTER_BANK:
+        // input channel c produces the output channels [c * K, (c + 1) * K)
+        if (stage->bank.layout == BANK_INTERLEAVED)
+          apply_filter_bank(in, buffer + c * stage->bank.size, height, width, &stage->bank,
+                            output.channels, 1);
+        else
+          apply_filter_bank(in, buffer + c * stage->bank.size * out_plane, height, width,
+                            &stage->bank, 1, out_plane);
+        break;
+    }
+  }
+}
+
+/*  Applies a stage on each channel of the feature map, the result is left in *image */
+static void apply_stage(const Stage* stage, u8** image, u8** buffer, FeatureShape* shape) {
+  run_stage(stage, *image, *buffer, *shape);
+  *shape = stage_output_shape(stage, *shape);
+
+  // swap buffer <=> image
+  u8* tmp;
+  tmp = *image;
+  *image = *buffer;
+  *buffer = tmp;
+}
+
+/*  Working set size, in bytes */
+size_t pipeline_tile_bytes(const Pipeline* pipeline) {
+  if (pipeline->tile_bytes) return pipeline->tile_bytes;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (l2 > 0) return l2;
+#endif
+  return DEFAULT_TILE_BYTES;
+}
+
+/*  Rows of every feature map needed to compute the rows [begin, end) of the pipeline output.
+    ranges must hold pipeline->size + 1 elements */
+static void band_rows(const Pipeline* pipeline, size_t begin, size_t end, RowRange* ranges) {
+  ranges[pipeline->size].begin = begin;
+  ranges[pipeline->size].end = end;
+  for (u64 s = pipeline->size; s > 0; s--) {
+    ranges[s - 1] = stage_input_rows(&pipeline->stages[s - 1], ranges[s]);
+  }
+}
+
+/*  Largest feature map band, and working set of the largest stage, for bands of rows output rows
+    of lanes interleaved images. The band sizes only depend on the number of rows */
+static void band_sizes(const Pipeline* pipeline, const FeatureShape* shapes, RowRange* ranges,
+                       size_t rows, size_t lanes, size_t* scratch, size_t* working_set) {
+  band_rows(pipeline, 0, rows, ranges);
+  *scratch = 0;
+  *working_set = 0;
+
+  for (u64 s = 0; s < pipeline->size; s++) {
+    size_t in =
+            lanes * shapes[s].width * shapes[s].channels * (ranges[s].end - ranges[s].begin);
+    size_t out = lanes * shapes[s + 1].width * shapes[s + 1].channels *
+                 (ranges[s + 1].end - ranges[s + 1].begin);
+    if (out > *scratch) *scratch = out;
+    if (in + out > *working_set) *working_set = in + out;
+  }
+}
+
+/*  Shapes of the input and of the output of every stage, pipeline->size + 1 elements */
+static FeatureShape* pipeline_shapes(const Pipeline* pipeline, size_t image_width,
+                                     size_t image_height) {
+  FeatureShape* shapes = malloc((pipeline->size + 1) * sizeof(FeatureShape));
+
+  shapes[0].width = image_width;
+  shapes[0].height = image_height;
+  shapes[0].channels = 1;
+  for (u64 s = 0; s < pipeline->size; s++) {
+    shapes[s + 1] = stage_output_shape(&pipeline->stages[s], shapes[s]);
+  }
+  return shapes;
+}
+
+/*  Largest band of output rows whose working set fits in tile_bytes, at least one row */
+static size_t band_height(const Pipeline* pipeline, const FeatureShape* shapes, RowRange* ranges,
+                          size_t lanes, size_t tile_bytes, size_t* scratch_size) {
+  size_t rows = shapes[pipeline->size].height;
+  size_t working_set;
+
+  band_sizes(pipeline, shapes, ranges, rows, lanes, scratch_size, &working_set);
+  while (rows > 1 && working_set > tile_bytes) {
+    rows = (rows + 1) / 2;
+    band_sizes(pipeline, shapes, ranges, rows, lanes, scratch_size, &working_set);
+  }
+  return rows;
+}
+
+/*  Applies every stage of the pipeline to a single channel image, band of rows by band of rows.
+    Each band of output rows is computed from the band of input rows it depends on, through
+    all the stages, so that the intermediate feature maps stay in cache. The overlapping rows
+    between two bands are computed twice, the result is identical to apply_pipeline.
+    Returns a copy of the resulting features */
+unsigned char* apply_pipeline_tiled(const Pipeline* pipeline, const u8* image_ptr,
+                                    size_t image_width, size_t image_height, size_t tile_bytes) {
+  if (pipeline_has_crop(pipeline)) {
+    const Stage* crop = &pipeline->stages[0];
+    u8* cropped = malloc(crop->crop_width * crop->crop_height);
+    crop_image(crop, image_ptr, image_width, image_height, cropped);
+
+    Pipeline tail = pipeline_tail(pipeline);
+    u8* inputs =
+            apply_pipeline_tiled(&tail, cropped, crop->crop_width, crop->crop_height, tile_bytes);
+    free(cropped);
+    return inputs;
+  }
+
+  u64 nb_stages = pipeline->size;
+  FeatureShape* shapes = pipeline_shapes(pipeline, image_width, image_height);
+  RowRange* ranges = malloc((nb_stages + 1) * sizeof(RowRange));
+  FeatureShape final = shapes[nb_stages];
+
+  size_t scratch_size;
+  size_t rows = band_height(pipeline, shapes, ranges, 1, tile_bytes, &scratch_size);
+
+  u8* scratch[2];
+  scratch[0] = malloc(scratch_size);
+  scratch[1] = malloc(scratch_size);
+
+  size_t size = final.width * final.height * final.channels;
+  u8* inputs = aligned_alloc(64, size * sizeof(u8));
+
+  int interleaved = nb_stages > 0 &&
+                    pipeline->stages[nb_stages - 1].type == STAGE_FILTER_BANK &&
+                    pipeline->stages[nb_stages - 1].bank.layout == BANK_INTERLEAVED;
+
+  for (size_t begin = 0; begin < final.height; begin += rows) {
+    size_t end = (begin + rows < final.height) ? begin + rows : final.height;
+    band_rows(pipeline, begin, end, ranges);
+
+    u8* in = (u8*) image_ptr + ranges[0].begin * image_width;
+    for (u64 s = 0; s < nb_stages; s++) {
+      FeatureShape band = shapes[s];
+      band.height = ranges[s].end - ranges[s].begin;
+
+      run_stage(&pipeline->stages[s], in, scratch[s % 2], band);
+      in = scratch[s % 2];
+    }
+
+    // the band holds end - begin rows of each output channel
+    size_t band_rows_count = end - begin;
+    if (interleaved) {
+      memcpy(inputs + begin * final.width * final.channels, in,
+             band_rows_count * final.width * final.channels);
+    } else {
+      for (size_t c = 0; c < final.channels; c++) {
+        memcpy(inputs + c * final.width * final.height + begin * final.width,
+               in + c * final.width * band_rows_count, band_rows_count * final.width);
+      }
+    }
+  }
+
+  free(scratch[0]);
+  free(scratch[1]);
+  free(shapes);
+  free(ranges);
+
+  return inputs;
+}
+
+/*  Applies every stage of the pipeline to a single channel image.
+    image_ptr and buffer_ptr are both used as scratch and must hold
+    pipeline_buffer_size bytes. Returns a copy of the resulting features */
+unsigned char* apply_pipeline(const Pipeline* pipeline, u8* image_ptr, u8* buffer_ptr,
+                              size_t image_width, size_t image_height) {
+  // the crop is a copy of a window of the image, the other stages run on that window
+  if (pipeline_has_crop(pipeline)) {
+    const Stage* crop = &pipeline->stages[0];
+    crop_image(crop, image_ptr, image_width, image_height, buffer_ptr);
+
+    Pipeline tail = pipeline_tail(pipeline);
+    return apply_pipeline(&tail, buffer_ptr, image_ptr, crop->crop_width, crop->crop_height);
+  }
+
+  FeatureShape shape = {image_width, image_height, 1};
+  size_t tile_bytes = pipeline_tile_bytes(pipeline);
+
+  // Full images passes would not stay in cache
+  if (pipeline->size > 0 && 2 * pipeline_buffer_size(pipeline, shape) > tile_bytes) {
+    return apply_pipeline_tiled(pipeline, image_ptr, image_width, image_height, tile_bytes);
+  }
+
+  for (u64 i = 0; i < pipeline->size; i++) {
+    apply_stage(&pipeline->stages[i], &image_ptr, &buffer_ptr, &shape);
+  }
+
+  size_t size = shape.width * shape.height * shape.channels;
+  u8* inputs = aligned_alloc(64, size * sizeof(u8));
+  memcpy(inputs, image_ptr, sizeof(u8) * size);
+
+  return inputs;
+}
+
+
+/*  True if every stage has a batched filter, a leading crop being done image by image */
+int pipeline_supports_batch(const Pipeline* pipeline) {
+  for (u64 i = pipeline_has_crop(pipeline); i < pipeline->size; i++) {
+    switch (pipeline->stages[i].type) {
+      case STAGE_CONVOLUTION_5X5:
+      case STAGE_CONVOLUTION_3X3:
+      case STAGE_MAX_POOL_2X2:
+      case STAGE_AVG_POOL_2X2:
+        break;
+      default:
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/*  Batched run_stage, on FILTER_BATCH interleaved feature maps */
+static void run_stage_batch(const Stage* stage, const u8* image, u8* buffer, FeatureShape shape) {
+  FeatureShape output = stage_output_shape(stage, shape);
+  size_t in_plane = shape.width * shape.height * FILTER_BATCH;
+  size_t out_plane = output.width * output.height * FILTER_BATCH;
+
+  for (size_t c = 0; c < shape.channels; c++) {
+    const u8* in = image + c * in_plane;
+    u8* out = buffer + c * out_plane;
+
+    switch (stage->type) {
+      case STAGE_CONVOLUTION_5X5:
+        convolution_batch(in, out, shape.height, shape.width, stage->kernel_filter, 5, 9,
+                          stage->stride, stage->dilation);
+        break;
+      case STAGE_CONVOLUTION_3X3:
+        convolution_batch(in, out, shape.height, shape.width, stage->kernel_filter, 3, 5,
+                          stage->stride, stage->dilation);
+        break;
+      case STAGE_MAX_POOL_2X2:
+        max_pool_2X2_batch(in, out, shape.height, shape.width);
+        break;
+      case STAGE_AVG_POOL_2X2:
+        avg_pool_2X2_batch(in, out, shape.height, shape.width);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/*  Applies every stage of the pipeline to count (at most FILTER_BATCH) single channel images
+    of the same size at once. The images are interleaved so that every SIMD lane works on
+    the same pixel of a different image, and processed in bands of rows like
+    apply_pipeline_tiled. Only the final features are de-interleaved.
+    The pipeline must support batching. inputs[b] receives a copy of the features of
+    images[b], identical to apply_pipeline */
+void apply_pipeline_batch(const Pipeline* pipeline, const u8* const* images, u64 count,
+                          size_t image_width, size_t image_height, u8** inputs) {
+  if (pipeline_has_crop(pipeline)) {
+    const Stage* crop = &pipeline->stages[0];
+    size_t crop_size = crop->crop_width * crop->crop_height;
+    u8* cropped = malloc(count * crop_size);
+    const u8* cropped_images[FILTER_BATCH];
+
+    for (u64 b = 0; b < count; b++) {
+      crop_image(crop, images[b], image_width, image_height, cropped + b * crop_size);
+      cropped_images[b] = cropped + b * crop_size;
+    }
+
+    Pipeline tail = pipeline_tail(pipeline);
+    apply_pipeline_batch(&tail, cropped_images, count, crop->crop_width, crop->crop_height,
+                         inputs);
+    free(cropped);
+    return;
+  }
+
+  u64 nb_stages = pipeline->size;
+  FeatureShape* shapes = pipeline_shapes(pipeline, image_width, image_height);
+  RowRange* ranges = malloc((nb_stages + 1) * sizeof(RowRange));
+  FeatureShape final = shapes[nb_stages];
+
+  size_t scratch_size;
+  size_t rows = band_height(pipeline, shapes, ranges, FILTER_BATCH, pipeline_tile_bytes(pipeline),
+                            &scratch_size);
+
+  u8* batch = malloc(image_width * image_height * FILTER_BATCH);
+  interleave_batch(images, count, image_width * image_height, batch);
+
+  u8* scratch[2];
+  scratch[0] = malloc(scratch_size);
+  scratch[1] = malloc(scratch_size);
+
+  size_t size = final.width * final.height * final.channels;
+  for (u64 b = 0; b < count; b++) { inputs[b] = aligned_alloc(64, size * sizeof(u8)); }
+
+  for (size_t begin = 0; begin < final.height; begin += rows) {
+    size_t end = (begin + rows < final.height) ? begin + rows : final.height;
+    band_rows(pipeline, begin, end, ranges);
+
+    u8* in = batch + ranges[0].begin * image_width * FILTER_BATCH;
+    for (u64 s = 0; s < nb_stages; s++) {
+      FeatureShape band = shapes[s];
+      band.height = ranges[s].end - ranges[s].begin;
+
+      run_stage_batch(&pipeline->stages[s], in, scratch[s % 2], band);
+      in = scratch[s % 2];
+    }
+
+    // de-interleave the band, end - begin rows of each output channel
+    size_t band_size = (end - begin) * final.width;
+    for (size_t c = 0; c < final.channels; c++) {
+      const u8* src = in + c * band_size * FILTER_BATCH;
+      size_t offset = c * final.width * final.height + begin * final.width;
+      for (size_t p = 0; p < band_size; p++) {
+        for (u64 b = 0; b < count; b++) { inputs[b][offset + p] = src[p * FILTER_BATCH + b]; }
+      }
+    }
+  }
+
+  free(batch);
+  free(scratch[0]);
+  free(scratch[1]);
+  free(shapes);
+  free(ranges);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convolution_layer.h"
+
+// Preprocessing pipeline : the list of image filters applied to an image before feeding it
+// to the neural network, see image.filters in the config.
+// Multi channels feature maps are stored as planes, one channel after the other
+
+typedef enum {
+  STAGE_CONVOLUTION_5X5,
+  STAGE_CONVOLUTION_3X3,
+  STAGE_MAX_POOL_2X2,
+  STAGE_AVG_POOL_2X2,
+  STAGE_FILTER_BANK,
+  STAGE_SOBEL_3X3,
+  STAGE_MAX_POOL,
+  STAGE_AVG_POOL,
+  STAGE_CROP,
+} StageType;
+
+// Where the window of a crop is centered : on the foreground of each image, or on the union of
+// the foregrounds of the training images (see pipeline_fit_crop)
+typedef enum { CROP_IMAGE = 0, CROP_DATASET = 1 } CropMode;
+
+typedef struct {
+  StageType type;
+
+  // convolutions, a stride of 2 gives the geometry of a convolution followed by a 2x2 pooling
+  const u8* kernel_filter;
+  int stride;
+  int dilation;
+
+  // poolings of any size, over window x window tiles every stride pixels
+  int window;
+
+  // filter bank
+  FilterBank bank;
+
+  // sobel, and foreground of the crop
+  int threshold;
+  SobelMagnitude magnitude;
+
+  // crop to a crop_width x crop_height window, only as the first stage
+  size_t crop_width;
+  size_t crop_height;
+  CropMode crop_mode;
+  BoundingBox crop_box;
+} Stage;
+
+typedef struct {
+  u64 size;
+  Stage* stages;
+
+  // Images whose feature maps do not fit in tile_bytes are processed in bands of rows,
+  // running all the stages on a band before moving to the next one.
+  // 0 uses the size of the L2 cache
+  size_t tile_bytes;
+
+  // When set, images of the same size are processed FILTER_BATCH at a time, interleaved,
+  // if every stage has a batched filter (see pipeline_supports_batch)
+  int batch;
+} Pipeline;
+
+// Geometry of a feature map between two stages
+typedef struct {
+  size_t width;
+  size_t height;
+  size_t channels;
+} FeatureShape;
+
+// construction
+void init_pipeline(Pipeline* pipeline);
+void default_pipeline(Pipeline* pipeline);
+int stage_from_name(const char* name, Stage* stage);
+void pipeline_add_stage(Pipeline* pipeline, const Stage* stage);
+int check_pipeline(const Pipeline* pipeline, FeatureShape input);
+void free_pipeline(Pipeline* pipeline);
+void pipeline_fit_crop(Pipeline* pipeline, const u8* image, size_t image_width,
+                       size_t image_height);
+
+// geometry
+FeatureShape stage_output_shape(const Stage* stage, FeatureShape input);
+FeatureShape pipeline_output_shape(const Pipeline* pipeline, FeatureShape input);
+size_t pipeline_buffer_size(const Pipeline* pipeline, FeatureShape input);
+
+// processing
+size_t pipeline_tile_bytes(const Pipeline* pipeline);
+unsigned char* apply_pipeline_tiled(const Pipeline* pipeline, const u8* image_ptr,
+                                    size_t image_width, size_t image_height, size_t tile_bytes);
+unsigned char* apply_pipeline(const Pipeline* pipeline, u8* image_ptr, u8* buffer_ptr,
+                              size_t image_width, size_t image_height);
+int pipeline_supports_batch(const Pipeline* pipeline);
+void apply_pipeline_batch(const Pipeline* pipeline, const u8* const* images, u64 count,
+                          size_t image_width, size_t image_height, u8** inputs);
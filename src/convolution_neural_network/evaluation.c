@@ -44,13 +44,11 @@ void process_score(Score* score) {
   int fp = score->false_positive;
   int fn = score->false_negative;
   double recall = tp / (double) (tp + fn);// also sensitivity, also true positive rate
-  double specificity = tn / (double) (tn + fp);
   double precision = tp / (double) (tp + fp);
   double accuracy = (tp + tn) / (double) (tp + tn + fp + fn);
   double false_positive_rate = fp / (double) (fp + tn);
 
   if (tp + fn == 0) recall = 0;
-  if (tn + tp == 0) specificity = 0;
   if (tp + fp == 0) precision = 0;
 
   double f1 = 2 * (recall * precision) / (recall + precision);
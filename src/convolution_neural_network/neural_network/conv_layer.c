@@ -0,0 +1,126 @@
+#include "conv_layer.h"
+
+//  Copies every kernel sized patch of the input in a column of conv->columns.
+//  Row (c, ki, kj) of the result holds, for each output pixel, the input value
+//  multiplied by the weight (c, ki, kj) of each filter
+void im2col(const f64* input, ConvShape* conv) {
+  u64 k = conv->kernel;
+  u64 stride = conv->stride;
+  u64 pixels = conv->out_height * conv->out_width;
+
+  for (u64 c = 0; c < conv->channels; c++) {
+    const f64* plane = input + c * conv->height * conv->width;
+
+    for (u64 ki = 0; ki < k; ki++) {
+      for (u64 kj = 0; kj < k; kj++) {
+        f64* row = conv->columns + ((c * k + ki) * k + kj) * pixels;
+
+        for (u64 oy = 0; oy < conv->out_height; oy++) {
+          const f64* src = plane + (oy * stride + ki) * conv->width + kj;
+          for (u64 ox = 0; ox < conv->out_width; ox++) {
+            row[oy * conv->out_width + ox] = src[ox * stride];
+          }
+        }
+      }
+    }
+  }
+}
+
+//  Inverse of im2col : accumulates conv->delta_columns back into the input geometry.
+//  Overlapping patches add up, output is overwritten
+void col2im(const ConvShape* conv, f64* output) {
+  u64 k = conv->kernel;
+  u64 stride = conv->stride;
+  u64 pixels = conv->out_height * conv->out_width;
+
+  memset(output, 0, conv->channels * conv->height * conv->width * sizeof(f64));
+
+  for (u64 c = 0; c < conv->channels; c++) {
+    f64* plane = output + c * conv->height * conv->width;
+
+    for (u64 ki = 0; ki < k; ki++) {
+      for (u64 kj = 0; kj < k; kj++) {
+        const f64* row = conv->delta_columns + ((c * k + ki) * k + kj) * pixels;
+
+        for (u64 oy = 0; oy < conv->out_height; oy++) {
+          f64* dst = plane + (oy * stride + ki) * conv->width + kj;
+          for (u64 ox = 0; ox < conv->out_width; ox++) {
+            dst[ox * stride] += row[oy * conv->out_width + ox];
+          }
+        }
+      }
+    }
+  }
+}
+
+//  Forward pass of a convolution layer :
+//  next = sigmoid(weights * im2col(neurons) + bias)
+//  3x3, stride 1 layers go through Winograd instead, and only lower the neurons when
+//  backpropagating
+void compute_conv_layer(Layer* layer1, Layer* layer2) {
+  ConvShape* conv = layer1->conv;
+  u64 patch = conv->channels * conv->kernel * conv->kernel;
+  u64 pixels = conv->out_height * conv->out_width;
+
+  if (conv->winograd) {
+    winograd_convolution(conv, layer1->weights, layer1->neurons, layer2->neurons);
+    for (u64 f = 0; f < conv->filters; f++) {
+      for (u64 p = 0; p < pixels; p++) { layer2->neurons[f * pixels + p] += layer1->bias[f]; }
+    }
+  } else {
+    im2col(layer1->neurons, conv);
+
+    for (u64 f = 0; f < conv->filters; f++) {
+      for (u64 p = 0; p < pixels; p++) { layer2->neurons[f * pixels + p] = layer1->bias[f]; }
+    }
+
+    gemm(0, 0, conv->filters, pixels, patch, 1.0, layer1->weights, conv->columns, 1.0,
+         layer2->neurons);
+  }
+
+  for (u64 i = 0; i < conv->filters * pixels; i++) {
+    layer2->neurons[i] = sigmoid(layer2->neurons[i]);
+  }
+}
+
+//  Backpropagation process.
+//  Computes the error delta of the input feature maps of a convolution layer
+void compute_conv_delta(Layer* layer1, Layer* layer2) {
+  ConvShape* conv = layer1->conv;
+  u64 patch = conv->channels * conv->kernel * conv->kernel;
+  u64 pixels = conv->out_height * conv->out_width;
+
+  gemm(1, 0, patch, pixels, conv->filters, 1.0, layer1->weights, layer2->delta_neurons, 0.0,
+       conv->delta_columns);
+  col2im(conv, layer1->delta_neurons);
+
+  for (u64 i = 0; i < layer1->size; i++) {
+    layer1->delta_neurons[i] *= d_sigmoid(layer1->neurons[i]);
+  }
+}
+
+//  Backpropagation process
+//  Changes the filters and biases of a convolution layer.
+//  Relies on the columns lowered during the last forward pass, or lowers the neurons
+//  (unchanged since then) after a Winograd forward pass
+void backpropagate_conv(Layer* layer1, Layer* layer2, f64 eta_, f64 alpha_) {
+  ConvShape* conv = layer1->conv;
+  u64 patch = conv->channels * conv->kernel * conv->kernel;
+  u64 pixels = conv->out_height * conv->out_width;
+
+  if (conv->winograd) {
+    im2col(layer1->neurons, conv);
+    conv->winograd->filters_ready = 0;
+  }
+
+  gemm(0, 1, conv->filters, patch, pixels, eta_, layer2->delta_neurons, conv->columns, alpha_,
+       layer1->delta_weights);
+  for (u64 i = 0; i < conv->filters * patch; i++) { layer1->weights[i] += layer1->delta_weights[i]; }
+
+  for (u64 f = 0; f < conv->filters; f++) {
+    f64 s = 0.0;
+    for (u64 p = 0; p < pixels; p++) { s += layer2->delta_neurons[f * pixels + p]; }
+    layer1->delta_bias[f] = eta_ * s + alpha_ * layer1->delta_bias[f];
+    layer1->bias[f] += layer1->delta_bias[f];
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm.h"
+#include "neural_network.h"
+#include "type.h"
+#include "winograd.h"
+
+// Trainable convolution layers.
+// The input feature maps are lowered with im2col so that both the forward and the backward
+// passes reduce to the same gemm kernels used by the dense layers.
+// Convolutions are "valid" (no padding), like the fixed image filters.
+
+// lowering
+void im2col(const f64* input, ConvShape* conv);
+void col2im(const ConvShape* conv, f64* output);
+
+// forward
+void compute_conv_layer(Layer* layer1, Layer* layer2);
+
+// backward
+void compute_conv_delta(Layer* layer1, Layer* layer2);
+void backpropagate_conv(Layer* layer1, Layer* layer2, f64 eta_, f64 alpha_);
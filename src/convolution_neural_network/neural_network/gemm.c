@@ -0,0 +1,92 @@
+#include "gemm.h"
+
+//  C = beta * C, with beta = 0 overwriting C (it may hold garbage)
+static void scale_matrix(f64* restrict c, u64 size, f64 beta) {
+  if (beta == 1.0) return;
+  if (beta == 0.0) {
+    for (u64 i = 0; i < size; i++) c[i] = 0.0;
+    return;
+  }
+  for (u64 i = 0; i < size; i++) c[i] *= beta;
+}
+
+//  C = alpha * A * B + beta * C
+//  The i-p-j order keeps the inner loop contiguous on both B and C
+static void gemm_nn(u64 m, u64 n, u64 k, f64 alpha, const f64* restrict a, const f64* restrict b,
+                    f64 beta, f64* restrict c) {
+
+  // Matrix-vector product (dense layers), one dot product per row
+  if (n == 1) {
+    for (u64 i = 0; i < m; i++) {
+      f64 s = (beta == 0.0) ? 0.0 : beta * c[i];
+      for (u64 p = 0; p < k; p++) { s += alpha * a[i * k + p] * b[p]; }
+      c[i] = s;
+    }
+    return;
+  }
+
+  scale_matrix(c, m * n, beta);
+  for (u64 i = 0; i < m; i++) {
+    for (u64 p = 0; p < k; p++) {
+      f64 aip = alpha * a[i * k + p];
+      for (u64 j = 0; j < n; j++) { c[i * n + j] += aip * b[p * n + j]; }
+    }
+  }
+}
+
+//  C = alpha * A^T * B + beta * C, A being stored k x m
+static void gemm_tn(u64 m, u64 n, u64 k, f64 alpha, const f64* restrict a, const f64* restrict b,
+                    f64 beta, f64* restrict c) {
+  scale_matrix(c, m * n, beta);
+
+  // Transposed matrix-vector product (dense layers backward), accumulates rows of A
+  if (n == 1) {
+    for (u64 p = 0; p < k; p++) {
+      for (u64 i = 0; i < m; i++) { c[i] += alpha * a[p * m + i] * b[p]; }
+    }
+    return;
+  }
+
+  for (u64 p = 0; p < k; p++) {
+    for (u64 i = 0; i < m; i++) {
+      f64 api = alpha * a[p * m + i];
+      for (u64 j = 0; j < n; j++) { c[i * n + j] += api * b[p * n + j]; }
+    }
+  }
+}
+
+//  C = alpha * A * B^T + beta * C, B being stored n x k
+//  Every output is a dot product between two contiguous rows
+static void gemm_nt(u64 m, u64 n, u64 k, f64 alpha, const f64* restrict a, const f64* restrict b,
+                    f64 beta, f64* restrict c) {
+  for (u64 i = 0; i < m; i++) {
+    for (u64 j = 0; j < n; j++) {
+      f64 s = 0.0;
+      for (u64 p = 0; p < k; p++) { s += a[i * k + p] * b[j * k + p]; }
+      c[i * n + j] = (beta == 0.0) ? alpha * s : alpha * s + beta * c[i * n + j];
+    }
+  }
+}
+
+//  C = alpha * A^T * B^T + beta * C, A being stored k x m and B n x k
+static void gemm_tt(u64 m, u64 n, u64 k, f64 alpha, const f64* restrict a, const f64* restrict b,
+                    f64 beta, f64* restrict c) {
+  for (u64 i = 0; i < m; i++) {
+    for (u64 j = 0; j < n; j++) {
+      f64 s = 0.0;
+      for (u64 p = 0; p < k; p++) { s += a[p * m + i] * b[j * k + p]; }
+      c[i * n + j] = (beta == 0.0) ? alpha * s : alpha * s + beta * c[i * n + j];
+    }
+  }
+}
+
+void gemm(int trans_a, int trans_b, u64 m, u64 n, u64 k, f64 alpha, const f64* a, const f64* b,
+          f64 beta, f64* c) {
+  if (!trans_a && !trans_b) gemm_nn(m, n, k, alpha, a, b, beta, c);
+  else if (trans_a && !trans_b)
+    gemm_tn(m, n, k, alpha, a, b, beta, c);
+  else if (!trans_a && trans_b)
+    gemm_nt(m, n, k, alpha, a, b, beta, c);
+  else
+    gemm_tt(m, n, k, alpha, a, b, beta, c);
+}
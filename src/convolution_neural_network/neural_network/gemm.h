@@ -0,0 +1,16 @@
+#pragma once
+#include <stdlib.h>
+
+#include "type.h"
+
+// Dense matrix products used by both the fully connected and the convolution layers.
+// All matrices are row-major and packed, op(X) is X or its transpose depending on the
+// matching trans flag :
+//   - op(A) is m x k, stored m x k (trans_a = 0) or k x m (trans_a = 1)
+//   - op(B) is k x n, stored k x n (trans_b = 0) or n x k (trans_b = 1)
+//   - C is m x n
+//
+// Computes C = alpha * op(A) * op(B) + beta * C
+// When beta is 0, C is overwritten and does not need to be initialized
+void gemm(int trans_a, int trans_b, u64 m, u64 n, u64 k, f64 alpha, const f64* a, const f64* b,
+          f64 beta, f64* c);
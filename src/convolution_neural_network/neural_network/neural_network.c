@@ -1,4 +1,5 @@
 #include "neural_network.h"
+#include "conv_layer.h"
 
 //  Activations functions
 f64 sigmoid(f64 x) { return 1 / (1 + exp(-x)); }
@@ -19,19 +20,110 @@ Layer* create_layer(u64 size, u64 next_size) {
   layer->delta_weights = aligned_alloc(64, size * next_size * sizeof(f64));
   layer->delta_bias = aligned_alloc(64, next_size * sizeof(f64));
 
+  layer->type = DENSE_LAYER;
+  layer->conv = NULL;
+
+  return layer;
+}
+
+//  Geometry and lowering buffers of a convolution layer.
+//  The gradient of the columns is only needed to backpropagate
+static ConvShape* create_conv_shape(u64 channels, u64 height, u64 width, u64 filters, u64 kernel,
+                                    u64 stride, int trainable) {
+  ConvShape* conv = malloc(sizeof(ConvShape));
+  conv->channels = channels;
+  conv->height = height;
+  conv->width = width;
+  conv->filters = filters;
+  conv->kernel = kernel;
+  conv->stride = stride;
+  conv->out_height = (height - kernel) / stride + 1;
+  conv->out_width = (width - kernel) / stride + 1;
+
+  u64 patch = channels * kernel * kernel;
+  u64 pixels = conv->out_height * conv->out_width;
+
+  conv->columns = aligned_alloc(64, patch * pixels * sizeof(f64));
+  conv->delta_columns = trainable ? aligned_alloc(64, patch * pixels * sizeof(f64)) : NULL;
+  conv->winograd = (channels >= WINOGRAD_MIN_CHANNELS) ? create_winograd(conv) : NULL;
+
+  return conv;
+}
+
+//  Allocate a convolution layer taking channels x height x width neurons,
+//  and producing filters feature maps
+Layer* create_conv_layer(u64 channels, u64 height, u64 width, u64 filters, u64 kernel,
+                         u64 stride) {
+  ConvShape* conv = create_conv_shape(channels, height, width, filters, kernel, stride, 1);
+
+  u64 size = channels * height * width;
+  u64 patch = channels * kernel * kernel;
+
+  Layer* layer = malloc(sizeof(Layer));
+  layer->size = size;
+  layer->type = CONV_LAYER;
+  layer->conv = conv;
+
+  layer->neurons = aligned_alloc(64, size * sizeof(f64));
+  layer->weights = aligned_alloc(64, filters * patch * sizeof(f64));
+  layer->bias = aligned_alloc(64, filters * sizeof(f64));
+
+  layer->delta_neurons = aligned_alloc(64, size * sizeof(f64));
+  layer->delta_weights = aligned_alloc(64, filters * patch * sizeof(f64));
+  layer->delta_bias = aligned_alloc(64, filters * sizeof(f64));
+
   return layer;
 }
 
+//  Allocate a layer which is only run forward : its neurons, and the buffers of its
+//  convolution when conv is not NULL. The weights and bias are left NULL, for the caller
+//  to point them to already computed values (see map_neural_network)
+static Layer* create_inference_layer(u64 size, ConvShape* conv) {
+  Layer* layer = malloc(sizeof(Layer));
+  layer->size = size;
+  layer->type = conv ? CONV_LAYER : DENSE_LAYER;
+  layer->conv = conv;
+
+  layer->neurons = aligned_alloc(64, size * sizeof(f64));
+  layer->weights = NULL;
+  layer->bias = NULL;
+
+  layer->delta_neurons = NULL;
+  layer->delta_weights = NULL;
+  layer->delta_bias = NULL;
+
+  return layer;
+}
+
+//  Number of weights going out of a layer
+u64 layer_weights_size(Layer* layer, u64 next_size) {
+  if (layer->type == CONV_LAYER) {
+    ConvShape* conv = layer->conv;
+    return conv->filters * conv->channels * conv->kernel * conv->kernel;
+  }
+  return layer->size * next_size;
+}
+
+//  Number of biases going out of a layer
+u64 layer_bias_size(Layer* layer, u64 next_size) {
+  if (layer->type == CONV_LAYER) return layer->conv->filters;
+  return next_size;
+}
+
 
 //  Init a layer with random values
+//  One row of weights per bias : a neuron of the next layer or a filter
 void init_layer(Layer* layer, u64 next_size) {
   u64 size = layer->size;
-  for (u64 j = 0; j < next_size; j++) {
+  u64 rows = layer_bias_size(layer, next_size);
+  u64 row_size = layer_weights_size(layer, next_size) / rows;
+
+  for (u64 j = 0; j < rows; j++) {
     layer->bias[j] = ((f64) rand() / (f64) RAND_MAX) - 0.5;
     layer->delta_bias[j] = 0.0f;
-    for (u64 i = 0; i < size; i++) {
-      layer->weights[j * size + i] = ((f64) rand() / (f64) RAND_MAX) - 0.5;
-      layer->delta_weights[j * size + i] = 0.0f;
+    for (u64 i = 0; i < row_size; i++) {
+      layer->weights[j * row_size + i] = ((f64) rand() / (f64) RAND_MAX) - 0.5;
+      layer->delta_weights[j * row_size + i] = 0.0f;
     }
   }
   for (u64 i = 0; i < size; i++) {
@@ -45,13 +137,10 @@ void init_layer(Layer* layer, u64 next_size) {
 void compute_layer(Layer* layer1, Layer* layer2) {
   u64 size = layer1->size;
   u64 next_size = layer2->size;
-  f64 s = 0.0f;
 
-  for (u64 j = 0; j < next_size; j++) {
-    s = layer1->bias[j];
-    for (u64 i = 0; i < size; i++) { s += layer1->neurons[i] * layer1->weights[j * size + i]; }
-    layer2->neurons[j] = sigmoid(s);
-  }
+  for (u64 j = 0; j < next_size; j++) { layer2->neurons[j] = layer1->bias[j]; }
+  gemm(0, 0, next_size, 1, size, 1.0, layer1->weights, layer1->neurons, 1.0, layer2->neurons);
+  for (u64 j = 0; j < next_size; j++) { layer2->neurons[j] = sigmoid(layer2->neurons[j]); }
 }
 
 //  First step of the backpropagation process
@@ -76,32 +165,27 @@ void compute_delta(Layer* layer1, Layer* layer2) {
 
   u64 size = layer1->size;
   u64 next_size = layer2->size;
-  f64 s = 0.f;
 
-  for (u64 i = 0; i < size; i++) {
-    s = 0.0;
-    for (u64 j = 0; j < next_size; j++) {
-      s += layer1->weights[j * size + i] * layer2->delta_neurons[j];
-    }
-    layer1->delta_neurons[i] = s * d_sigmoid(layer1->neurons[i]);
-  }
+  gemm(1, 0, size, 1, next_size, 1.0, layer1->weights, layer2->delta_neurons, 0.0,
+       layer1->delta_neurons);
+  for (u64 i = 0; i < size; i++) { layer1->delta_neurons[i] *= d_sigmoid(layer1->neurons[i]); }
 }
 
 //  Backpropagation process
-//  Changes the weights of all neurons of a layer
+//  Changes the weights of all neurons of a layer.
+//  The weight gradient is the outer product of the deltas and the neurons, a gemm with k = 1
 void backpropagate(Layer* layer1, Layer* layer2, f64 eta_, f64 alpha_) {
 
   u64 size = layer1->size;
   u64 next_size = layer2->size;
 
+  gemm(0, 0, next_size, size, 1, eta_, layer2->delta_neurons, layer1->neurons, alpha_,
+       layer1->delta_weights);
+  for (u64 i = 0; i < next_size * size; i++) { layer1->weights[i] += layer1->delta_weights[i]; }
+
   for (u64 j = 0; j < next_size; j++) {
     layer1->delta_bias[j] = eta_ * layer2->delta_neurons[j] + alpha_ * layer1->delta_bias[j];
     layer1->bias[j] += layer1->delta_bias[j];
-    for (u64 i = 0; i < size; i++) {
-      layer1->delta_weights[j * size + i] = eta_ * layer1->neurons[i] * layer2->delta_neurons[j] +
-                                            alpha_ * layer1->delta_weights[j * size + i];
-      layer1->weights[j * size + i] += layer1->delta_weights[j * size + i];
-    }
   }
 }
 
@@ -136,7 +220,7 @@ void debug(Layer* layer, u64 next_size) {
 
 //  General free function, liberating all allocated memory to the NN
 void free_neural_network(Layer** layers, u64 size) {
-  for (int i = 0; i < size; i++) {
+  for (u64 i = 0; i < size; i++) {
     free(layers[i]->bias);
     free(layers[i]->neurons);
     free(layers[i]->weights);
@@ -144,11 +228,28 @@ void free_neural_network(Layer** layers, u64 size) {
     free(layers[i]->delta_neurons);
     free(layers[i]->delta_weights);
     free(layers[i]->delta_bias);
+
+    if (layers[i]->conv) {
+      free(layers[i]->conv->columns);
+      free(layers[i]->conv->delta_columns);
+      free_winograd(layers[i]->conv->winograd);
+      free(layers[i]->conv);
+    }
     free(layers[i]);
   }
   free(layers);
 }
 
+//  Frees a NN created by init_inference_network_from_context,
+//  whose weights and bias belong to someone else
+void free_inference_network(Layer** layers, u64 size) {
+  for (u64 i = 0; i < size; i++) {
+    layers[i]->weights = NULL;
+    layers[i]->bias = NULL;
+  }
+  free_neural_network(layers, size);
+}
+
 //  Creates and initializes the NN by calling previously defined functions
 Layer** init_neural_network(int* neurons_per_layers, u64 nb_layers) {
   Layer** layers = malloc(nb_layers * sizeof(Layer*));
@@ -162,11 +263,71 @@ Layer** init_neural_network(int* neurons_per_layers, u64 nb_layers) {
   return layers;
 }
 
-//  Shuffles the dataset to prevents pattern redundancy
-void shuffle(u64 size, u64* tab) {
-  for (u64 p = 0; p < size; p++) { tab[p] = p; }
-  for (u64 p = 0; p < size - 1; p++) {
-    u64 np = rand() % (size - p) + p;
+//  Allocates the layers of the NN described by the context :
+//  the convolution layers first, followed by the dense topology
+static Layer** create_neural_network_from_context(Context* context, int trainable) {
+  u64 nb_layers = context->nn_size;
+  Layer** layers = malloc(nb_layers * sizeof(Layer*));
+
+  u64 channels = context->input_channels;
+  u64 height = context->input_height;
+  u64 width = context->input_width;
+
+  for (u64 i = 0; i < nb_layers; i++) {
+    if (i < (u64) context->conv_size) {
+      ConvSpec* spec = &context->conv[i];
+      if (trainable) {
+        layers[i] = create_conv_layer(channels, height, width, spec->filters, spec->kernel,
+                                      spec->stride);
+      } else {
+        ConvShape* conv = create_conv_shape(channels, height, width, spec->filters, spec->kernel,
+                                            spec->stride, 0);
+        layers[i] = create_inference_layer(channels * height * width, conv);
+      }
+
+      channels = spec->filters;
+      height = layers[i]->conv->out_height;
+      width = layers[i]->conv->out_width;
+    } else if (trainable) {
+      layers[i] = create_layer(context->topology[i], context->topology[i + 1]);
+    } else {
+      layers[i] = create_inference_layer(context->topology[i], NULL);
+    }
+  }
+
+  return layers;
+}
+
+//  Creates and initializes the NN described by the context
+Layer** init_neural_network_from_context(Context* context) {
+  Layer** layers = create_neural_network_from_context(context, 1);
+
+  for (u64 i = 0; i < (u64) context->nn_size - 1; i++) {
+    init_layer(layers[i], context->topology[i + 1]);
+  }
+
+  return layers;
+}
+
+//  Creates the NN described by the context for inference only, without weights
+//  nor any of the buffers used to backpropagate (see create_inference_layer)
+Layer** init_inference_network_from_context(Context* context) {
+  return create_neural_network_from_context(context, 0);
+}
+
+//  splitmix64 generator : its whole state is one integer, which can be saved and restored
+u64 next_random(u64* state) {
+  u64 z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+//  Shuffles the order of the dataset to prevents pattern redundancy.
+//  tab is a permutation, shuffled again from its previous order
+void shuffle(u64 size, u64* tab, u64* rng) {
+  for (u64 p = 0; p + 1 < size; p++) {
+    u64 np = next_random(rng) % (size - p) + p;
 
     u64 op = tab[p];
     tab[p] = tab[np];
@@ -179,9 +340,18 @@ void fill_input(Layer* layer, u64 size, u8* tab) {
   for (u64 i = 0; i < size; i++) { layer->neurons[i] = (f64) tab[i] / 255; }
 }
 
+//  Inputs already scaled to [0, 1], as fill_input does
+void fill_input_f32(Layer* layer, u64 size, const f32* tab) {
+  for (u64 i = 0; i < size; i++) { layer->neurons[i] = tab[i]; }
+}
+
 //  Wrapper function, computing each layer forward
-void forward_compute(u64 nb_layers, Layer** layers, Context* context) {
-  for (u64 i = 0; i < nb_layers - 1; i++) { compute_layer(layers[i], layers[i + 1]); }
+void forward_compute(u64 nb_layers, Layer** layers) {
+  for (u64 i = 0; i < nb_layers - 1; i++) {
+    if (layers[i]->type == CONV_LAYER) compute_conv_layer(layers[i], layers[i + 1]);
+    else
+      compute_layer(layers[i], layers[i + 1]);
+  }
 }
 
 //  Computes the output error, used to compute the cumulated error of the NN
@@ -201,9 +371,16 @@ void backward_compute(Layer** layers, f64* expected, Context* context) {
   u64 nb_layers = context->nn_size;
   compute_output_delta(layers[nb_layers - 1], expected);
 
-  for (u64 i = nb_layers - 2; i > 0; i--) { compute_delta(layers[i], layers[i + 1]); }
+  for (u64 i = nb_layers - 2; i > 0; i--) {
+    if (layers[i]->type == CONV_LAYER) compute_conv_delta(layers[i], layers[i + 1]);
+    else
+      compute_delta(layers[i], layers[i + 1]);
+  }
 
   for (u64 i = 0; i < nb_layers - 1; i++) {
-    backpropagate(layers[i], layers[i + 1], context->eta_, context->alpha_);
+    if (layers[i]->type == CONV_LAYER)
+      backpropagate_conv(layers[i], layers[i + 1], context->eta_, context->alpha_);
+    else
+      backpropagate(layers[i], layers[i + 1], context->eta_, context->alpha_);
   }
 }
@@ -11,6 +11,41 @@
 // #define eta 0.5
 // #define alpha2 0.3
 
+typedef enum { DENSE_LAYER = 0, CONV_LAYER = 1 } LayerType;
+
+// Winograd F(2x2, 3x3) state of a 3x3, stride 1 convolution layer, see winograd.h.
+// The outputs are computed by 2x2 tiles, each from a 4x4 tile of the input
+typedef struct {
+  u64 tiles_y;
+  u64 tiles_x;
+
+  f64* filters;     // transformed filters, 16 x filters x channels
+  int filters_ready;// cleared whenever the weights change
+  f64* tiles;       // transformed input tiles, 16 x channels x tiles
+  f64* products;    // 16 x filters x tiles
+} Winograd;
+
+// Geometry of a convolution layer, which maps its channels x height x width neurons
+// to the filters x out_height x out_width neurons of the next layer.
+// Weights are stored filters x (channels * kernel * kernel), one bias per filter
+typedef struct {
+  u64 channels;
+  u64 height;
+  u64 width;
+
+  u64 filters;
+  u64 kernel;
+  u64 stride;
+
+  u64 out_height;
+  u64 out_width;
+
+  f64* columns;      // im2col lowering of the neurons, (channels * kernel * kernel) x out pixels
+  f64* delta_columns;// gradient of the lowered neurons, same shape
+
+  Winograd* winograd;// forward fast path, NULL when the layer does not use it
+} ConvShape;
+
 typedef struct {
   u64 size;
   f64* neurons;
@@ -19,6 +54,9 @@ typedef struct {
   f64* delta_neurons;
   f64* delta_weights;
   f64* delta_bias;
+
+  LayerType type;
+  ConvShape* conv;// NULL for dense layers
 } Layer;
 
 // f64 alpha = 0.9;
@@ -26,17 +64,24 @@ typedef struct {
 
 // neural network
 Layer** init_neural_network(int* neurons_per_layers, u64 nb_layers);
-void forward_compute(u64 nb_layers, Layer** layers, Context* context);
+Layer** init_neural_network_from_context(Context* context);
+Layer** init_inference_network_from_context(Context* context);
+void forward_compute(u64 nb_layers, Layer** layers);
 void backward_compute(Layer** layers, f64* expected, Context* context);
 void free_neural_network(Layer** layers, u64 size);
+void free_inference_network(Layer** layers, u64 size);
 
 
 // layer
 void init_layer(Layer* layer, u64 next_size);
 Layer* create_layer(u64 size, u64 next_size);
+Layer* create_conv_layer(u64 channels, u64 height, u64 width, u64 filters, u64 kernel, u64 stride);
+u64 layer_weights_size(Layer* layer, u64 next_size);
+u64 layer_bias_size(Layer* layer, u64 next_size);
 
 // forwqrd
 void fill_input(Layer* layer, u64 size, u8* tab);
+void fill_input_f32(Layer* layer, u64 size, const f32* tab);
 void compute_layer(Layer* layer1, Layer* layer2);
 f64 get_error(Layer* layer, f64* expected);
 
@@ -51,7 +96,8 @@ void debug(Layer* layer, u64 next_size);
 
 
 // misc
-void shuffle(u64 size, u64* tab);
+u64 next_random(u64* state);
+void shuffle(u64 size, u64* tab, u64* rng);
 
 // activations functions
 f64 sigmoid(f64 x);
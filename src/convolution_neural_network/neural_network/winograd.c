@@ -0,0 +1,162 @@
+#include "winograd.h"
+
+//  Allocates the Winograd state of a layer, NULL if the layer is not 3x3 with a stride of 1
+Winograd* create_winograd(const ConvShape* conv) {
+  if (conv->kernel != 3 || conv->stride != 1) return NULL;
+
+  Winograd* winograd = malloc(sizeof(Winograd));
+  winograd->tiles_y = (conv->out_height + 1) / 2;
+  winograd->tiles_x = (conv->out_width + 1) / 2;
+
+  u64 tiles = winograd->tiles_y * winograd->tiles_x;
+  winograd->filters = aligned_alloc(64, 16 * conv->filters * conv->channels * sizeof(f64));
+  winograd->filters_ready = 0;
+  winograd->tiles = aligned_alloc(64, 16 * conv->channels * tiles * sizeof(f64));
+  winograd->products = aligned_alloc(64, 16 * conv->filters * tiles * sizeof(f64));
+
+  return winograd;
+}
+
+void free_winograd(Winograd* winograd) {
+  if (winograd == NULL) return;
+  free(winograd->filters);
+  free(winograd->tiles);
+  free(winograd->products);
+  free(winograd);
+}
+
+//  U = G g G^T for every filter and channel, stored as 16 matrices filters x channels
+//  G = | 1    0    0  |
+//      | 1/2  1/2  1/2|
+//      | 1/2 -1/2  1/2|
+//      | 0    0    1  |
+void winograd_transform_filters(const ConvShape* conv, const f64* weights) {
+  Winograd* winograd = conv->winograd;
+  u64 fc = conv->filters * conv->channels;
+
+  for (u64 i = 0; i < fc; i++) {
+    const f64* g = weights + i * 9;
+    f64 gg[4][3];// G g
+
+    for (u64 j = 0; j < 3; j++) {
+      gg[0][j] = g[j];
+      gg[1][j] = 0.5 * (g[j] + g[3 + j] + g[6 + j]);
+      gg[2][j] = 0.5 * (g[j] - g[3 + j] + g[6 + j]);
+      gg[3][j] = g[6 + j];
+    }
+
+    for (u64 r = 0; r < 4; r++) {
+      f64 u[4];// row r of (G g) G^T
+      u[0] = gg[r][0];
+      u[1] = 0.5 * (gg[r][0] + gg[r][1] + gg[r][2]);
+      u[2] = 0.5 * (gg[r][0] - gg[r][1] + gg[r][2]);
+      u[3] = gg[r][2];
+      for (u64 c = 0; c < 4; c++) { winograd->filters[(r * 4 + c) * fc + i] = u[c]; }
+    }
+  }
+
+  winograd->filters_ready = 1;
+}
+
+//  V = B^T d B for every 4x4 input tile d, stored as 16 matrices channels x tiles.
+//  The tiles of the last row and column may go past the input, the missing values are 0
+//  B^T = | 1  0 -1  0 |
+//        | 0  1  1  0 |
+//        | 0 -1  1  0 |
+//        | 0  1  0 -1 |
+static void transform_tiles(const ConvShape* conv, const f64* input) {
+  Winograd* winograd = conv->winograd;
+  u64 tiles = winograd->tiles_y * winograd->tiles_x;
+  u64 ct = conv->channels * tiles;
+
+  for (u64 c = 0; c < conv->channels; c++) {
+    const f64* plane = input + c * conv->height * conv->width;
+
+    for (u64 ty = 0; ty < winograd->tiles_y; ty++) {
+      for (u64 tx = 0; tx < winograd->tiles_x; tx++) {
+        f64 d[4][4];
+        for (u64 r = 0; r < 4; r++) {
+          u64 y = 2 * ty + r;
+          for (u64 x = 0; x < 4; x++) {
+            u64 col = 2 * tx + x;
+            d[r][x] = (y < conv->height && col < conv->width) ? plane[y * conv->width + col] : 0.0;
+          }
+        }
+
+        f64 bd[4][4];// B^T d
+        for (u64 x = 0; x < 4; x++) {
+          bd[0][x] = d[0][x] - d[2][x];
+          bd[1][x] = d[1][x] + d[2][x];
+          bd[2][x] = d[2][x] - d[1][x];
+          bd[3][x] = d[1][x] - d[3][x];
+        }
+
+        f64* v = winograd->tiles + c * tiles + ty * winograd->tiles_x + tx;
+        for (u64 r = 0; r < 4; r++) {
+          v[(r * 4 + 0) * ct] = bd[r][0] - bd[r][2];
+          v[(r * 4 + 1) * ct] = bd[r][1] + bd[r][2];
+          v[(r * 4 + 2) * ct] = bd[r][2] - bd[r][1];
+          v[(r * 4 + 3) * ct] = bd[r][1] - bd[r][3];
+        }
+      }
+    }
+  }
+}
+
+//  Y = A^T m A for every tile of every filter, only the outputs inside the feature map
+//  are written
+//  A^T = | 1  1  1  0 |
+//        | 0  1 -1 -1 |
+static void inverse_transform(const ConvShape* conv, f64* output) {
+  Winograd* winograd = conv->winograd;
+  u64 tiles = winograd->tiles_y * winograd->tiles_x;
+  u64 ft = conv->filters * tiles;
+  u64 out_pixels = conv->out_height * conv->out_width;
+
+  for (u64 f = 0; f < conv->filters; f++) {
+    f64* plane = output + f * out_pixels;
+
+    for (u64 ty = 0; ty < winograd->tiles_y; ty++) {
+      for (u64 tx = 0; tx < winograd->tiles_x; tx++) {
+        const f64* m = winograd->products + f * tiles + ty * winograd->tiles_x + tx;
+
+        f64 am[2][4];// A^T m
+        for (u64 x = 0; x < 4; x++) {
+          f64 m0 = m[x * ft], m1 = m[(4 + x) * ft], m2 = m[(8 + x) * ft], m3 = m[(12 + x) * ft];
+          am[0][x] = m0 + m1 + m2;
+          am[1][x] = m1 - m2 - m3;
+        }
+
+        for (u64 r = 0; r < 2; r++) {
+          u64 y = 2 * ty + r;
+          if (y >= conv->out_height) break;
+
+          u64 x = 2 * tx;
+          plane[y * conv->out_width + x] = am[r][0] + am[r][1] + am[r][2];
+          if (x + 1 < conv->out_width)
+            plane[y * conv->out_width + x + 1] = am[r][1] - am[r][2] - am[r][3];
+        }
+      }
+    }
+  }
+}
+
+//  output = weights * input for a 3x3, stride 1 layer, without the bias.
+//  output holds filters x out_height x out_width values and is overwritten
+void winograd_convolution(const ConvShape* conv, const f64* weights, const f64* input,
+                          f64* output) {
+  Winograd* winograd = conv->winograd;
+  u64 tiles = winograd->tiles_y * winograd->tiles_x;
+
+  if (!winograd->filters_ready) winograd_transform_filters(conv, weights);
+  transform_tiles(conv, input);
+
+  for (u64 xi = 0; xi < 16; xi++) {
+    gemm(0, 0, conv->filters, tiles, conv->channels, 1.0,
+         winograd->filters + xi * conv->filters * conv->channels,
+         winograd->tiles + xi * conv->channels * tiles, 0.0,
+         winograd->products + xi * conv->filters * tiles);
+  }
+
+  inverse_transform(conv, output);
+}
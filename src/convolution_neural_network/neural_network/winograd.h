@@ -0,0 +1,24 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm.h"
+#include "neural_network.h"
+#include "type.h"
+
+// Winograd F(2x2, 3x3) forward pass of the 3x3, stride 1 convolution layers.
+// Every 4x4 input tile and every 3x3 filter are moved to the Winograd domain, where a 2x2
+// output tile only needs 16 products instead of 36. Summed over the channels, the products
+// become 16 independent (filters x channels) * (channels x tiles) gemm.
+// The transformed filters are cached until the weights change.
+
+// Layers with fewer input channels are as fast or faster with im2col : the gemm are too thin
+// to amortize the transforms of the tiles (see the benchmark target)
+#define WINOGRAD_MIN_CHANNELS 4
+
+Winograd* create_winograd(const ConvShape* conv);
+void free_winograd(Winograd* winograd);
+
+void winograd_transform_filters(const ConvShape* conv, const f64* weights);
+void winograd_convolution(const ConvShape* conv, const f64* weights, const f64* input,
+                          f64* output);
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdio.h>
+
+#include "../../src/type.h"
+#include "checkpoint.h"
+#include "context.h"
+#include "neural_network.h"
+#include "store.h"
+
+// Training on samples handed one at a time by their owner, without the dataset of
+// dataset_manager.h : the C++ datasets of the io library feed the training through it.
+// A source holds size samples, numbered from 0 to size - 1
+
+typedef struct {
+  void* data;
+  u64 size;
+
+  // Starts an epoch over the samples, in this order, or from 0 to size - 1 when order is NULL
+  void (*start_epoch)(void* data, const u64* order, u64 size);
+
+  // Fills the input layer with the inputs of the next sample of the epoch, and returns its
+  // label. Returns -1 once the epoch is over. Samples that failed to load are skipped
+  int (*next_sample)(void* data, Layer* input_layer);
+} SampleSource;
+
+// Runs the epochs from state->epoch to max_epoch, testing the network after each one.
+// A new training passes a state from init_training_state, a resumed one the state returned by
+// load_neural_network. Returns 0 on error
+int train_samples(Context* context, SampleSource* train_source, SampleSource* test_source,
+                  Layer** neural_network, TrainingState* state, FILE* fp_train, FILE* fp_test);
@@ -1,169 +1,831 @@
 #include "store.h"
 
-/* Stores a trained NN in a file, in order to be loaded for test */
-void store_neural_network(Context* context, Layer** layers) {
-  char sbuf[1024];
-
-  for (int i = 0; i < context->nn_size - 1; i++) {
-    // Layer * layer = nn[i];
-    u64 next_size = context->topology[i + 1];
-    u64 size = context->topology[i];
-
-    const char* path = context->storage_dir;
-    //
-    // //
-    // sprintf (sbuf, "%s/%d%s", path, i,"bias.dat");
-    // FILE *bias = fopen(sbuf,"w");
-    //
-    // for( u64 j = 0; j < next_size; j++ ){
-    //     fprintf(bias,"%lf\n", layer->bias[j]);
-    //     // printf("print : %lf\n", layer->bias[j]);
-    // }
-    //
-
-
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "bias.dat");
-    FILE* bias = fopen(sbuf, "w");
-    for (u64 j = 0; j < next_size; j++) { fprintf(bias, "%lf\n", layers[i]->bias[j]); }
-
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "delta_bias.dat");
-    FILE* delta_bias = fopen(sbuf, "w");
-    for (u64 j = 0; j < next_size; j++) { fprintf(delta_bias, "%lf\n", layers[i]->delta_bias[j]); }
-
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "weight.dat");
-    FILE* weight = fopen(sbuf, "w");
-    for (u64 j = 0; j < next_size; j++) {
-      for (u64 ii = 0; ii < size; ii++) {
-        fprintf(weight, "%lf\n", layers[i]->weights[j * size + ii]);
-      }
-    }
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static u64 align_offset(u64 offset) {
+  return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "delta_weight.dat");
-    FILE* delta_weight = fopen(sbuf, "w");
-    for (u64 j = 0; j < next_size; j++) {
-      for (u64 ii = 0; ii < size; ii++) {
-        fprintf(delta_weight, "%lf\n", layers[i]->delta_weights[j * size + ii]);
-      }
-    }
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "neurons.dat");
-    FILE* neurons = fopen(sbuf, "w");
-    for (u64 j = 0; j < size; j++) { fprintf(neurons, "%lf\n", layers[i]->neurons[j]); }
+static void model_path(const Context* context, const char* file_name, char* path, size_t size) {
+  snprintf(path, size, "%s/%s", context->storage_dir, file_name);
+}
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "delta_neurons.dat");
-    FILE* delta_neurons = fopen(sbuf, "w");
-    for (u64 j = 0; j < size; j++) { fprintf(delta_neurons, "%lf\n", layers[i]->delta_neurons[j]); }
+/*  Neurons of the next layer, 0 for the output layer */
+static u64 next_layer_size(const Context* context, u64 i) {
+  return (i + 1 < (u64) context->nn_size) ? (u64) context->topology[i + 1] : 0;
+}
 
+static void describe_layer(Layer* layer, u64 next_size, ModelLayer* description) {
+  memset(description, 0, sizeof(ModelLayer));
+  description->type = layer->type;
+  description->size = layer->size;
+  description->next_size = next_size;
+
+  if (layer->conv) {
+    description->channels = layer->conv->channels;
+    description->height = layer->conv->height;
+    description->width = layer->conv->width;
+    description->filters = layer->conv->filters;
+    description->kernel = layer->conv->kernel;
+    description->stride = layer->conv->stride;
+  }
+}
 
-    fclose(bias);
-    fclose(delta_bias);
+/*  Array of a layer stored as a tensor of the given kind, and its number of values */
+static f64* layer_tensor(Layer* layer, u64 next_size, TensorKind kind, u64* count) {
+  switch (kind) {
+    case TENSOR_WEIGHTS:
+      *count = layer_weights_size(layer, next_size);
+      return layer->weights;
+    case TENSOR_BIAS:
+      *count = layer_bias_size(layer, next_size);
+      return layer->bias;
+    case TENSOR_DELTA_WEIGHTS:
+      *count = layer_weights_size(layer, next_size);
+      return layer->delta_weights;
+    case TENSOR_DELTA_BIAS:
+      *count = layer_bias_size(layer, next_size);
+      return layer->delta_bias;
+    case TENSOR_NEURONS:
+      *count = layer->size;
+      return layer->neurons;
+    default:
+      *count = layer->size;
+      return layer->delta_neurons;
+  }
+}
 
-    fclose(weight);
-    fclose(delta_weight);
+static u64 dtype_size(ModelDtype dtype) {
+  switch (dtype) {
+    case MODEL_F64:
+      return 8;
+    case MODEL_F32:
+      return 4;
+    default:
+      return 2;
+  }
+}
 
-    fclose(neurons);
-    fclose(delta_neurons);
+/*  Rounds x to the nearest 16 bits float with the given number of exponent and mantissa
+    bits (ties to even), f16 is 5 + 10 and bf16 8 + 7. Directly from the bits of the double,
+    going through a float would round twice */
+static u16 f64_to_half(f64 x, int exponent_bits, int mantissa_bits) {
+  u64 bits;
+  memcpy(&bits, &x, sizeof(bits));
+
+  u16 sign = (u16) ((bits >> 63) << 15);
+  int exponent = (bits >> 52) & 0x7ff;
+  u64 mantissa = bits & ((1ull << 52) - 1);
+  int max_exponent = (1 << exponent_bits) - 1;
+  u16 infinity = (u16) (max_exponent << mantissa_bits);
+
+  if (exponent == 0x7ff) return sign | infinity | (mantissa ? 1 << (mantissa_bits - 1) : 0);
+
+  int e = exponent - 1023 + (max_exponent >> 1);
+  if (e >= max_exponent) return sign | infinity;
+
+  // normal numbers keep the implicit bit out of the result, subnormals shift it in
+  int shift = 52 - mantissa_bits;
+  u64 h = ((u64) e << mantissa_bits) | (mantissa >> shift);
+  if (e <= 0) {
+    if (exponent == 0) return sign;// doubles this small are 0 in any 16 bits format
+    mantissa |= 1ull << 52;
+    shift += 1 - e;
+    if (shift > 53) return sign;
+    h = mantissa >> shift;
   }
+
+  u64 rest = mantissa & ((1ull << shift) - 1);
+  u64 half = 1ull << (shift - 1);
+  if (rest > half || (rest == half && (h & 1))) h++;// may carry into the exponent, up to infinity
+
+  return sign | (u16) h;
 }
 
-/* Loads a trained NN from a file, in order to test it */
-Layer** load_neural_network(Context* context) {
-  int nn_size = context->nn_size;
-  Layer** layers = malloc(nn_size * sizeof(Layer*));
+/*  Exact inverse of f64_to_half */
+static f64 half_to_f64(u16 h, int exponent_bits, int mantissa_bits) {
+  int max_exponent = (1 << exponent_bits) - 1;
+  int bias = max_exponent >> 1;
+  int exponent = (h >> mantissa_bits) & max_exponent;
+  u64 mantissa = h & ((1u << mantissa_bits) - 1);
+  f64 value;
+
+  if (exponent == max_exponent) value = mantissa ? NAN : INFINITY;
+  else if (exponent == 0)
+    value = ldexp((f64) mantissa, 1 - bias - mantissa_bits);
+  else
+    value = ldexp((f64) (mantissa | (1ull << mantissa_bits)), exponent - bias - mantissa_bits);
+
+  return (h >> 15) ? -value : value;
+}
 
-  for (u64 i = 0; i < nn_size; i++) {
-    layers[i] = create_layer(context->topology[i], context->topology[i + 1]);
+static void encode_tensor(const f64* values, u64 count, ModelDtype dtype, u8* dst) {
+  switch (dtype) {
+    case MODEL_F64:
+      memcpy(dst, values, count * sizeof(f64));
+      break;
+    case MODEL_F32:
+      for (u64 i = 0; i < count; i++) ((f32*) dst)[i] = (f32) values[i];
+      break;
+    case MODEL_F16:
+      for (u64 i = 0; i < count; i++) ((u16*) dst)[i] = f64_to_half(values[i], 5, 10);
+      break;
+    case MODEL_BF16:
+      for (u64 i = 0; i < count; i++) ((u16*) dst)[i] = f64_to_half(values[i], 8, 7);
+      break;
   }
+}
 
-  // au cas ou
-  for (u64 i = 0; i < nn_size - 1; i++) { init_layer(layers[i], context->topology[i + 1]); }
+/*  Every stored value is exactly representable as a double */
+static void decode_tensor(const u8* src, u64 count, ModelDtype dtype, f64* values) {
+  switch (dtype) {
+    case MODEL_F64:
+      memcpy(values, src, count * sizeof(f64));
+      break;
+    case MODEL_F32:
+      for (u64 i = 0; i < count; i++) values[i] = ((const f32*) src)[i];
+      break;
+    case MODEL_F16:
+      for (u64 i = 0; i < count; i++) values[i] = half_to_f64(((const u16*) src)[i], 5, 10);
+      break;
+    case MODEL_BF16:
+      for (u64 i = 0; i < count; i++) values[i] = half_to_f64(((const u16*) src)[i], 8, 7);
+      break;
+  }
+}
 
+/*  Moves the i-th byte of every value of a block in the i-th plane. The end of a block which
+    is not a whole value is kept as is */
+static void shuffle_bytes(const u8* src, u64 size, u64 element_size, u8* dst) {
+  u64 count = size / element_size;
+  for (u64 b = 0; b < element_size; b++) {
+    for (u64 i = 0; i < count; i++) dst[b * count + i] = src[i * element_size + b];
+  }
+  memcpy(dst + count * element_size, src + count * element_size, size - count * element_size);
+}
 
-  char sbuf[1024];
-  char test[1024];
+static void unshuffle_bytes(const u8* src, u64 size, u64 element_size, u8* dst) {
+  u64 count = size / element_size;
+  for (u64 b = 0; b < element_size; b++) {
+    for (u64 i = 0; i < count; i++) dst[i * element_size + b] = src[b * count + i];
+  }
+  memcpy(dst + count * element_size, src + count * element_size, size - count * element_size);
+}
+
+/*  Sequential writes of what follows the header of a model file, a block at a time.
+    Only one block of the file is ever in memory, and each one is handed to the kernel,
+    which writes it back while the next one is compressed */
+typedef struct {
+  FILE* fp;
+  int level;       // zlib level, 0 writes the blocks as they are
+  u64 element_size;// bytes of a stored value, the number of planes of the shuffle
+  u64 offset;      // in the uncompressed file
+  u64 used;        // bytes of the current block
+  u8* block;
+  u8* shuffled;
+  u8* compressed;
+  int failed;
+} ModelWriter;
+
+static void init_writer(ModelWriter* writer, FILE* fp, int level, u64 element_size) {
+  memset(writer, 0, sizeof(ModelWriter));
+  writer->fp = fp;
+  writer->level = level;
+  writer->element_size = element_size;
+  writer->offset = sizeof(ModelHeader);
+  writer->block = malloc(MODEL_CHUNK);
+  if (level) {
+    writer->shuffled = malloc(MODEL_CHUNK);
+    writer->compressed = malloc(compressBound(MODEL_CHUNK));
+  }
+}
+
+static void flush_block(ModelWriter* writer) {
+  if (writer->used && !writer->failed && !writer->level) {
+    writer->failed = fwrite(writer->block, 1, writer->used, writer->fp) != writer->used;
+  } else if (writer->used && !writer->failed) {
+    shuffle_bytes(writer->block, writer->used, writer->element_size, writer->shuffled);
+    uLongf size = compressBound(MODEL_CHUNK);
+    writer->failed = compress2(writer->compressed, &size, writer->shuffled, writer->used,
+                               writer->level) != Z_OK;
+
+    u32 sizes[2] = {(u32) size, (u32) writer->used};
+    writer->failed = writer->failed || fwrite(sizes, sizeof(sizes), 1, writer->fp) != 1 ||
+                     fwrite(writer->compressed, 1, size, writer->fp) != size;
+  }
+  writer->used = 0;
+}
 
-  const char* path = context->storage_dir;
+/*  Room left in the current block, a new one when it is full */
+static u8* next_bytes(ModelWriter* writer, u64* room) {
+  if (writer->used == MODEL_CHUNK) flush_block(writer);
+  *room = MODEL_CHUNK - writer->used;
+  return writer->block + writer->used;
+}
+
+/*  Writes size bytes of data, or of 0 if data is NULL */
+static void write_bytes(ModelWriter* writer, const void* data, u64 size) {
+  while (size) {
+    u64 room;
+    u8* dst = next_bytes(writer, &room);
+    u64 length = size < room ? size : room;
+    if (data) {
+      memcpy(dst, data, length);
+      data = (const u8*) data + length;
+    } else {
+      memset(dst, 0, length);
+    }
+
+    writer->used += length;
+    writer->offset += length;
+    size -= length;
+  }
+}
+
+static void pad_to(ModelWriter* writer, u64 offset) {
+  write_bytes(writer, NULL, offset - writer->offset);
+}
 
-  for (int i = 0; i < nn_size - 1; i++) {
-    u64 next_size = context->topology[i + 1];
-    u64 size = context->topology[i];
+/*  Encodes the values directly in the blocks. Values never straddle two blocks : the tensors
+    are aligned, and everything before them is made of whole u64 */
+static void write_tensor(ModelWriter* writer, const f64* values, u64 count, ModelDtype dtype) {
+  while (count) {
+    u64 room;
+    u8* dst = next_bytes(writer, &room);
+    u64 length = count < room / writer->element_size ? count : room / writer->element_size;
+    encode_tensor(values, length, dtype, dst);
+
+    writer->used += length * writer->element_size;
+    writer->offset += length * writer->element_size;
+    values += length;
+    count -= length;
+  }
+}
 
-    f64 value = 0;
+/*  Returns 1 if the whole file was written */
+static int free_writer(ModelWriter* writer) {
+  flush_block(writer);
+  free(writer->block);
+  free(writer->shuffled);
+  free(writer->compressed);
+  return !writer->failed;
+}
 
+/*  Writes the first kinds tensors of every layer (all of them, or the weights and bias only)
+    and the training state if any, in the file_name of the storage directory, compressed with
+    the given zlib level unless it is 0.
+    The file is written next to the previous one, which it then replaces : a crash never
+    leaves a partial model behind */
+static int write_model(Context* context, Layer** layers, const char* file_name, ModelDtype dtype,
+                       u64 kinds, const TrainingState* state, int level) {
+  u64 nb_layers = context->nn_size;
+  u64 nb_tensors = (nb_layers - 1) * kinds;
+  u64 tables = sizeof(ModelHeader) + nb_layers * sizeof(ModelLayer) +
+               nb_tensors * sizeof(ModelTensor);
+
+  ModelLayer* descriptions = malloc(nb_layers * sizeof(ModelLayer));
+  ModelTensor* tensors = malloc(nb_tensors * sizeof(ModelTensor));
+
+  u64 offset = align_offset(tables);
+  for (u64 i = 0; i < nb_layers; i++) {
+    describe_layer(layers[i], next_layer_size(context, i), &descriptions[i]);
+    if (i + 1 == nb_layers) break;
+
+    for (u64 kind = 0; kind < kinds; kind++) {
+      ModelTensor* tensor = &tensors[i * kinds + kind];
+      layer_tensor(layers[i], descriptions[i].next_size, kind, &tensor->count);
+      tensor->layer = i;
+      tensor->kind = kind;
+      tensor->offset = offset;
+      offset = align_offset(offset + tensor->count * dtype_size(dtype));
+    }
+  }
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "bias.dat");
-    FILE* bias = fopen(sbuf, "r");
-    for (u64 j = 0; j < next_size; j++) {
-      int sc = fscanf(bias, "%lf\n", &value);
-      // printf("id value : %lld %lf\n", j, value);
-      layers[i]->bias[j] = value;
+  ModelHeader header;
+  memset(&header, 0, sizeof(ModelHeader));
+  memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+  header.version = MODEL_VERSION;
+  header.dtype = dtype;
+  header.nb_layers = nb_layers;
+  header.nb_tensors = nb_tensors;
+  header.compression = level ? MODEL_ZLIB : MODEL_RAW;
+
+  if (state && state->permutation) {
+    header.state_offset = offset;
+    offset = align_offset(offset + sizeof(ModelState) + state->size * sizeof(u64));
+  }
+  header.file_size = offset;
+
+  char path[1024];
+  char tmp_path[1040];
+  model_path(context, file_name, path, sizeof(path));
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  int stored = 0;
+  FILE* fp = fopen(tmp_path, "wb");
+  if (fp) {
+    ModelWriter writer;
+    init_writer(&writer, fp, level, dtype_size(dtype));
+    stored = fwrite(&header, sizeof(ModelHeader), 1, fp) == 1;
+
+    write_bytes(&writer, descriptions, nb_layers * sizeof(ModelLayer));
+    write_bytes(&writer, tensors, nb_tensors * sizeof(ModelTensor));
+
+    // the padding between the tensors is left to 0
+    for (u64 t = 0; t < nb_tensors; t++) {
+      u64 count;
+      f64* values = layer_tensor(layers[tensors[t].layer],
+                                 descriptions[tensors[t].layer].next_size, tensors[t].kind, &count);
+      pad_to(&writer, tensors[t].offset);
+      write_tensor(&writer, values, count, dtype);
     }
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "delta_bias.dat");
-    FILE* delta_bias = fopen(sbuf, "r");
-    for (u64 j = 0; j < next_size; j++) {
-      int sc = fscanf(delta_bias, "%lf\n", &value);
-      // printf("id value : %lld %lf\n", j, value);
-      layers[i]->delta_bias[j] = value;
+    if (header.state_offset) {
+      ModelState stored_state = {state->epoch, state->rng, state->size};
+      pad_to(&writer, header.state_offset);
+      write_bytes(&writer, &stored_state, sizeof(ModelState));
+      write_bytes(&writer, state->permutation, state->size * sizeof(u64));
     }
+    pad_to(&writer, header.file_size);
+
+    stored &= free_writer(&writer);
+    stored &= fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    stored &= fclose(fp) == 0;
+    stored = stored && rename(tmp_path, path) == 0;
+  }
+  if (!stored) {
+    fprintf(stderr, "could not write the model to %s\n", path);
+    remove(tmp_path);
+  }
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "weight.dat");
-    FILE* weight = fopen(sbuf, "r");
-    for (u64 j = 0; j < next_size; j++) {
-      for (u64 ii = 0; ii < size; ii++) {
-        int sc = fscanf(weight, "%lf\n", &value);
-        // printf("id value : %lld %lf\n", j, value);
-        layers[i]->weights[j * size + ii] = value;
-      }
+  free(tensors);
+  free(descriptions);
+
+  return stored;
+}
+
+/*  Stores a trained NN in a single binary file, in order to be loaded for test.
+    Every array of the layers is kept, so that the training can go on from the file */
+int store_neural_network(Context* context, Layer** layers, const TrainingState* state) {
+  return write_model(context, layers, MODEL_FILE, MODEL_F64, TENSOR_KINDS, state,
+                     context->compression);
+}
+
+/*  Stores the weights and bias of a trained NN, rounded to dtype, for inference */
+int export_neural_network(Context* context, Layer** layers, ModelDtype dtype) {
+  return write_model(context, layers, EXPORT_FILE, dtype, TENSOR_BIAS + 1, NULL, 0);
+}
+
+/*  Checks a model header against the context, before its tables are read.
+    Returns the size of the header and the tables, 0 if the file can not be loaded */
+static u64 check_header(const ModelHeader* header, Context* context, int full) {
+  u64 nb_layers = context->nn_size;
+
+  if (memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic))) {
+    fprintf(stderr, "not a model file\n");
+    return 0;
+  }
+  // The headers of the versions 1 and 2 were shorter, the rest of this one is not theirs
+  if (header->version != MODEL_VERSION) {
+    fprintf(stderr, "the model is in version %u of the format, this build only reads %d%s\n",
+            header->version, MODEL_VERSION,
+            header->version < MODEL_VERSION ? " : train it again to store it in that version" : "");
+    return 0;
+  }
+  if (header->dtype > MODEL_BF16 || header->compression > MODEL_ZLIB ||
+      (full && header->dtype != MODEL_F64)) {
+    fprintf(stderr, "unsupported model dtype %u, compression %u\n", header->dtype,
+            header->compression);
+    return 0;
+  }
+  if (header->nb_layers != nb_layers || header->nb_tensors > (nb_layers - 1) * TENSOR_KINDS) {
+    fprintf(stderr, "the model has %u layers, the config %llu\n", header->nb_layers, nb_layers);
+    return 0;
+  }
+
+  u64 tables = sizeof(ModelHeader) + nb_layers * sizeof(ModelLayer) +
+               header->nb_tensors * sizeof(ModelTensor);
+  if (header->file_size < tables) {
+    fprintf(stderr, "the model file is truncated\n");
+    return 0;
+  }
+
+  return tables;
+}
+
+/*  Checks the tables of a model (head, the header followed by its tables) against the
+    network built from the context. Every layer needs its weights and bias, and every
+    other array too when the model is loaded for training (full). The tensors and the state
+    follow each other in the file, so that it can be read in a single pass.
+    Returns 1 if the tensors can be copied */
+static int check_tables(const u8* head, Layer** layers, Context* context, int full) {
+  const ModelHeader* header = (const ModelHeader*) head;
+  u64 nb_layers = context->nn_size;
+  u64 size = header->file_size;
+
+  const ModelLayer* descriptions = (const ModelLayer*) (head + sizeof(ModelHeader));
+  for (u64 i = 0; i < nb_layers; i++) {
+    ModelLayer expected;
+    describe_layer(layers[i], next_layer_size(context, i), &expected);
+    if (memcmp(&expected, &descriptions[i], sizeof(ModelLayer))) {
+      fprintf(stderr, "layer %llu of the model does not match the config\n", i);
+      return 0;
     }
+  }
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "delta_weight.dat");
-    FILE* delta_weight = fopen(sbuf, "r");
-    for (u64 j = 0; j < next_size; j++) {
-      for (u64 ii = 0; ii < size; ii++) {
-        int sc = fscanf(delta_weight, "%lf\n", &value);
-        // printf("id value : %lld %lf\n", j, value);
-        layers[i]->delta_weights[j * size + ii] = value;
-      }
+  // one bit per kind of tensor found for each layer
+  u32* found = calloc(nb_layers, sizeof(u32));
+  int valid = 1;
+  u64 end = sizeof(ModelHeader) + nb_layers * sizeof(ModelLayer) +
+            header->nb_tensors * sizeof(ModelTensor);
+
+  const ModelTensor* tensors = (const ModelTensor*) (descriptions + nb_layers);
+  for (u64 t = 0; t < header->nb_tensors && valid; t++) {
+    const ModelTensor* tensor = &tensors[t];
+    u64 count = 0;
+    if (tensor->layer + 1 < nb_layers && tensor->kind < TENSOR_KINDS &&
+        !(found[tensor->layer] & (1u << tensor->kind))) {
+      layer_tensor(layers[tensor->layer], descriptions[tensor->layer].next_size, tensor->kind,
+                   &count);
+      found[tensor->layer] |= 1u << tensor->kind;
     }
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "neurons.dat");
-    FILE* neurons = fopen(sbuf, "r");
-    for (u64 j = 0; j < size; j++) {
-      int sc = fscanf(neurons, "%lf\n", &value);
-      // printf("id value : %lld %lf\n", j, value);
-      layers[i]->neurons[j] = value;
+
+    valid = count != 0 && tensor->count == count && tensor->offset % MODEL_ALIGNMENT == 0 &&
+            tensor->offset >= end && tensor->offset <= size &&
+            count <= (size - tensor->offset) / dtype_size(header->dtype);
+    if (!valid) fprintf(stderr, "tensor %llu of the model is corrupted\n", t);
+    else
+      end = tensor->offset + count * dtype_size(header->dtype);
+  }
+
+  u32 required = full ? (1u << TENSOR_KINDS) - 1 : (1u << TENSOR_WEIGHTS) | (1u << TENSOR_BIAS);
+  for (u64 i = 0; i + 1 < nb_layers && valid; i++) {
+    valid = (found[i] & required) == required;
+    if (!valid) fprintf(stderr, "layer %llu of the model is incomplete\n", i);
+  }
+
+  if (valid && header->state_offset) {
+    u64 offset = header->state_offset;
+    valid = offset % MODEL_ALIGNMENT == 0 && offset >= end && offset <= size &&
+            sizeof(ModelState) <= size - offset;
+    if (!valid) fprintf(stderr, "the training state of the model is corrupted\n");
+  }
+
+  free(found);
+  return valid;
+}
+
+/*  Sequential reads of what follows the header of a model file, a block at a time */
+typedef struct {
+  FILE* fp;
+  int compressed;
+  u64 element_size;
+  u64 offset;// in the uncompressed file
+  u64 size;  // bytes of the current block
+  u64 used;  // bytes of the current block already read
+  u8* block;
+  u8* shuffled;
+  u8* compressed_block;
+  int failed;
+} ModelReader;
+
+static void init_reader(ModelReader* reader, FILE* fp, const ModelHeader* header) {
+  memset(reader, 0, sizeof(ModelReader));
+  reader->fp = fp;
+  reader->compressed = header->compression == MODEL_ZLIB;
+  reader->element_size = dtype_size(header->dtype);
+  reader->offset = sizeof(ModelHeader);
+  reader->block = malloc(MODEL_CHUNK);
+  if (reader->compressed) {
+    reader->shuffled = malloc(MODEL_CHUNK);
+    reader->compressed_block = malloc(compressBound(MODEL_CHUNK));
+  }
+}
+
+static void free_reader(ModelReader* reader) {
+  if (reader->fp) fclose(reader->fp);
+  free(reader->block);
+  free(reader->shuffled);
+  free(reader->compressed_block);
+  memset(reader, 0, sizeof(ModelReader));
+}
+
+static void load_block(ModelReader* reader) {
+  reader->used = 0;
+  reader->size = 0;
+
+  if (!reader->compressed) {
+    reader->size = fread(reader->block, 1, MODEL_CHUNK, reader->fp);
+    reader->failed = reader->size == 0;
+    return;
+  }
+
+  u32 sizes[2];
+  uLongf size = MODEL_CHUNK;
+  reader->failed = fread(sizes, sizeof(sizes), 1, reader->fp) != 1 || sizes[1] == 0 ||
+                   sizes[1] > MODEL_CHUNK || sizes[0] > compressBound(MODEL_CHUNK) ||
+                   fread(reader->compressed_block, 1, sizes[0], reader->fp) != sizes[0] ||
+                   uncompress(reader->shuffled, &size, reader->compressed_block, sizes[0]) !=
+                           Z_OK ||
+                   size != sizes[1];
+  if (reader->failed) return;
+
+  unshuffle_bytes(reader->shuffled, size, reader->element_size, reader->block);
+  reader->size = size;
+}
+
+/*  Bytes left in the current block, the next one when it is exhausted. NULL past the end
+    of the file, or if it is corrupted */
+static const u8* next_read_bytes(ModelReader* reader, u64* available) {
+  if (reader->used == reader->size && !reader->failed) load_block(reader);
+  if (reader->failed) return NULL;
+  *available = reader->size - reader->used;
+  return reader->block + reader->used;
+}
+
+/*  Reads size bytes in data, or skips them if data is NULL */
+static void read_bytes(ModelReader* reader, void* data, u64 size) {
+  while (size) {
+    u64 available;
+    const u8* src = next_read_bytes(reader, &available);
+    if (!src) return;
+
+    u64 length = size < available ? size : available;
+    if (data) {
+      memcpy(data, src, length);
+      data = (u8*) data + length;
     }
 
-    //
-    sprintf(sbuf, "%s/%d%s", path, i, "delta_neurons.dat");
-    FILE* delta_neurons = fopen(sbuf, "r");
-    for (u64 j = 0; j < size; j++) {
-      int sc = fscanf(delta_neurons, "%lf\n", &value);
-      // printf("id value : %lld %lf\n", j, value);
-      layers[i]->delta_neurons[j] = value;
+    reader->used += length;
+    reader->offset += length;
+    size -= length;
+  }
+}
+
+static void skip_to(ModelReader* reader, u64 offset) {
+  read_bytes(reader, NULL, offset - reader->offset);
+}
+
+/*  Decodes the values directly from the blocks, see write_tensor */
+static void read_tensor(ModelReader* reader, f64* values, u64 count, ModelDtype dtype) {
+  while (count) {
+    u64 available;
+    const u8* src = next_read_bytes(reader, &available);
+    if (!src) return;
+
+    u64 length = available / reader->element_size;
+    if (length == 0) {
+      reader->failed = 1;
+      return;
     }
+    if (length > count) length = count;
+    decode_tensor(src, length, dtype, values);
+
+    reader->used += length * reader->element_size;
+    reader->offset += length * reader->element_size;
+    values += length;
+    count -= length;
+  }
+}
+
+/*  Opens a model file of the storage directory and reads its header and tables (the head),
+    NULL if it can not. The rest of the file is then read in order through the reader */
+static u8* open_model(Context* context, const char* file_name, ModelReader* reader, int full) {
+  char path[1024];
+  model_path(context, file_name, path, sizeof(path));
+  memset(reader, 0, sizeof(ModelReader));
+
+  FILE* fp = fopen(path, "rb");
+  if (!fp) {
+    fprintf(stderr, "could not open the model %s\n", path);
+    return NULL;
+  }
+
+  ModelHeader header;
+  u64 tables = 0;
+  if (fread(&header, sizeof(ModelHeader), 1, fp) != 1) fprintf(stderr, "not a model file\n");
+  else
+    tables = check_header(&header, context, full);
+
+  if (!tables) {
+    fclose(fp);
+    return NULL;
+  }
+
+  u8* head = malloc(tables);
+  memcpy(head, &header, sizeof(ModelHeader));
+  init_reader(reader, fp, &header);
+  read_bytes(reader, head + sizeof(ModelHeader), tables - sizeof(ModelHeader));
+
+  if (reader->failed) {
+    fprintf(stderr, "the model file is truncated\n");
+    free_reader(reader);
+    free(head);
+    return NULL;
+  }
+
+  return head;
+}
+
+/*  Reads the tensors of an opened model in the order of the file, and copies (and widens)
+    the first kinds ones in their layers */
+static void read_tensors(ModelReader* reader, const u8* head, Layer** layers, Context* context,
+                         u64 kinds) {
+  const ModelHeader* header = (const ModelHeader*) head;
+  const ModelTensor* tensors =
+          (const ModelTensor*) (head + sizeof(ModelHeader) + header->nb_layers * sizeof(ModelLayer));
+
+  for (u64 t = 0; t < header->nb_tensors; t++) {
+    if (tensors[t].kind >= kinds) continue;
+
+    u64 count;
+    f64* values = layer_tensor(layers[tensors[t].layer], next_layer_size(context, tensors[t].layer),
+                               tensors[t].kind, &count);
+    skip_to(reader, tensors[t].offset);
+    read_tensor(reader, values, count, header->dtype);
+  }
+}
+
+/*  Reads the training state of an opened model, after its tensors.
+    The state is left as is if the model does not store it */
+static void read_state(ModelReader* reader, const u8* head, TrainingState* state) {
+  const ModelHeader* header = (const ModelHeader*) head;
+  if (!header->state_offset || reader->failed) return;
 
+  ModelState stored_state;
+  skip_to(reader, header->state_offset);
+  read_bytes(reader, &stored_state, sizeof(ModelState));
 
-    fclose(bias);
-    fclose(delta_bias);
+  u64 room = header->file_size - header->state_offset - sizeof(ModelState);
+  if (reader->failed || stored_state.patterns > room / sizeof(u64)) {
+    reader->failed = 1;
+    return;
+  }
+
+  state->epoch = stored_state.epoch;
+  state->rng = stored_state.rng;
+  state->size = stored_state.patterns;
+  state->permutation = malloc(state->size * sizeof(u64));
+  read_bytes(reader, state->permutation, state->size * sizeof(u64));
+}
+
+/*  Reads the end of an opened model, which must end the file.
+    Returns 1 if the whole file could be read */
+static int finish_model(ModelReader* reader, const u8* head) {
+  skip_to(reader, ((const ModelHeader*) head)->file_size);
+  int complete = !reader->failed && reader->used == reader->size && fgetc(reader->fp) == EOF;
+  if (!complete) fprintf(stderr, "the model file is truncated or corrupted\n");
+  return complete;
+}
+
+/*  Loads a trained NN from its binary file, in order to test it or to resume its training.
+    The file is read in a single pass, each tensor is decoded in its layer */
+Layer** load_neural_network(Context* context, TrainingState* state) {
+  ModelReader reader;
+  u8* head = open_model(context, MODEL_FILE, &reader, 1);
+  if (!head) return NULL;
+
+  Layer** layers = init_neural_network_from_context(context);
+  TrainingState stored_state;
+  init_training_state(&stored_state);
+
+  int loaded = check_tables(head, layers, context, 1);
+  if (loaded) {
+    read_tensors(&reader, head, layers, context, TENSOR_KINDS);
+    read_state(&reader, head, &stored_state);
+    loaded = finish_model(&reader, head);
+  }
+  free_reader(&reader);
+  free(head);
+
+  if (!loaded) {
+    fprintf(stderr, "could not load the model %s\n", MODEL_FILE);
+    free_neural_network(layers, context->nn_size);
+    free_training_state(&stored_state);
+    return NULL;
+  }
+
+  if (state) *state = stored_state;
+  else
+    free_training_state(&stored_state);
 
-    fclose(weight);
-    fclose(delta_weight);
+  return layers;
+}
 
-    fclose(neurons);
-    fclose(delta_neurons);
+/*  A new training, its generator is seeded by rand() */
+void init_training_state(TrainingState* state) {
+  state->epoch = 0;
+  state->rng = ((u64) rand() << 32) ^ (u64) rand();
+  state->size = 0;
+  state->permutation = NULL;
+}
+
+void free_training_state(TrainingState* state) {
+  free(state->permutation);
+  state->permutation = NULL;
+  state->size = 0;
+}
+
+/*  Loads the weights and bias of a model or of an export of any dtype, widened to f64.
+    Only the arrays used by the forward pass are allocated */
+Layer** load_inference_network(Context* context, const char* file_name) {
+  ModelReader reader;
+  u8* head = open_model(context, file_name, &reader, 0);
+  if (!head) return NULL;
+
+  Layer** layers = init_inference_network_from_context(context);
+
+  int loaded = check_tables(head, layers, context, 0);
+  if (loaded) {
+    for (u64 i = 0; i < (u64) context->nn_size - 1; i++) {
+      u64 next_size = next_layer_size(context, i);
+      layers[i]->weights =
+              aligned_alloc(64, layer_weights_size(layers[i], next_size) * sizeof(f64));
+      layers[i]->bias = aligned_alloc(64, layer_bias_size(layers[i], next_size) * sizeof(f64));
+    }
+
+    read_tensors(&reader, head, layers, context, TENSOR_BIAS + 1);
+    loaded = finish_model(&reader, head);
   }
+  free_reader(&reader);
+  free(head);
 
+  if (!loaded) {
+    fprintf(stderr, "could not load the model %s\n", file_name);
+    free_neural_network(layers, context->nn_size);
+    return NULL;
+  }
 
   return layers;
 }
+
+/*  Maps a trained NN for inference, without reading nor copying its weights :
+    pages are loaded on first use and shared with the other processes mapping the file.
+    Works on model files stored with output.compression = 0 and on f64 exports */
+int map_neural_network(Context* context, const char* file_name, MappedModel* model) {
+  char path[1024];
+  model_path(context, file_name, path, sizeof(path));
+  memset(model, 0, sizeof(MappedModel));
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) || st.st_size == 0) {
+    fprintf(stderr, "could not open the model %s\n", path);
+    if (fd >= 0) close(fd);
+    return 0;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "could not map the model %s\n", path);
+    return 0;
+  }
+
+  Layer** layers = init_inference_network_from_context(context);
+  const ModelHeader* header = (const ModelHeader*) data;
+
+  int mapped = (u64) st.st_size >= sizeof(ModelHeader) && check_header(header, context, 0);
+  if (mapped && (header->dtype != MODEL_F64 || header->compression != MODEL_RAW)) {
+    fprintf(stderr, "only uncompressed f64 models can be mapped : a model stored with "
+                    "output.compression = 0, or an f64 export\n");
+    mapped = 0;
+  }
+  if (mapped && header->file_size != (u64) st.st_size) {
+    fprintf(stderr, "the model file is truncated\n");
+    mapped = 0;
+  }
+  if (!mapped || !check_tables(data, layers, context, 0)) {
+    fprintf(stderr, "could not map the model %s\n", path);
+    free_inference_network(layers, context->nn_size);
+    munmap(data, st.st_size);
+    return 0;
+  }
+
+  const ModelTensor* tensors = (const ModelTensor*) ((const u8*) data + sizeof(ModelHeader) +
+                                                     header->nb_layers * sizeof(ModelLayer));
+
+  // the tensors are aligned in the file, and so in the page aligned mapping
+  for (u64 t = 0; t < header->nb_tensors; t++) {
+    f64* values = (f64*) ((u8*) data + tensors[t].offset);
+    if (tensors[t].kind == TENSOR_WEIGHTS) layers[tensors[t].layer]->weights = values;
+    if (tensors[t].kind == TENSOR_BIAS) layers[tensors[t].layer]->bias = values;
+  }
+
+  model->data = data;
+  model->size = st.st_size;
+  model->layers = layers;
+  model->nb_layers = context->nn_size;
+
+  return 1;
+}
+
+void unmap_neural_network(MappedModel* model) {
+  if (model->layers) free_inference_network(model->layers, model->nb_layers);
+  if (model->data) munmap((void*) model->data, model->size);
+  memset(model, 0, sizeof(MappedModel));
+}
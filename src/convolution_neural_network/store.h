@@ -2,6 +2,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 
@@ -9,5 +10,125 @@
 #include "context.h"
 #include "neural_network.h"
 
-void store_neural_network(Context* context, Layer** layers);
-Layer** load_neural_network(Context* context);
+// Binary model file, written in storage_dir/MODEL_FILE :
+//   - a ModelHeader
+//   - the layer table, one ModelLayer per layer
+//   - the tensor table, one ModelTensor per stored array
+//   - the raw tensors, each starting on a MODEL_ALIGNMENT boundary
+//   - optionally, the state of the training (ModelState and the order of the patterns)
+// Values are stored in the native byte order, as they are in memory, so that a round trip
+// is exact. Every layer but the last stores its weights, bias, deltas and neurons.
+// Exports for inference (EXPORT_FILE) only store the weights and bias, in any dtype
+//
+// The model file is compressed when output.compression is set : the ModelHeader is kept as
+// is, and the rest of the file is cut in blocks of MODEL_CHUNK bytes, each stored as its
+// compressed size (u32), its size (u32) and its zlib stream. The bytes of a block are shuffled
+// by planes before being compressed, the first byte of every value then the second and so on :
+// the signs and exponents of the weights are alike, their mantissas are noise.
+// Files are written and read one block at a time, the offsets of the tables are those of the
+// uncompressed file. Exports are never compressed so that they can be mapped
+//
+// Only a raw file can be mapped : with the default output.compression = 1, MODEL_FILE must be
+// loaded, or stored again with output.compression = 0 to be mapped. EXPORT_FILE always can.
+// Files of an older MODEL_VERSION are rejected with their version, they are not converted
+
+#define MODEL_FILE "model.bin"
+#define EXPORT_FILE "inference.bin"
+#define MODEL_MAGIC "PPNMODEL"
+#define MODEL_VERSION 3
+#define MODEL_ALIGNMENT 64
+#define MODEL_CHUNK (1 << 20)
+
+// f16 is IEEE half precision, bf16 the upper half of a f32. Both are rounded to nearest even
+typedef enum { MODEL_F64 = 0, MODEL_F32 = 1, MODEL_F16 = 2, MODEL_BF16 = 3 } ModelDtype;
+
+typedef enum { MODEL_RAW = 0, MODEL_ZLIB = 1 } ModelCompression;
+
+typedef enum {
+  TENSOR_WEIGHTS = 0,
+  TENSOR_BIAS = 1,
+  TENSOR_DELTA_WEIGHTS = 2,
+  TENSOR_DELTA_BIAS = 3,
+  TENSOR_NEURONS = 4,
+  TENSOR_DELTA_NEURONS = 5,
+  TENSOR_KINDS = 6,
+} TensorKind;
+
+typedef struct {
+  char magic[8];
+  u32 version;
+  u32 dtype;
+  u32 nb_layers;
+  u32 nb_tensors;
+  u64 file_size;   // uncompressed
+  u64 state_offset;// 0 when the training state is not stored
+  u32 compression;
+  u32 reserved;
+} ModelHeader;
+
+// Topology of a layer, the convolution geometry is 0 for dense layers
+typedef struct {
+  u32 type;
+  u32 reserved;
+  u64 size;
+  u64 next_size;
+
+  u64 channels;
+  u64 height;
+  u64 width;
+  u64 filters;
+  u64 kernel;
+  u64 stride;
+} ModelLayer;
+
+typedef struct {
+  u32 layer;
+  u32 kind;
+  u64 offset;// from the start of the file
+  u64 count; // number of values
+} ModelTensor;
+
+// Followed by the permutation, patterns u64
+typedef struct {
+  u64 epoch;
+  u64 rng;
+  u64 patterns;
+} ModelState;
+
+// Progress of a training, stored with the checkpoints so that it can be resumed.
+// The momentum is already part of the layers (delta_weights and delta_bias),
+// the learning rate is constant
+typedef struct {
+  u64 epoch;       // completed epochs
+  u64 rng;         // state of the generator of the shuffles, see next_random
+  u64 size;        // patterns of the training dataset
+  u64* permutation;// order of the patterns during the last epoch, NULL before the first one
+} TrainingState;
+
+// Model file mapped read-only for inference, its layers point to the weights and bias
+// of the mapping. Processes mapping the same file share its pages
+typedef struct {
+  const u8* data;
+  u64 size;
+  Layer** layers;
+  u64 nb_layers;
+} MappedModel;
+
+// Returns 1 on success, 0 if the file could not be written.
+// The training state is stored along with the network, unless state is NULL
+int store_neural_network(Context* context, Layer** layers, const TrainingState* state);
+int export_neural_network(Context* context, Layer** layers, ModelDtype dtype);
+
+// Returns NULL if the file is missing, corrupted or does not match the topology of the context.
+// When state is not NULL, it is filled with the stored training state, or a new one
+Layer** load_neural_network(Context* context, TrainingState* state);
+// Weights and bias of MODEL_FILE or EXPORT_FILE widened to f64, for the forward pass only
+Layer** load_inference_network(Context* context, const char* file_name);
+// Same checks as load_inference_network, for uncompressed f64 files : MODEL_FILE stored with
+// output.compression = 0, or an f64 EXPORT_FILE. Returns 1 on success.
+// The layers can only run forward : writing their weights is a segmentation fault
+int map_neural_network(Context* context, const char* file_name, MappedModel* model);
+void unmap_neural_network(MappedModel* model);
+
+void init_training_state(TrainingState* state);
+void free_training_state(TrainingState* state);
@@ -1,66 +1,188 @@
 #include "training.h"
 
+/*  Computes the inputs of every image of the dataset.
+    Runs of consecutive images of the same size are processed FILTER_BATCH at a time when the
+    pipeline supports it, the others one by one through image_ptr and buffer_ptr */
+static void preprocess_dataset(const Pipeline* pipeline, Dataset* dataset, u8* image_ptr,
+                               u8* buffer_ptr) {
+  int batch = pipeline->batch && pipeline_supports_batch(pipeline);
+  u64 i = 0;
+
+  while (i < dataset->size) {
+    mri_image* first = &dataset->images[i];
+    const u8* pixels[FILTER_BATCH];
+    u8* inputs[FILTER_BATCH];
+    u64 count = 0;
+
+    while (batch && count < FILTER_BATCH && i + count < dataset->size &&
+           dataset->images[i + count].width == first->width &&
+           dataset->images[i + count].height == first->height) {
+      pixels[count] = dataset->images[i + count].pixels;
+      count++;
+    }
 
-int train(Context* context, Dataset* train_dataset, Dataset* test_dataset, Layer** neural_network,
-          FILE* fp_train, FILE* fp_test)// TODO cette ligne doit etre suprimee
-{
+    if (count > 1) {
+      apply_pipeline_batch(pipeline, pixels, count, first->width, first->height, inputs);
+      for (u64 b = 0; b < count; b++) { dataset->images[i + b].inputs = inputs[b]; }
+      i += count;
+      continue;
+    }
 
-  printf(" epoch; precision; recall; accuracy; f1; falsePositiveRate \n");
-  fprintf(fp_test, " epoch; precision; recall; accuracy; f1; falsePositiveRate \n");
-  fprintf(fp_train, " epoch; precision; recall; accuracy; f1; falsePositiveRate \n");
+    memcpy(image_ptr, first->pixels, sizeof(u8) * first->width * first->height);
+    first->inputs = apply_pipeline(pipeline, image_ptr, buffer_ptr, first->width, first->height);
+    i++;
+  }
+}
 
-  Score score;
 
-  u64 nn_size = context->nn_size;
-  u64 input_size = neural_network[0]->size;
-  u64 output_size = neural_network[nn_size - 1]->size;
+/*  The order of a resumed training must be a permutation of the training dataset */
+static int check_permutation(const TrainingState* state, u64 size) {
+  if (state->size != size) return 0;
 
-  f64 expected[output_size];
-  u64* random_pattern = malloc(train_dataset->size * sizeof(u64));
+  u8* seen = calloc(size, sizeof(u8));
+  int valid = 1;
+  for (u64 i = 0; i < size && valid; i++) {
+    u64 p = state->permutation[i];
+    valid = p < size && !seen[p];
+    if (valid) seen[p] = 1;
+  }
+  free(seen);
 
+  return valid;
+}
+
+/*  The preprocessed images of a dataset, as a source of samples */
+typedef struct {
+  Dataset* dataset;
+  const u64* order;
+  u64 size;
+  u64 position;
+} DatasetSource;
+
+static void dataset_start_epoch(void* data, const u64* order, u64 size) {
+  DatasetSource* source = data;
+  source->order = order;
+  source->size = size;
+  source->position = 0;
+}
+
+static int dataset_next_sample(void* data, Layer* input_layer) {
+  DatasetSource* source = data;
+  if (source->position >= source->size) return -1;
+
+  u64 p = source->order ? source->order[source->position] : source->position;
+  source->position++;
+
+  mri_image* image = &source->dataset->images[p];
+  fill_input(input_layer, input_layer->size, image->inputs);
+  return image->value;
+}
+
+int train(Context* context, Dataset* train_dataset, Dataset* test_dataset, Layer** neural_network,
+          TrainingState* state, FILE* fp_train, FILE* fp_test) {
+  u64 input_size = neural_network[0]->size;
 
   u8* image_ptr = NULL;
   u8* buffer_ptr = NULL;
 
-  image_ptr = malloc(IMAGE_SIZE * sizeof(unsigned char));
-  buffer_ptr = malloc(IMAGE_SIZE * sizeof(unsigned char));
-
+  // scratch buffers for the largest image, a filter bank can make the feature maps larger
+  // than the image itself
+  size_t scratch_size = 0;
+  Dataset* datasets[2] = {train_dataset, test_dataset};
+  for (int d = 0; d < 2; d++) {
+    for (u64 i = 0; i < datasets[d]->size; i++) {
+      mri_image* image = &datasets[d]->images[i];
+      FeatureShape image_shape = {image->width, image->height, 1};
+      FeatureShape features = pipeline_output_shape(&context->pipeline, image_shape);
+
+      if (check_pipeline(&context->pipeline, image_shape)) {
+        fprintf(stderr, "image %llu is %zux%zu, too small for image.filters\n", i, image->width,
+                image->height);
+        return 0;
+      }
+
+      if (features.width * features.height * features.channels != input_size) {
+        fprintf(stderr, "image %llu is %zux%zu, its %zu features do not match the %llu inputs\n",
+                i, image->width, image->height,
+                features.width * features.height * features.channels, input_size);
+        return 0;
+      }
+
+      size_t size = pipeline_buffer_size(&context->pipeline, image_shape);
+      if (size > scratch_size) scratch_size = size;
+    }
+  }
 
+  // a dataset wide crop is centered on the brains of the training images
   for (u64 i = 0; i < train_dataset->size; i++) {
+    mri_image* image = &train_dataset->images[i];
+    pipeline_fit_crop(&context->pipeline, image->pixels, image->width, image->height);
+  }
+
+  image_ptr = malloc(scratch_size * sizeof(unsigned char));
+  buffer_ptr = malloc(scratch_size * sizeof(unsigned char));
+
+
+  preprocess_dataset(&context->pipeline, train_dataset, image_ptr, buffer_ptr);
+  preprocess_dataset(&context->pipeline, test_dataset, image_ptr, buffer_ptr);
+
+  free(image_ptr);
+  free(buffer_ptr);
+
+  DatasetSource train_data = {train_dataset, NULL, 0, 0};
+  DatasetSource test_data = {test_dataset, NULL, 0, 0};
+  SampleSource train_source = {&train_data, train_dataset->size, dataset_start_epoch,
+                               dataset_next_sample};
+  SampleSource test_source = {&test_data, test_dataset->size, dataset_start_epoch,
+                              dataset_next_sample};
 
-    memcpy(image_ptr, train_dataset->images[i].pixels,
-           sizeof(u8) * train_dataset->images[i].width * train_dataset->images[i].height);
+  return train_samples(context, &train_source, &test_source, neural_network, state, fp_train,
+                       fp_test);
+}
+
+int train_samples(Context* context, SampleSource* train_source, SampleSource* test_source,
+                  Layer** neural_network, TrainingState* state, FILE* fp_train, FILE* fp_test) {
 
-    train_dataset->images[i].inputs = apply_convolution_filters(
-            image_ptr, buffer_ptr, train_dataset->images[i].width, train_dataset->images[i].height);
+  printf(" epoch; precision; recall; accuracy; f1; falsePositiveRate \n");
+  // a resumed training appends to the results of the previous run, which have their header
+  if (state->epoch == 0) {
+    fprintf(fp_test, " epoch; precision; recall; accuracy; f1; falsePositiveRate \n");
+    fprintf(fp_train, " epoch; precision; recall; accuracy; f1; falsePositiveRate \n");
   }
 
-  for (u64 i = 0; i < test_dataset->size; i++) {
+  Score score;
+
+  u64 nn_size = context->nn_size;
+  u64 output_size = neural_network[nn_size - 1]->size;
 
-    memcpy(image_ptr, test_dataset->images[i].pixels,
-           sizeof(u8) * test_dataset->images[i].width * test_dataset->images[i].height);
+  f64 expected[output_size];
+  int label;
 
-    test_dataset->images[i].inputs = apply_convolution_filters(
-            image_ptr, buffer_ptr, test_dataset->images[i].width, test_dataset->images[i].height);
+  if (state->permutation && !check_permutation(state, train_source->size)) {
+    fprintf(stderr, "the stored order of the patterns does not match the %llu training images, "
+                    "the resumed training starts from a new one\n",
+            train_source->size);
+    free_training_state(state);
+  }
+  if (!state->permutation) {
+    state->size = train_source->size;
+    state->permutation = malloc(state->size * sizeof(u64));
+    for (u64 i = 0; i < state->size; i++) { state->permutation[i] = i; }
   }
 
-  free(image_ptr);
-  free(buffer_ptr);
 
+  Checkpointer checkpointer;
+  if (context->checkpoint_every > 0) init_checkpointer(&checkpointer, context);
 
-  for (u64 epoch = 0; epoch < context->max_epoch; epoch++) {
+  for (u64 epoch = state->epoch; epoch < (u64) context->max_epoch; epoch++) {
     init_score(&score);
-    shuffle(train_dataset->size, random_pattern);
-
+    shuffle(state->size, state->permutation, &state->rng);
 
-    for (u64 np = 0; np < train_dataset->size; np++) {
-      u64 p = random_pattern[np];
-      // display_ascii_image( train_dataset->images[p].inputs, train_dataset->images[p].width,
-      // train_dataset->images[p].height );
 
-      fill_input(neural_network[0], input_size, train_dataset->images[p].inputs);
-      expected[0] = train_dataset->images[p].value;
-      forward_compute(nn_size, neural_network, context);
+    train_source->start_epoch(train_source->data, state->permutation, state->size);
+    while ((label = train_source->next_sample(train_source->data, neural_network[0])) >= 0) {
+      expected[0] = label;
+      forward_compute(nn_size, neural_network);
       update_score(neural_network[nn_size - 1], expected, &score);
       backward_compute(neural_network, expected, context);
     }
@@ -74,19 +196,23 @@ int train(Context* context, Dataset* train_dataset, Dataset* test_dataset, Layer
 
     // TEST
     init_score(&score);
-    for (u64 p = 0; p < test_dataset->size; p++) {
-
-      fill_input(neural_network[0], input_size, test_dataset->images[p].inputs);
-      expected[0] = test_dataset->images[p].value;
-      forward_compute(nn_size, neural_network, context);
+    test_source->start_epoch(test_source->data, NULL, test_source->size);
+    while ((label = test_source->next_sample(test_source->data, neural_network[0])) >= 0) {
+      expected[0] = label;
+      forward_compute(nn_size, neural_network);
       update_score(neural_network[nn_size - 1], expected, &score);
     }
     process_score(&score);
     fprintf(fp_test, "%llu; %lf; %lf; %lf; %lf; %lf\n", epoch, score.precision, score.recall,
             score.accuracy, score.f1, score.specificity);
+
+    state->epoch = epoch + 1;
+    if (context->checkpoint_every > 0 && state->epoch % context->checkpoint_every == 0) {
+      checkpoint(&checkpointer, neural_network, state);
+    }
   }
 
-  free(random_pattern);
+  if (context->checkpoint_every > 0) free_checkpointer(&checkpointer);
 
   return 1;
 }
@@ -9,12 +9,17 @@
 #include "../../src/type.h"
 
 #include "convolution_layer.h"
+#include "pipeline.h"
 #include "neural_network.h"
 
+#include "checkpoint.h"
 #include "context.h"
 #include "dataset_manager.h"
 #include "evaluation.h"
+#include "sample_source.h"
 
 
+// Preprocesses both datasets with the pipeline of the context, then trains the network on them
+// with train_samples. Returns 0 on error
 int train(Context* context, Dataset* train_dataset, Dataset* test_dataset, Layer** neural_network,
-          FILE* fp_train, FILE* fp_test);
+          TrainingState* state, FILE* fp_train, FILE* fp_test);
@@ -40,10 +40,11 @@ int load_dataset(char** dirs, int dir_num, Dataset* dataset, int max_per_folder)
         snprintf(image_path, sizeof(image_path), "%s/%s", dirs[i], dir->d_name);
 
 
-        dataset->images[total_counter].pixels = malloc(IMAGE_SIZE * sizeof(unsigned char));
-        load_image(image_path, &dataset->images[total_counter].pixels,
-                   &dataset->images[total_counter].original_width,
-                   &dataset->images[total_counter].original_height);
+        if (load_image(image_path, &dataset->images[total_counter].pixels,
+                       &dataset->images[total_counter].original_width,
+                       &dataset->images[total_counter].original_height)) {
+          continue;
+        }
         dataset->images[total_counter].value = i;
         dataset->images[total_counter].filename = "name";
         dataset->images[total_counter].width = dataset->images[total_counter].original_width;
@@ -3,12 +3,12 @@
 
 int store_image_ppm(char* filename, unsigned char* tab, size_t dimx, size_t dimy) {
   // const int dimx = 800, dimy = 800;
-  int i, j;
+  size_t i, j;
   FILE* fp = fopen(filename, "wb"); /* b - binary mode */
   (void) fprintf(fp, "P6\n%d %d\n255\n", (int) dimx, (int) dimy);
   for (j = 0; j < dimy; ++j) {
     for (i = 0; i < dimx; ++i) {
-      int index = j * dimx + i;
+      size_t index = j * dimx + i;
       static unsigned char color[3];
       color[0] = tab[index]; /* red */
       color[1] = tab[index]; /* green */
@@ -29,6 +29,9 @@ int load_image(char* img, unsigned char** image, size_t* image_width, size_t* im
   // unsigned char *image = NULL;
   // size_t image_size, image_width, image_height;
 
+  // the image is allocated once its size is known
+  *image = NULL;
+
   png = fopen(img, "rb");
 
   if (png == NULL) {
@@ -70,20 +73,27 @@ int load_image(char* img, unsigned char** image, size_t* image_width, size_t* im
 
   // size_t image_size, image_width, image_height;
 
-  int fmt = SPNG_FMT_PNG;
+  // The images are one byte per pixel : 16 bits, color or alpha images are rejected instead
+  // of being read with a wrong width
+  if (ihdr.color_type != SPNG_COLOR_TYPE_GRAYSCALE || ihdr.bit_depth > 8) {
+    printf("ERROR : %s is not an 8 bits grayscale image (color type %u, bit depth %u)\n", img,
+           ihdr.color_type, ihdr.bit_depth);
+    goto error;
+  }
 
-  if (ihdr.color_type == SPNG_COLOR_TYPE_INDEXED) fmt = SPNG_FMT_RGB8;
+  // Grayscale images of less than 8 bits are expanded to one byte per pixel
+  int fmt = SPNG_FMT_G8;
 
   ret = spng_decoded_image_size(ctx, fmt, image_size);
 
-  if (*image_size != IMAGE_SIZE) {
+  if (ret) goto error;
+
+  if (*image_size != (size_t) ihdr.width * ihdr.height) {
     printf("ERROR : wrong image size");
     goto error;
   }
 
-  if (ret) goto error;
-
-  // *image = malloc(*image_size * sizeof(unsigned char));
+  *image = malloc(*image_size * sizeof(unsigned char));
 
   if (*image == NULL) goto error;
 
@@ -95,7 +105,7 @@ int load_image(char* img, unsigned char** image, size_t* image_width, size_t* im
   }
 
   *image_height = ihdr.height;
-  *image_width = (*image_size) / (*image_height);
+  *image_width = ihdr.width;
 
   struct spng_row_info row_info = {0};
 
@@ -124,7 +134,8 @@ int load_image(char* img, unsigned char** image, size_t* image_width, size_t* im
 error:
   spng_ctx_free(ctx);
   free(*image);
-  fclose(png);
+  *image = NULL;
+  if (png) fclose(png);
   return -1;
 }
 
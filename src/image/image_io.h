@@ -14,6 +14,8 @@
 
 int store_image_ppm(char* filename, unsigned char* tab, size_t dimx, size_t dimy);
 
+// Decodes a grayscale png of any resolution and up to 8 bits per pixel, one byte per pixel.
+// *image is allocated by the function. Other formats (color, alpha, 16 bits) are rejected
 int load_image(char* img, unsigned char** image, size_t* image_width, size_t* image_height);
 
 
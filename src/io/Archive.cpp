@@ -0,0 +1,409 @@
+#include "Archive.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+  constexpr uint32_t zip_local_header = 0x04034b50;
+  constexpr uint32_t zip_central_header = 0x02014b50;
+  constexpr uint32_t zip_end_of_directory = 0x06054b50;
+  constexpr uint32_t zip64_end_locator = 0x07064b50;
+  constexpr uint32_t zip64_end_of_directory = 0x06064b50;
+  constexpr uint64_t tar_block = 512;
+
+  constexpr uint64_t zip_local_header_size = 30;
+
+  // deflate expands its input at most 1032 times, the sizes beyond are forged
+  constexpr uint64_t max_deflate_ratio = 1032;
+
+  // the buffers are sized from the headers before anything is read, an image is far smaller
+  constexpr uint64_t max_entry_size = uint64_t(1) << 32;
+
+  // The archive formats are little endian, the fields of their headers are not aligned
+  uint64_t read_le(const unsigned char* bytes, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) value = (value << 8) | bytes[i];
+    return value;
+  }
+
+  /**
+   * @brief Read size bytes at offset, retrying short reads
+   */
+  bool read_at(int fd, void* buffer, uint64_t size, uint64_t offset) {
+    auto* bytes = static_cast<unsigned char*>(buffer);
+    while (size > 0) {
+      ssize_t n = pread(fd, bytes, size, static_cast<off_t>(offset));
+      if (n <= 0) return false;
+      bytes += n;
+      offset += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Numeric field of a tar header, in octal or in base 256 for the large values
+   */
+  uint64_t tar_number(const unsigned char* field, size_t size) {
+    uint64_t value = 0;
+    if (field[0] & 0x80) {
+      value = field[0] & 0x7f;
+      for (size_t i = 1; i < size; i++) value = (value << 8) | field[i];
+      return value;
+    }
+
+    size_t i = 0;
+    while (i < size and (field[i] == ' ' or field[i] == '\0')) i++;
+    while (i < size and field[i] >= '0' and field[i] <= '7') value = value * 8 + (field[i++] - '0');
+    return value;
+  }
+
+  /**
+   * @brief Check the sizes of a zip entry against the archive before any buffer is sized from
+   * them : the compressed content must fit in the file after a local header, and the content
+   * must be what the compression method can produce from it
+   */
+  bool zip_sizes_are_valid(const Archive::Entry& entry, uint64_t file_size) {
+    if (entry.offset > file_size or file_size - entry.offset < zip_local_header_size or
+        entry.compressed_size > file_size - entry.offset - zip_local_header_size)
+      return false;
+
+    if (entry.size > max_entry_size) return false;
+
+    if (entry.method == Archive::Method::Stored) return entry.size == entry.compressed_size;
+    return entry.size <= entry.compressed_size * max_deflate_ratio;
+  }
+
+  std::string tar_string(const unsigned char* field, size_t size) {
+    const auto* chars = reinterpret_cast<const char*>(field);
+    return {chars, strnlen(chars, size)};
+  }
+
+  bool tar_checksum_is_valid(const unsigned char* header) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < tar_block; i++) sum += (i >= 148 and i < 156) ? ' ' : header[i];
+    return sum == tar_number(header + 148, 8);
+  }
+
+  /**
+   * @brief Apply the records of a pax extended header ("<length> <key>=<value>\n") which
+   * override the name and the size of the next entry
+   * @return False if a record is malformed
+   */
+  bool parse_pax_records(const std::vector<unsigned char>& records, std::string& name,
+                         std::optional<uint64_t>& size) {
+    size_t pos = 0;
+    while (pos < records.size()) {
+      size_t length = 0;
+      size_t i = pos;
+      while (i < records.size() and records[i] >= '0' and records[i] <= '9' and
+             length <= records.size())
+        length = length * 10 + (records[i++] - '0');
+      if (length == 0 or length > records.size() - pos) return false;
+
+      // the length counts its own digits, the space and the newline
+      size_t end = pos + length - 1;
+      if (i >= end or records[i] != ' ' or records[end] != '\n') return false;
+
+      std::string record(records.begin() + i + 1, records.begin() + end);
+      size_t equal = record.find('=');
+      if (equal != std::string::npos) {
+        std::string key = record.substr(0, equal);
+        if (key == "path") name = record.substr(equal + 1);
+        if (key == "size") size = std::strtoull(record.c_str() + equal + 1, nullptr, 10);
+      }
+      pos += length;
+    }
+    return true;
+  }
+
+}// namespace
+
+std::optional<Archive> Archive::open(const std::filesystem::path& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st {};
+  if (fd < 0 or fstat(fd, &st) != 0) {
+    spdlog::error("Archive: could not open {}", path.string());
+    if (fd >= 0) close(fd);
+    return std::nullopt;
+  }
+
+  Archive archive;
+  archive.path = path;
+  archive.file_size = static_cast<uint64_t>(st.st_size);
+
+  unsigned char magic[4] = {};
+  auto file_size = static_cast<uint64_t>(st.st_size);
+  read_at(fd, magic, std::min<uint64_t>(file_size, 4), 0);
+
+  std::optional<Archive> res;
+  if (read_le(magic, 4) == zip_local_header or read_le(magic, 4) == zip_end_of_directory) {
+    res = openZip(fd, file_size, std::move(archive));
+  } else if (magic[0] == 0x1f and magic[1] == 0x8b) {
+    spdlog::error("Archive: {} is a compressed tar, which can not be read in place. Use a zip "
+                  "or an uncompressed tar",
+                  path.string());
+  } else {
+    res = openTar(fd, file_size, std::move(archive));
+  }
+  close(fd);
+
+  if (res) spdlog::debug("Archive: indexed {} files in {}", res->entries.size(), path.string());
+
+  return res;
+}
+
+std::optional<Archive> Archive::openZip(int fd, uint64_t file_size, Archive archive) {
+  // The end of central directory record is followed by a comment of at most 64 KiB
+  uint64_t tail_size = std::min<uint64_t>(file_size, 22 + 0xffff);
+  std::vector<unsigned char> tail(tail_size);
+  if (not read_at(fd, tail.data(), tail_size, file_size - tail_size)) return std::nullopt;
+
+  int64_t end = -1;
+  for (int64_t i = (int64_t) tail_size - 22; i >= 0; i--) {
+    if (read_le(&tail[i], 4) == zip_end_of_directory) {
+      end = i;
+      break;
+    }
+  }
+  if (end < 0) {
+    spdlog::error("Archive: {} is not a valid zip archive", archive.path.string());
+    return std::nullopt;
+  }
+
+  uint64_t nb_entries = read_le(&tail[end + 10], 2);
+  uint64_t directory_size = read_le(&tail[end + 12], 4);
+  uint64_t directory_offset = read_le(&tail[end + 16], 4);
+
+  // Zip64 archives store the real values in another record, found through a locator
+  if (nb_entries == 0xffff or directory_size == 0xffffffff or directory_offset == 0xffffffff) {
+    unsigned char record[56];
+    if (end < 20 or read_le(&tail[end - 20], 4) != zip64_end_locator or
+        not read_at(fd, record, sizeof(record), read_le(&tail[end - 20 + 8], 8)) or
+        read_le(record, 4) != zip64_end_of_directory) {
+      spdlog::error("Archive: {} has a corrupted zip64 directory", archive.path.string());
+      return std::nullopt;
+    }
+    nb_entries = read_le(record + 32, 8);
+    directory_size = read_le(record + 40, 8);
+    directory_offset = read_le(record + 48, 8);
+  }
+
+  std::vector<unsigned char> directory(directory_size);
+  if (directory_offset > file_size or directory_size > file_size - directory_offset or
+      not read_at(fd, directory.data(), directory_size, directory_offset)) {
+    spdlog::error("Archive: {} has a corrupted zip directory", archive.path.string());
+    return std::nullopt;
+  }
+
+  // a central directory header takes at least 46 bytes
+  if (nb_entries > directory_size / 46) {
+    spdlog::error("Archive: {} has a corrupted zip directory", archive.path.string());
+    return std::nullopt;
+  }
+  archive.entries.reserve(nb_entries);
+  uint64_t pos = 0;
+  for (uint64_t e = 0; e < nb_entries; e++) {
+    if (pos + 46 > directory_size or read_le(&directory[pos], 4) != zip_central_header) {
+      spdlog::error("Archive: {} has a corrupted zip directory", archive.path.string());
+      return std::nullopt;
+    }
+    const unsigned char* header = &directory[pos];
+    uint64_t name_size = read_le(header + 28, 2);
+    uint64_t extra_size = read_le(header + 30, 2);
+    uint64_t comment_size = read_le(header + 32, 2);
+    if (pos + 46 + name_size + extra_size + comment_size > directory_size) {
+      spdlog::error("Archive: {} has a corrupted zip directory", archive.path.string());
+      return std::nullopt;
+    }
+    pos += 46 + name_size + extra_size + comment_size;
+
+    Entry entry;
+    entry.is_zip = true;
+    entry.name.assign(reinterpret_cast<const char*>(header + 46), name_size);
+    entry.crc = read_le(header + 16, 4);
+    entry.compressed_size = read_le(header + 20, 4);
+    entry.size = read_le(header + 24, 4);
+    entry.offset = read_le(header + 42, 4);
+
+    // The zip64 extra field holds, in this order, the values too large for their field
+    const unsigned char* extra = header + 46 + name_size;
+    for (uint64_t i = 0; i + 4 <= extra_size;) {
+      uint64_t id = read_le(extra + i, 2);
+      uint64_t size = read_le(extra + i + 2, 2);
+      const unsigned char* value = extra + i + 4;
+      const unsigned char* value_end = extra + std::min(extra_size, i + 4 + size);
+      if (id == 0x0001) {
+        for (uint64_t* field: {&entry.size, &entry.compressed_size, &entry.offset}) {
+          if (*field != 0xffffffff or value + 8 > value_end) continue;
+          *field = read_le(value, 8);
+          value += 8;
+        }
+      }
+      i += 4 + size;
+    }
+
+    if (entry.name.empty() or entry.name.back() == '/') continue;
+
+    uint64_t method = read_le(header + 10, 2);
+    if ((read_le(header + 8, 2) & 1) or (method != 0 and method != 8)) {
+      spdlog::warn("Archive: ignoring {}, encrypted or compressed with method {}", entry.name,
+                   method);
+      continue;
+    }
+    entry.method = method == 8 ? Method::Deflate : Method::Stored;
+
+    if (not zip_sizes_are_valid(entry, file_size)) {
+      spdlog::error("Archive: {} has corrupted sizes for {}", archive.path.string(), entry.name);
+      return std::nullopt;
+    }
+
+    archive.entries.emplace_back(std::move(entry));
+  }
+
+  return archive;
+}
+
+std::optional<Archive> Archive::openTar(int fd, uint64_t file_size, Archive archive) {
+  unsigned char header[tar_block];
+  uint64_t offset = 0;
+
+  // Set by the GNU long name and pax headers for the entry which follows them
+  std::string next_name;
+  std::optional<uint64_t> next_size;
+
+  while (offset < file_size) {
+    if (file_size - offset < tar_block or not read_at(fd, header, tar_block, offset)) {
+      spdlog::error("Archive: {} is truncated", archive.path.string());
+      return std::nullopt;
+    }
+    if (std::all_of(header, header + tar_block, [](unsigned char c) { return c == 0; })) break;
+
+    if (not tar_checksum_is_valid(header)) {
+      spdlog::error("Archive: {} {}", archive.path.string(),
+                    offset == 0 ? "is not a zip or tar archive" : "has a corrupted tar header");
+      return std::nullopt;
+    }
+
+    char type = static_cast<char>(header[156]);
+    uint64_t size = next_size.value_or(tar_number(header + 124, 12));
+    uint64_t data = offset + tar_block;
+    if (data > file_size or size > file_size - data) {
+      spdlog::error("Archive: {} is truncated", archive.path.string());
+      return std::nullopt;
+    }
+    offset = data + (size + tar_block - 1) / tar_block * tar_block;
+
+    if (type == 'L' or type == 'x') {
+      std::vector<unsigned char> content(size);
+      if (not read_at(fd, content.data(), size, data)) return std::nullopt;
+      if (type == 'L') {
+        next_name = tar_string(content.data(), content.size());
+      } else if (not parse_pax_records(content, next_name, next_size)) {
+        spdlog::error("Archive: {} has a corrupted pax header", archive.path.string());
+        return std::nullopt;
+      }
+      continue;
+    }
+
+    std::string name = next_name;
+    if (name.empty()) {
+      name = tar_string(header, 100);
+      std::string prefix = tar_string(header + 345, 155);
+      if (memcmp(header + 257, "ustar", 5) == 0 and not prefix.empty()) name = prefix + "/" + name;
+    }
+    next_name.clear();
+    next_size.reset();
+
+    // regular files only, the directories are implied by the paths
+    if (type != '0' and type != '\0' and type != '7') continue;
+
+    Entry entry;
+    entry.name = std::move(name);
+    entry.offset = data;
+    entry.compressed_size = size;
+    entry.size = size;
+    archive.entries.emplace_back(std::move(entry));
+  }
+
+  // the padding of the last file is missing
+  if (offset > file_size) {
+    spdlog::error("Archive: {} is truncated", archive.path.string());
+    return std::nullopt;
+  }
+
+  return archive;
+}
+
+Archive::Reader::Reader(const Archive& archive) : archive(archive) {
+  fd = ::open(archive.path.c_str(), O_RDONLY);
+  if (fd < 0) spdlog::error("Archive: could not open {}", archive.path.string());
+}
+
+Archive::Reader::~Reader() {
+  if (fd >= 0) close(fd);
+}
+
+bool Archive::Reader::read(size_t index, std::vector<unsigned char>& buffer) {
+  if (fd < 0 or index >= archive.entries.size()) return false;
+  const Entry& entry = archive.entries[index];
+
+  uint64_t data = entry.offset;
+  if (entry.is_zip) {
+    // The local header repeats the name, and may have another extra field
+    unsigned char header[30];
+    if (not read_at(fd, header, sizeof(header), entry.offset) or
+        read_le(header, 4) != zip_local_header)
+      return false;
+    data += sizeof(header) + read_le(header + 26, 2) + read_le(header + 28, 2);
+  }
+  if (data > archive.file_size or entry.compressed_size > archive.file_size - data) return false;
+
+  buffer.resize(entry.size);
+  if (entry.method == Method::Stored) {
+    if (entry.compressed_size != entry.size or not read_at(fd, buffer.data(), entry.size, data))
+      return false;
+  } else {
+    compressed.resize(entry.compressed_size);
+    if (not read_at(fd, compressed.data(), entry.compressed_size, data)) return false;
+
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) return false;
+
+    // Inflated in steps, the sizes of a z_stream are 32 bits
+    stream.next_in = compressed.data();
+    stream.next_out = buffer.data();
+    uint64_t in_left = entry.compressed_size, out_left = entry.size;
+    int status = Z_OK;
+    while (status == Z_OK) {
+      uInt in_step = static_cast<uInt>(std::min<uint64_t>(in_left, 1u << 30));
+      uInt out_step = static_cast<uInt>(std::min<uint64_t>(out_left, 1u << 30));
+      stream.avail_in = in_step;
+      stream.avail_out = out_step;
+      status = inflate(&stream, Z_NO_FLUSH);
+      in_left -= in_step - stream.avail_in;
+      out_left -= out_step - stream.avail_out;
+    }
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END or out_left != 0) return false;
+  }
+
+  if (entry.is_zip) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (uint64_t done = 0; done < entry.size;) {
+      auto step = static_cast<uInt>(std::min<uint64_t>(entry.size - done, 1u << 30));
+      crc = crc32(crc, buffer.data() + done, step);
+      done += step;
+    }
+    if (crc != entry.crc) return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Read-only index of a zip or uncompressed tar archive, so that its files can be read
+ * in place without extracting them
+ * The entries are indexed once when the archive is opened. Their content is then read, and
+ * decompressed if needed, in memory by Archive::Reader, one per thread
+ */
+class Archive {
+public:
+  enum class Method { Stored, Deflate };
+
+  /**
+   * @brief A regular file of the archive
+   */
+  struct Entry {
+    /**
+     * @brief The path of the file inside the archive
+     */
+    std::string name;
+
+    /**
+     * @brief Offset of the zip local header, or of the content for a tar
+     */
+    uint64_t offset = 0;
+
+    uint64_t compressed_size = 0;
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    Method method = Method::Stored;
+    bool is_zip = false;
+  };
+
+  /**
+   * @brief Reads the entries of an archive, a .zip (zip64 included) or an uncompressed .tar
+   * @param path The path to the archive
+   * @return An Archive object if the archive could be indexed, std::nullopt otherwise, or if the
+   * sizes of an entry do not fit in the archive
+   */
+  static std::optional<Archive> open(const std::filesystem::path& path);
+
+  /**
+   * @return The path to the archive
+   */
+  [[nodiscard]] const std::filesystem::path& getPath() const { return path; }
+
+  /**
+   * @return The regular files of the archive, in the order of the archive
+   */
+  [[nodiscard]] const std::vector<Entry>& getEntries() const { return entries; }
+
+  /**
+   * @brief Reads the entries of an archive through its own file handle, which makes it cheap to
+   * give one to each thread. The buffers are reused from one entry to the next
+   */
+  class Reader {
+  public:
+    explicit Reader(const Archive& archive);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /**
+     * @brief Read the decompressed content of an entry
+     * @param entry The index of the entry in getEntries()
+     * @param buffer Resized to the content of the entry
+     * @return False if the entry could not be read, or is corrupted
+     */
+    bool read(size_t entry, std::vector<unsigned char>& buffer);
+
+  private:
+    const Archive& archive;
+    int fd = -1;
+
+    /**
+     * @brief Compressed content of the last entry read
+     */
+    std::vector<unsigned char> compressed;
+  };
+
+private:
+  static std::optional<Archive> openZip(int fd, uint64_t file_size, Archive archive);
+  static std::optional<Archive> openTar(int fd, uint64_t file_size, Archive archive);
+
+  std::filesystem::path path;
+  uint64_t file_size = 0;
+  std::vector<Entry> entries;
+};
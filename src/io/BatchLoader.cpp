@@ -0,0 +1,158 @@
+#include "BatchLoader.hpp"
+#include <algorithm>
+
+namespace {
+
+  /**
+   * @brief Wait until a slot reaches a sequence number
+   * @return The time waited
+   */
+  std::chrono::nanoseconds wait_for_sequence(const std::atomic<uint64_t>& sequence,
+                                             uint64_t expected) {
+    uint64_t current = sequence.load(std::memory_order_acquire);
+    if (current == expected) return std::chrono::nanoseconds(0);
+
+    auto start = std::chrono::steady_clock::now();
+    while (current != expected) {
+      sequence.wait(current, std::memory_order_acquire);
+      current = sequence.load(std::memory_order_acquire);
+    }
+    return std::chrono::steady_clock::now() - start;
+  }
+
+  void set_sequence(std::atomic<uint64_t>& sequence, uint64_t value) {
+    sequence.store(value, std::memory_order_release);
+    sequence.notify_all();
+  }
+
+}// namespace
+
+BatchLoader::BatchLoader(LazyDataset& dataset, const Options& options, Preprocess preprocess)
+    : dataset(dataset), options(options), preprocess(std::move(preprocess)) {
+  this->options.batch_size = std::max<size_t>(options.batch_size, 1);
+  this->options.nb_threads = std::max<size_t>(options.nb_threads, 1);
+  this->options.capacity = std::max<size_t>(options.capacity, 2);
+  slots = std::make_unique<Slot[]>(this->options.capacity);
+
+  if (not this->preprocess) {
+    this->preprocess = [size = options.input_size](const Image& image, float* inputs) {
+      if ((size_t) image.getWidth() * image.getHeight() * image.getNChannels() != size)
+        return false;
+      image.toFloat(inputs);
+      return true;
+    };
+  }
+}
+
+BatchLoader::~BatchLoader() { stop(); }
+
+void BatchLoader::startEpoch(std::vector<size_t> new_order) {
+  stop();
+
+  order = std::move(new_order);
+  nb_batches = (order.size() + options.batch_size - 1) / options.batch_size;
+  for (size_t k = 0; k < options.capacity; k++) slots[k].sequence.store(k);
+
+  next_claim = 0;
+  next_read = 0;
+  holding = false;
+  stopping = false;
+  for (size_t t = 0; t < options.nb_threads; t++) producers.emplace_back([this] { produce(); });
+}
+
+const Batch* BatchLoader::next() {
+  while (true) {
+    release();
+    if (next_read >= nb_batches) return nullptr;
+
+    Slot& slot = slots[next_read % options.capacity];
+    auto waited = wait_for_sequence(slot.sequence, next_read + 1);
+    consumer_stall.fetch_add(waited.count(), std::memory_order_relaxed);
+    next_read++;
+    holding = true;
+
+    // a batch whose images all failed is skipped
+    if (slot.batch.size() > 0) return &slot.batch;
+  }
+}
+
+BatchLoader::Stats BatchLoader::getStats() const {
+  Stats stats;
+  stats.consumer_stall = std::chrono::nanoseconds(consumer_stall.load(std::memory_order_relaxed));
+  stats.producer_stall = std::chrono::nanoseconds(producer_stall.load(std::memory_order_relaxed));
+  stats.batches = batches.load(std::memory_order_relaxed);
+  stats.samples = samples.load(std::memory_order_relaxed);
+  stats.failures = failures.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void BatchLoader::release() {
+  if (not holding) return;
+
+  uint64_t previous = next_read - 1;
+  set_sequence(slots[previous % options.capacity].sequence, previous + options.capacity);
+  holding = false;
+}
+
+void BatchLoader::produce() {
+  while (true) {
+    uint64_t index = next_claim.fetch_add(1, std::memory_order_relaxed);
+    if (index >= nb_batches) return;
+
+    Slot& slot = slots[index % options.capacity];
+    auto waited = wait_for_sequence(slot.sequence, index);
+    producer_stall.fetch_add(waited.count(), std::memory_order_relaxed);
+
+    fill(slot.batch, index);
+    set_sequence(slot.sequence, index + 1);
+  }
+}
+
+void BatchLoader::fill(Batch& batch, uint64_t index) {
+  size_t begin = index * options.batch_size;
+  size_t end = std::min(begin + options.batch_size, order.size());
+
+  // the vectors of the slot are reused from one batch to the next
+  batch.inputs.resize((end - begin) * options.input_size);
+  batch.labels.clear();
+  batch.positions.clear();
+
+  for (size_t p = begin; p < end; p++) {
+    // a stopped epoch still publishes its claimed batches, empty
+    if (stopping.load(std::memory_order_relaxed)) break;
+
+    size_t i = order[p];
+    std::shared_ptr<const Image> image = dataset.get(i);
+    float* inputs = batch.inputs.data() + batch.size() * options.input_size;
+    if (not image or not preprocess(*image, inputs)) {
+      failures.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    batch.labels.push_back(dataset.getLabel(i));
+    batch.positions.push_back(i);
+  }
+
+  batch.inputs.resize(batch.size() * options.input_size);
+  samples.fetch_add(batch.size(), std::memory_order_relaxed);
+  batches.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BatchLoader::stop() {
+  if (producers.empty()) return;
+
+  // No batch is claimed past this point. The claimed ones are published, empty, as soon as
+  // their slot is free, which the loop below makes sure of
+  stopping = true;
+  uint64_t claimed = std::min(next_claim.exchange(nb_batches), nb_batches);
+
+  release();
+  for (; next_read < claimed; next_read++) {
+    Slot& slot = slots[next_read % options.capacity];
+    wait_for_sequence(slot.sequence, next_read + 1);
+    set_sequence(slot.sequence, next_read + options.capacity);
+  }
+
+  for (auto& producer: producers) producer.join();
+  producers.clear();
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include "LazyDataset.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A mini-batch of samples, ready to be fed to the network
+ */
+struct Batch {
+  /**
+   * @brief The inputs of the samples, input_size floats each, one sample after the other
+   */
+  std::vector<float> inputs;
+
+  /**
+   * @brief The label of each sample
+   */
+  std::vector<int> labels;
+
+  /**
+   * @brief The position of each sample in the dataset
+   */
+  std::vector<size_t> positions;
+
+  /**
+   * @return The number of samples, the images that failed to load or to be preprocessed are
+   * left out of their batch
+   */
+  [[nodiscard]] size_t size() const { return labels.size(); }
+};
+
+/**
+ * @brief Loads the batches of an epoch in the background, while the previous ones are consumed
+ * Producer threads each take the next batch of the epoch, load its images from a LazyDataset in
+ * the order of the epoch, preprocess them and publish the batch in a ring of a few slots. The
+ * consumer reads the batches in order. The ring is lock-free : each slot holds a sequence number
+ * telling whether it is free for a batch or holds it, which the threads wait on.
+ * A producer waits for a free slot when the consumer is behind (backpressure), the time the
+ * consumer waits for a batch is counted in the stats
+ */
+class BatchLoader {
+public:
+  /**
+   * @brief Fills the inputs of a sample from its image
+   * @return False if the sample must be left out
+   */
+  using Preprocess = std::function<bool(const Image& image, float* inputs)>;
+
+  struct Options {
+    size_t batch_size = 32;
+
+    /**
+     * @brief Number of producer threads
+     */
+    size_t nb_threads = 2;
+
+    /**
+     * @brief Number of batches in the ring, loaded or being loaded. At least 2
+     */
+    size_t capacity = 4;
+
+    /**
+     * @brief Number of floats in the inputs of a sample
+     */
+    size_t input_size = 0;
+  };
+
+  struct Stats {
+    std::chrono::nanoseconds consumer_stall{0};// waiting for a batch to be ready
+    std::chrono::nanoseconds producer_stall{0};// waiting for a free slot
+    size_t batches = 0;
+    size_t samples = 0;
+    size_t failures = 0;
+  };
+
+  /**
+   * @param dataset The dataset the samples are read from, which must outlive the loader
+   * @param preprocess Fills the inputs of a sample, usually with the preprocessing pipeline of
+   * the training (see pipelinePreprocess in SampleSources.hpp). If empty, the inputs are the raw
+   * pixels of the image as floats (Image::toFloat), which must then be input_size values
+   */
+  BatchLoader(LazyDataset& dataset, const Options& options, Preprocess preprocess = {});
+
+  BatchLoader(const BatchLoader&) = delete;
+  BatchLoader& operator=(const BatchLoader&) = delete;
+
+  /**
+   * @brief Stops the epoch in progress
+   */
+  ~BatchLoader();
+
+  /**
+   * @brief Start loading the batches of an epoch, stopping the previous epoch if it was not
+   * consumed to the end
+   * @param order The positions of the samples in the dataset, in the order of the epoch
+   */
+  void startEpoch(std::vector<size_t> order);
+
+  /**
+   * @brief The next batch of the epoch, waiting for it if needed
+   * The batch is valid until the next call, which hands its slot back to the producers
+   * @return nullptr once the whole epoch was read
+   */
+  const Batch* next();
+
+  [[nodiscard]] Stats getStats() const;
+
+private:
+  struct Slot {
+    // batch b of the epoch may be written in the slot when sequence == b, read when b + 1
+    std::atomic<uint64_t> sequence = 0;
+    Batch batch;
+  };
+
+  /**
+   * @brief Hand the batch held by the consumer back to the producers
+   */
+  void release();
+
+  void produce();
+  void fill(Batch& batch, uint64_t index);
+
+  /**
+   * @brief Stop the producers, drain the batches they claimed, and join them
+   */
+  void stop();
+
+  LazyDataset& dataset;
+  Options options;
+  Preprocess preprocess;
+
+  std::unique_ptr<Slot[]> slots;
+  std::vector<size_t> order;
+  uint64_t nb_batches = 0;
+
+  std::atomic<uint64_t> next_claim = 0;// next batch to load, shared by the producers
+  std::atomic<bool> stopping = false;
+  uint64_t next_read = 0;// next batch of the consumer
+  bool holding = false;  // the consumer holds batch next_read - 1
+  std::vector<std::thread> producers;
+
+  std::atomic<int64_t> consumer_stall = 0, producer_stall = 0;
+  std::atomic<size_t> batches = 0, samples = 0, failures = 0;
+};
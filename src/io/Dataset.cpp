@@ -2,9 +2,14 @@
 
 #include "Dataset.hpp"
 #include <algorithm>
+#include <cstring>
 #include <execution>
-#include <random>
+#include <fcntl.h>
+#include <fstream>
 #include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace {
 
@@ -18,39 +23,77 @@ namespace {
     return true;
   }
 
+  /**
+   * @brief Read a whole file in a buffer, reusing its memory
+   * @return False if the file could not be read
+   */
+  bool read_file(const std::filesystem::path& path, std::vector<unsigned char>& buffer) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (not file) return false;
+
+    auto size = static_cast<std::streamsize>(file.tellg());
+    buffer.resize(size);
+    file.seekg(0);
+    return size > 0 and file.read(reinterpret_cast<char*>(buffer.data()), size);
+  }
+
   std::pair<std::vector<Image>, std::vector<int>>
   load_image_in_range(const DatasetInfo& info, unsigned int begin, unsigned int end,
                       int max_per_label, int nlabel) {
 
-    std::vector<int> label_count(nlabel, 0);
-
     std::vector<Image> image_buffer(end - begin);
     std::vector<int> image_ids(end - begin);
 
     size_t errors = 0;
 
     // Load the images in parallel, but store them in a temporary buffer
-    // So we can remove the images that failed to load
-    for (unsigned int i = begin; i < end; i++) {
-      const ImageInfo& curr_info = info.getImagesInfo()[i];
+    // So we can remove the images that failed to load.
+#pragma omp parallel reduction(+ : errors)
+    {
+      // Encoded files are read in a buffer of the thread, reused from one image to the next.
+      // Archives are read through a file handle of the thread
+      std::vector<unsigned char> file_buffer;
+      std::optional<Archive::Reader> archive_reader;
+      if (info.getArchive()) archive_reader.emplace(*info.getArchive());
+
+#pragma omp for schedule(dynamic, 16)
+      for (unsigned int i = begin; i < end; i++) {
+        const ImageInfo& curr_info = info.getImagesInfo()[i];
+
+        bool read = archive_reader ? archive_reader->read(curr_info.getArchiveEntry(), file_buffer)
+                                   : read_file(curr_info.getPath(), file_buffer);
+
+        std::optional<Image> loaded_image;
+        if (read)
+          loaded_image = Image::loadFromMemory(file_buffer.data(), file_buffer.size(), 1);
+
+        if (not loaded_image) {
+          spdlog::warn("Dataset: failed to load image {}", curr_info.getPath().string());
+          errors++;
+          continue;
+        }
+
+        image_buffer[i - begin] = std::move(*loaded_image);
+        image_ids[i - begin] = curr_info.getUniqueId();
+      }
+    }
 
-      if (max_per_label > 0 and label_count[curr_info.getLabelId()] >= max_per_label) { continue; }
 
-      auto loaded_image = Image::load(curr_info.getPath(), 1);
+    // The quotas are applied once every image is decoded, in the order of the images : a failed
+    // image leaves its slot to the next image of its label, whatever the scheduling
+    if (max_per_label > 0) {
+      std::vector<int> label_count(nlabel, 0);
+      for (unsigned int i = begin; i < end; i++) {
+        Image& image = image_buffer[i - begin];
+        if (image.bytes() == nullptr) continue;
 
-      if (not loaded_image) {
-        spdlog::warn("Dataset: failed to load image {}", curr_info.getPath().string());
-        errors++;
+        int& count = label_count[info.getImagesInfo()[i].getLabelId()];
+        if (count < max_per_label) count++;
+        else
+          image = Image();
       }
-
-      image_buffer[i - begin] = std::move(*loaded_image);
-      image_ids[i - begin] = curr_info.getUniqueId();
-
-      // Atomically increase the counter for the current label
-      label_count[curr_info.getLabelId()]++;
     }
 
-
     if (errors > 0)
       spdlog::warn(
               "Dataset: failed to load {} images, see above for the list of images that failed "
@@ -61,36 +104,6 @@ namespace {
   }
 
 
-  std::pair<int, int> find_max_size(const Dataset& set) {
-
-    int max_w = 0, max_h = 0;
-
-    for (const auto& image: set.getImages()) {
-      max_w = std::max(max_w, image.getWidth());
-      max_h = std::max(max_h, image.getHeight());
-    }
-    return {max_w, max_h};
-  }
-
-  void resize_to_max_dim(Dataset& test_set,
-                         Dataset& train_set) {// Ensure all the images have the same size
-    auto [max_width_test, max_height_test] = find_max_size(test_set);
-    auto [max_width_train, max_height_train] = find_max_size(train_set);
-
-    int max_width = std::max(max_width_test, max_width_train);
-    int max_height = std::max(max_height_test, max_height_train);
-
-    auto resize_lambda = [max_width, max_height](Image& image) {
-      image.resize(max_width, max_height);
-    };
-
-    std::for_each(std::execution::par_unseq, test_set.getImages().begin(),
-                  test_set.getImages().end(), resize_lambda);
-    std::for_each(std::execution::par_unseq, train_set.getImages().begin(),
-                  train_set.getImages().end(), resize_lambda);
-  }
-
-
   /**
    * @brief Find the label with the least number of images, and return its size if it is different
    * from the number of images in the other labels
@@ -117,6 +130,77 @@ namespace {
     return min_num_images;
   }
 
+  constexpr char cache_magic[8] = {'P', 'P', 'N', 'D', 'A', 'T', 'A', '\0'};
+  constexpr uint32_t cache_version = 2;
+  constexpr uint64_t cache_alignment = 64;
+
+  struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_labels;
+    uint64_t nb_images;
+    uint64_t source;
+    uint64_t labels_size;  // bytes of the label names, each followed by a '\0'
+    uint64_t pixels_offset;// from the start of the file
+    uint64_t file_size;
+  };
+
+  struct CacheImage {
+    int32_t id, label;
+    int32_t width, height, channels;
+    int32_t pixel_type;// Image::PixelType
+    uint64_t offset;   // of the pixels, from pixels_offset
+  };
+
+  uint64_t align_cache_offset(uint64_t offset) {
+    return (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+  }
+
+  uint64_t image_bytes(int width, int height, int channels, Image::PixelType type) {
+    return (uint64_t) width * height * channels * Image::pixelSize(type);
+  }
+
+  /**
+   * @brief FNV-1a hash of the images a dataset is loaded from, and of the way they are loaded
+   * The size and the modification time of the files tell when an image was replaced under the
+   * same name. The images of an archive are covered by the ones of the archive
+   */
+  uint64_t dataset_source(const DatasetInfo& info, unsigned int begin, unsigned int end,
+                          bool enforce_equal_distribution, bool resize_to_max_size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](const void* data, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<const unsigned char*>(data)[i];
+        hash *= 0x100000001b3ull;
+      }
+    };
+
+    auto mix_file = [&mix](const std::filesystem::path& path) {
+      // a missing file hashes as an empty one written at the epoch, it then fails to load
+      std::error_code error;
+      uint64_t size = std::filesystem::file_size(path, error);
+      if (error) size = 0;
+      auto mtime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+      if (error) mtime = 0;
+
+      mix(&size, sizeof(size));
+      mix(&mtime, sizeof(mtime));
+    };
+
+    uint64_t params[4] = {begin, end, enforce_equal_distribution, resize_to_max_size};
+    mix(params, sizeof(params));
+    if (info.getArchive()) mix_file(info.getRootPath());
+    for (const auto& label: info.getLabels()) mix(label.c_str(), label.size() + 1);
+    for (const auto& image_info: info.getImagesInfo()) {
+      const std::string& path = image_info.getPath().native();
+      int label = image_info.getLabelId();
+      mix(path.c_str(), path.size() + 1);
+      mix(&label, sizeof(label));
+      if (not info.getArchive()) mix_file(image_info.getPath());
+    }
+    return hash;
+  }
+
 }// namespace
 
 Dataset::Dataset(const DatasetInfo& info, unsigned int begin, unsigned int end,
@@ -144,7 +228,7 @@ Dataset::Dataset(const DatasetInfo& info, unsigned int begin, unsigned int end,
   for (unsigned int i = 0; i < image_buffer.size(); i++) {
     auto& image = image_buffer[i];
 
-    if (image.data() == nullptr) continue;
+    if (image.bytes() == nullptr) continue;
 
     int curr_id = image_ids[i];
 
@@ -156,29 +240,165 @@ Dataset::Dataset(const DatasetInfo& info, unsigned int begin, unsigned int end,
   labels_names = info.getLabels();
 }
 
-std::pair<Dataset, Dataset> Dataset::load_and_split(const DatasetInfo& info, float split_ratio,
-                                                    bool enforce_equal_distribution) {
-  std::vector<int> image_ids;
-  for (const auto& image_info: info.getImagesInfo()) {
-    image_ids.push_back(image_info.getUniqueId());
+void Dataset::resizeToMaxSize() {
+  int max_width = 0, max_height = 0;
+  for (const auto& image: images) {
+    max_width = std::max(max_width, image.getWidth());
+    max_height = std::max(max_height, image.getHeight());
+  }
+
+  std::for_each(std::execution::par_unseq, images.begin(), images.end(),
+                [max_width, max_height](Image& image) { image.resize(max_width, max_height); });
+}
+
+Dataset Dataset::loadCached(const std::filesystem::path& cache_path, const DatasetInfo& info,
+                            unsigned int begin, unsigned int end,
+                            bool enforce_equal_distribution, bool resize_to_max_size) {
+  uint64_t source =
+          dataset_source(info, begin, end, enforce_equal_distribution, resize_to_max_size);
+
+  if (std::filesystem::exists(cache_path)) {
+    if (auto cached = map(cache_path, source)) {
+      spdlog::debug("Dataset: mapped {} images from {}", cached->getSize(), cache_path.string());
+      return std::move(*cached);
+    }
+    spdlog::info("Dataset: the cache {} is outdated, loading the images", cache_path.string());
+  }
+
+  Dataset res(info, begin, end, enforce_equal_distribution);
+  if (resize_to_max_size) res.resizeToMaxSize();
+  res.save(cache_path, source);
+  return res;
+}
+
+bool Dataset::save(const std::filesystem::path& path, uint64_t source) const {
+  CacheHeader header{};
+  memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.nb_labels = labels_names.size();
+  header.nb_images = images.size();
+  header.source = source;
+  for (const auto& name: labels_names) header.labels_size += name.size() + 1;
+
+  std::vector<CacheImage> table(images.size());
+  uint64_t pixels_size = 0;
+  for (size_t i = 0; i < images.size(); i++) {
+    const Image& image = images[i];
+    table[i] = {image_id[i], labels[i], image.getWidth(), image.getHeight(),
+                image.getNChannels(), (int32_t) image.getPixelType(), pixels_size};
+    pixels_size = align_cache_offset(pixels_size + image.getByteSize());
+  }
+  header.pixels_offset = align_cache_offset(sizeof(CacheHeader) +
+                                            table.size() * sizeof(CacheImage) + header.labels_size);
+  header.file_size = header.pixels_offset + pixels_size;
+
+  // written next to the previous cache, which it then replaces
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+
+  std::error_code error;
+  if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), error);
+
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  static const char padding[cache_alignment] = {};
+  auto pad = [&file](uint64_t size) {
+    file.write(padding, (std::streamsize) (align_cache_offset(size) - size));
+  };
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(table.data()),
+             (std::streamsize) (table.size() * sizeof(CacheImage)));
+  for (const auto& name: labels_names) file.write(name.c_str(), (std::streamsize) name.size() + 1);
+  pad(sizeof(CacheHeader) + table.size() * sizeof(CacheImage) + header.labels_size);
+
+  for (const auto& image: images) {
+    file.write(reinterpret_cast<const char*>(image.bytes()),
+               (std::streamsize) image.getByteSize());
+    pad(image.getByteSize());
+  }
+  file.close();
+
+  if (file) std::filesystem::rename(tmp_path, path, error);
+  if (not file or error) {
+    spdlog::error("Dataset: could not write the cache {}", path.string());
+    std::filesystem::remove(tmp_path, error);
+    return false;
   }
 
-  // Shuffle the image ids
-  std::shuffle(image_ids.begin(), image_ids.end(), std::mt19937{std::random_device{}()});
+  return true;
+}
 
-  // Take the first 10% of the images for the test set
-  unsigned int split_index = (int) ((float) image_ids.size() * split_ratio);
+std::optional<Dataset> Dataset::map(const std::filesystem::path& path, uint64_t source) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st {};
+  if (fd < 0 or fstat(fd, &st) != 0 or (uint64_t) st.st_size < sizeof(CacheHeader)) {
+    if (fd >= 0) close(fd);
+    return std::nullopt;
+  }
 
-  Dataset test_set(info, 0, split_index);
-  Dataset train_set(info, split_index, image_ids.size(), enforce_equal_distribution);
+  // private and writable : the pages written are copied, the file is never modified
+  uint64_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return std::nullopt;
+
+  // released once the dataset and all its images are gone
+  std::shared_ptr<unsigned char> mapping(static_cast<unsigned char*>(data),
+                                         [size](unsigned char* ptr) { munmap(ptr, size); });
+  const unsigned char* bytes = mapping.get();
+
+  CacheHeader header;
+  memcpy(&header, bytes, sizeof(header));
+  uint64_t labels_offset = sizeof(CacheHeader) + header.nb_images * sizeof(CacheImage);
+  if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 or
+      header.version != cache_version or header.source != source or header.file_size != size or
+      header.nb_images > size / sizeof(CacheImage) or header.pixels_offset > size or
+      header.labels_size > size or labels_offset + header.labels_size > header.pixels_offset) {
+    return std::nullopt;
+  }
 
-  resize_to_max_dim(test_set, train_set);
+  Dataset res;
 
-  return {std::move(train_set), std::move(test_set)};
+  const char* names = reinterpret_cast<const char*>(bytes + labels_offset);
+  const char* names_end = names + header.labels_size;
+  for (uint32_t l = 0; l < header.nb_labels; l++) {
+    const char* name_end = static_cast<const char*>(memchr(names, '\0', names_end - names));
+    if (name_end == nullptr) return std::nullopt;
+    res.labels_names.emplace_back(names, name_end);
+    names = name_end + 1;
+  }
+
+  const auto* table = reinterpret_cast<const CacheImage*>(bytes + sizeof(CacheHeader));
+  uint64_t pixels_size = size - header.pixels_offset;
+  res.images.reserve(header.nb_images);
+  for (uint64_t i = 0; i < header.nb_images; i++) {
+    const CacheImage& entry = table[i];
+    auto type = static_cast<Image::PixelType>(entry.pixel_type);
+    if (entry.width <= 0 or entry.height <= 0 or entry.channels <= 0 or entry.label < 0 or
+        (uint32_t) entry.label >= header.nb_labels or entry.pixel_type < 0 or
+        type > Image::PixelType::F32 or entry.offset % cache_alignment != 0 or
+        entry.offset > pixels_size or
+        image_bytes(entry.width, entry.height, entry.channels, type) > pixels_size - entry.offset)
+      return std::nullopt;
+
+    unsigned char* pixels = mapping.get() + header.pixels_offset + entry.offset;
+    res.images.emplace_back(Image::fromShared(std::shared_ptr<unsigned char[]>(mapping, pixels),
+                                              type, entry.width, entry.height, entry.channels));
+    res.image_id.emplace_back(entry.id);
+    res.labels.emplace_back(entry.label);
+  }
+
+  return res;
 }
 
 size_t Dataset::getSize() const { return images.size(); }
 
 std::vector<Image>& Dataset::getImages() { return images; }
 
-const std::vector<Image>& Dataset::getImages() const { return images; }
\ No newline at end of file
+const std::vector<Image>& Dataset::getImages() const { return images; }
+
+int Dataset::getLabel(size_t i) const { return labels[i]; }
+
+int Dataset::getImageId(size_t i) const { return image_id[i]; }
+
+const std::vector<std::string>& Dataset::getLabelsNames() const { return labels_names; }
\ No newline at end of file
@@ -3,13 +3,14 @@
 #pragma once
 #include "DatasetInfo.hpp"
 #include "Image.hpp"
+#include <cstdint>
 #include <unordered_map>
 #include <utility>
 
 /**
  * @brief A dataset is a collection of images and their labels
  * This class is meant to be used in conjunction with the DatasetInfo class, to load a dataset from
- * disk
+ * disk. The training and testing sets are DatasetViews over the images of a single Dataset
  */
 class Dataset {
 public:
@@ -31,16 +32,36 @@ public:
                    bool enforce_equal_distribution = false);
 
   /**
-   * @brief Load a dataset from a DatasetInfo, and split it into two dataset for training and
-   * testing
-   * @param info The DatasetInfo associated with the dataset
-   * @param split_ratio The proportion of the dataset to use for training
-   * @param enforce_equal_distribution If true, the dataset is resized to have the same number of
-   * images per label
-   * @return One dataset for training, and one dataset for testing, in this order
+   * @brief Same as the constructor, through a cache file. The dataset is mapped from the cache if
+   * it was written for the same images, otherwise the images are decoded and the cache is written
+   * for the next runs
+   * @param cache_path The path to the cache file
+   * @param resize_to_max_size If true, the images are resized with resizeToMaxSize before the
+   * cache is written, so that the mapped images are used as they are
+   */
+  static Dataset loadCached(const std::filesystem::path& cache_path, const DatasetInfo& info,
+                            unsigned int begin = 0, unsigned int end = 0,
+                            bool enforce_equal_distribution = false,
+                            bool resize_to_max_size = false);
+
+  /**
+   * @brief Write the dataset in a single file : a header, the image table, the label names, then
+   * the pixels of every image in one contiguous block, each image aligned on 64 bytes
+   * @param path The path to the cache file, replaced once the new one is complete
+   * @param source A fingerprint of the images, checked when the file is mapped
+   * @return False if the file could not be written
    */
-  static std::pair<Dataset, Dataset> load_and_split(const DatasetInfo& info, float split_ratio,
-                                                    bool enforce_equal_distribution = false);
+  bool save(const std::filesystem::path& path, uint64_t source = 0) const;
+
+  /**
+   * @brief Map a file written by save. The pixels are not read : the images point to the
+   * mapping, and are loaded from the file on their first access. Writing to them only copies the
+   * pages written, the file is left untouched
+   * @param path The path to the cache file
+   * @param source The fingerprint the file must have been written with
+   * @return std::nullopt if the file is missing, corrupted or written for another source
+   */
+  static std::optional<Dataset> map(const std::filesystem::path& path, uint64_t source = 0);
 
   /**
    * @return Returns a vector containing the images in the dataset
@@ -57,6 +78,27 @@ public:
    */
   size_t getSize() const;
 
+  /**
+   * @return The id of the label of the i-th image
+   */
+  [[nodiscard]] int getLabel(size_t i) const;
+
+  /**
+   * @return The unique id of the i-th image in its DatasetInfo
+   */
+  [[nodiscard]] int getImageId(size_t i) const;
+
+  /**
+   * @return The name of the labels
+   */
+  [[nodiscard]] const std::vector<std::string>& getLabelsNames() const;
+
+  /**
+   * @brief Resize every image to the width and the height of the largest ones, so that all the
+   * images have the same size
+   */
+  void resizeToMaxSize();
+
 private:
   /**
    * @brief contains all the images in the dataset
@@ -2,6 +2,7 @@
 
 #include "DatasetInfo.hpp"
 #include <spdlog/spdlog.h>
+#include <unordered_map>
 namespace fs = std::filesystem;
 
 std::optional<DatasetInfo>
@@ -42,7 +43,42 @@ DatasetInfo::loadFromDirectory(const std::filesystem::path& dataset_path) {
 
 std::optional<DatasetInfo> DatasetInfo::loadFromArchive(const std::filesystem::path& dataset_path) {
   spdlog::debug("Loading dataset from archive {}", dataset_path.string());
-  throw std::runtime_error("Not implemented yet");
+
+  auto archive = Archive::open(dataset_path);
+  if (not archive) return std::nullopt;
+
+  DatasetInfo res;
+  res.dataset_path = dataset_path;
+  res.is_archive = true;
+  res.archive = std::make_shared<const Archive>(std::move(*archive));
+
+  std::unordered_map<std::string, int> label_ids;
+  int current_id = 0;
+
+  const auto& entries = res.archive->getEntries();
+  for (size_t e = 0; e < entries.size(); e++) {
+    fs::path path(entries[e].name);
+    auto depth = std::distance(path.begin(), path.end());
+
+    // <label>/<image> or <root>/<label>/<image>
+    if (depth != 2 and depth != 3) {
+      spdlog::warn("Ignoring file {} in dataset archive", entries[e].name);
+      continue;
+    }
+
+    std::string label = path.parent_path().filename().string();
+    auto [it, inserted] = label_ids.try_emplace(label, (int) res.labels.size());
+    if (inserted) res.labels.emplace_back(label);
+
+    res.images_info.emplace_back(path, current_id++, it->second, (int) e);
+  }
+
+  spdlog::debug("Found {} labels in dataset archive {}", res.labels.size(),
+                dataset_path.string());
+
+  spdlog::debug("Found {} images in dataset archive {}", res.images_info.size(),
+                dataset_path.string());
+  return res;
 }
 
 std::optional<DatasetInfo> DatasetInfo::loadFromPath(const std::filesystem::path& dataset_path) {
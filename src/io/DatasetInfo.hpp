@@ -1,7 +1,11 @@
 #pragma once
+#include "Archive.hpp"
 #include "Image.hpp"
 #include "ImageInfo.hpp"
+#include <algorithm>
+#include <cstddef>
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -20,19 +24,20 @@ public:
   static std::optional<DatasetInfo> loadFromPath(const std::filesystem::path& dataset_path);
 
   /**
-   * @brief Load a DatasetInfo from a directory on disk
-   * The directory must contain a subdirectory for each label, and each subdirectory must contain a
-   * set of images with no subdirectories
-   * @param dataset_path The path to the dataset
+   * @brief Load a DatasetInfo from a zip or uncompressed tar archive on disk, see Archive
+   * The archive may contain a top level directory, which must contain a subdirectory for each
+   * label, and each subdirectory must contain a set of images with no subdirectories.
+   * Only the entries are indexed, the images are then read from the archive without extracting it
+   * @param dataset_path  The path to the dataset
    * @return A DatasetInfo object if the dataset was successfully loaded, std::nullopt otherwise
    */
   static std::optional<DatasetInfo> loadFromArchive(const std::filesystem::path& dataset_path);
 
   /**
-   * @brief Load a DatasetInfo from an archive on disk
-   * The archive must contain a top level directory, which must contain a subdirectory for each
-   * label, and each subdirectory must contain a set of images with no subdirectories
-   * @param dataset_path  The path to the dataset
+   * @brief Load a DatasetInfo from a directory on disk
+   * The directory must contain a subdirectory for each label, and each subdirectory must contain a
+   * set of images with no subdirectories
+   * @param dataset_path The path to the dataset
    * @return A DatasetInfo object if the dataset was successfully loaded, std::nullopt otherwise
    */
   static std::optional<DatasetInfo> loadFromDirectory(const std::filesystem::path& dataset_path);
@@ -72,12 +77,22 @@ public:
    */
   [[nodiscard]] bool isArchive() const { return is_archive; }
 
+  /**
+   * @return The index of the archive of the dataset, nullptr if the dataset is a directory
+   */
+  [[nodiscard]] const Archive* getArchive() const { return archive.get(); }
+
 private:
   /**
    * @brief True if the dataset is an archive, false otherwise
    */
   bool is_archive = false;
 
+  /**
+   * @brief The index of the archive, shared by the copies of the DatasetInfo
+   */
+  std::shared_ptr<const Archive> archive;
+
   /**
    * @brief The root path of the dataset
    */
@@ -93,3 +108,31 @@ private:
    */
   std::vector<ImageInfo> images_info;
 };
+
+/**
+ * @brief Keep the first images of each label, as many as the label with the fewest images has, so
+ * that every label has the same number of images. Labels without any image are not taken into
+ * account
+ * @param indices The images, in order
+ * @param nb_labels The number of labels of the dataset
+ * @param label_of The label of an image of indices
+ * @return The images kept, in order
+ */
+template<typename LabelOf>
+std::vector<unsigned int> balanceLabels(const std::vector<unsigned int>& indices, size_t nb_labels,
+                                        LabelOf label_of) {
+  std::vector<size_t> count(nb_labels);
+  for (unsigned int index: indices) count[label_of(index)]++;
+
+  size_t smallest = indices.size();
+  for (size_t c: count) {
+    if (c > 0) smallest = std::min(smallest, c);
+  }
+
+  std::fill(count.begin(), count.end(), 0);
+  std::vector<unsigned int> res;
+  for (unsigned int index: indices) {
+    if (count[label_of(index)]++ < smallest) res.push_back(index);
+  }
+  return res;
+}
@@ -0,0 +1,51 @@
+#include "DatasetView.hpp"
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+DatasetView::DatasetView(std::shared_ptr<const Dataset> dataset)
+    : dataset(std::move(dataset)), indices(this->dataset->getSize()) {
+  std::iota(indices.begin(), indices.end(), 0);
+}
+
+DatasetView::DatasetView(std::shared_ptr<const Dataset> dataset, std::vector<unsigned int> indices)
+    : dataset(std::move(dataset)), indices(std::move(indices)) {}
+
+std::pair<DatasetView, DatasetView>
+DatasetView::load_and_split(const DatasetInfo& info, float split_ratio, uint64_t seed,
+                            bool enforce_equal_distribution, const std::filesystem::path& cache_dir) {
+  // Every image is loaded once, whatever the split. All the images get the same size, the
+  // cache holds them resized
+  Dataset master;
+  if (cache_dir.empty()) {
+    master = Dataset(info);
+    master.resizeToMaxSize();
+  } else {
+    master = Dataset::loadCached(cache_dir / "dataset.bin", info, 0, 0, false, true);
+  }
+
+  DatasetView all(std::make_shared<const Dataset>(std::move(master)));
+  auto [test_set, train_set] = all.shuffled(seed).split(split_ratio);
+
+  if (enforce_equal_distribution) train_set = train_set.balanced();
+
+  return {std::move(train_set), std::move(test_set)};
+}
+
+DatasetView DatasetView::shuffled(uint64_t seed) const {
+  std::vector<unsigned int> res = indices;
+  std::shuffle(res.begin(), res.end(), std::mt19937_64{seed});
+  return {dataset, std::move(res)};
+}
+
+std::pair<DatasetView, DatasetView> DatasetView::split(float ratio) const {
+  auto split_index = (size_t) ((float) indices.size() * std::clamp(ratio, 0.f, 1.f));
+
+  return {DatasetView(dataset, {indices.begin(), indices.begin() + split_index}),
+          DatasetView(dataset, {indices.begin() + split_index, indices.end()})};
+}
+
+DatasetView DatasetView::balanced() const {
+  return {dataset, balanceLabels(indices, dataset->getLabelsNames().size(),
+                                 [this](unsigned int index) { return dataset->getLabel(index); })};
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "Dataset.hpp"
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A subset of the images of a Dataset, such as a training, testing or validation set
+ * A view only holds the indices of its images in the dataset, which it shares with the other
+ * views : shuffling and splitting a view only moves indices, the images are never copied or
+ * reloaded
+ */
+class DatasetView {
+public:
+  /**
+   * @brief Construct an empty view
+   */
+  DatasetView() = default;
+
+  /**
+   * @brief A view over all the images of a dataset, in order
+   */
+  explicit DatasetView(std::shared_ptr<const Dataset> dataset);
+
+  /**
+   * @param dataset The dataset holding the images
+   * @param indices The indices of the images of the view in the dataset
+   */
+  DatasetView(std::shared_ptr<const Dataset> dataset, std::vector<unsigned int> indices);
+
+  /**
+   * @brief Load a dataset once, resized to the size of its largest image, and split it at random
+   * into two views for training and testing
+   * @param info The DatasetInfo associated with the dataset
+   * @param split_ratio The proportion of the images to use for testing
+   * @param seed The seed of the shuffle, the same seed gives the same split of the same dataset
+   * @param enforce_equal_distribution If true, the training view keeps the same number of images
+   * for each label, see balanced
+   * @param cache_dir If not empty, the dataset is loaded through a cache file in this directory,
+   * see Dataset::loadCached, which holds the resized images. The split does not depend on the
+   * cache
+   * @return One view for training, and one view for testing, in this order
+   */
+  static std::pair<DatasetView, DatasetView>
+  load_and_split(const DatasetInfo& info, float split_ratio, uint64_t seed,
+                 bool enforce_equal_distribution = false,
+                 const std::filesystem::path& cache_dir = {});
+
+  /**
+   * @return The same images in a random order
+   */
+  [[nodiscard]] DatasetView shuffled(uint64_t seed) const;
+
+  /**
+   * @brief Split the view in two, keeping the order of the images
+   * @param ratio The proportion of the images of the first view
+   */
+  [[nodiscard]] std::pair<DatasetView, DatasetView> split(float ratio) const;
+
+  /**
+   * @return The view without the images past the number of images of its smallest label, so that
+   * every label has the same number of images. The first images of each label are kept
+   */
+  [[nodiscard]] DatasetView balanced() const;
+
+  // Defined here for inlining purposes
+
+  /**
+   * @return The i-th image of the view
+   */
+  [[nodiscard]] const Image& getImage(size_t i) const {
+    return dataset->getImages()[indices[i]];
+  }
+
+  /**
+   * @return The id of the label of the i-th image of the view
+   */
+  [[nodiscard]] int getLabel(size_t i) const { return dataset->getLabel(indices[i]); }
+
+  /**
+   * @return The unique id of the i-th image of the view in its DatasetInfo
+   */
+  [[nodiscard]] int getImageId(size_t i) const { return dataset->getImageId(indices[i]); }
+
+  /**
+   * @return The indices of the images of the view in the dataset
+   */
+  [[nodiscard]] const std::vector<unsigned int>& getIndices() const { return indices; }
+
+  /**
+   * @return The dataset holding the images
+   */
+  [[nodiscard]] const Dataset& getDataset() const { return *dataset; }
+
+  /**
+   * @return the size of the view
+   */
+  [[nodiscard]] size_t getSize() const { return indices.size(); }
+
+private:
+  /**
+   * @brief Shared by all the views of the dataset, it lives as long as one of them
+   */
+  std::shared_ptr<const Dataset> dataset;
+
+  std::vector<unsigned int> indices;
+};
@@ -1,13 +1,52 @@
-
-
 #include "Image.hpp"
+#include <algorithm>
 #include <stb_image.h>
 #include <stb_image_resize.h>
+#include <stdexcept>
 
 std::optional<Image> Image::load(const std::filesystem::path& path, int nchannels) {
+  std::string name = path.string();
+  int width, height, channels;
+  void* pixels;
+  PixelType type;
+
+  if (stbi_is_hdr(name.c_str())) {
+    pixels = stbi_loadf(name.c_str(), &width, &height, &channels, nchannels);
+    type = PixelType::F32;
+  } else if (stbi_is_16_bit(name.c_str())) {
+    pixels = stbi_load_16(name.c_str(), &width, &height, &channels, nchannels);
+    type = PixelType::U16;
+  } else {
+    pixels = stbi_load(name.c_str(), &width, &height, &channels, nchannels);
+    type = PixelType::U8;
+  }
+
+  return fromDecoded(pixels, type, width, height, channels, nchannels);
+}
+
+std::optional<Image> Image::loadFromMemory(const unsigned char* buffer, size_t size,
+                                           int nchannels) {
+  int len = static_cast<int>(size);
   int width, height, channels;
-  float* pixels = stbi_loadf(path.string().c_str(), &width, &height, &channels, nchannels);
+  void* pixels;
+  PixelType type;
+
+  if (stbi_is_hdr_from_memory(buffer, len)) {
+    pixels = stbi_loadf_from_memory(buffer, len, &width, &height, &channels, nchannels);
+    type = PixelType::F32;
+  } else if (stbi_is_16_bit_from_memory(buffer, len)) {
+    pixels = stbi_load_16_from_memory(buffer, len, &width, &height, &channels, nchannels);
+    type = PixelType::U16;
+  } else {
+    pixels = stbi_load_from_memory(buffer, len, &width, &height, &channels, nchannels);
+    type = PixelType::U8;
+  }
 
+  return fromDecoded(pixels, type, width, height, channels, nchannels);
+}
+
+std::optional<Image> Image::fromDecoded(void* pixels, PixelType type, int width, int height,
+                                        int channels, int nchannels) {
   if (pixels == nullptr) { return std::nullopt; }
 
   if (channels != nchannels and nchannels != 0) {
@@ -15,11 +54,20 @@ std::optional<Image> Image::load(const std::filesystem::path& path, int nchannel
     return std::nullopt;
   }
 
+  // released by stb_image, which allocated them
+  return fromShared(std::shared_ptr<unsigned char[]>(static_cast<unsigned char*>(pixels),
+                                                     stbi_image_free),
+                    type, width, height, nchannels != 0 ? nchannels : channels);
+}
+
+Image Image::fromShared(std::shared_ptr<unsigned char[]> pixels, PixelType type, int width,
+                        int height, int channels) {
   Image res;
-  res.pixels = std::unique_ptr<float[]>(pixels);
+  res.pixels = std::move(pixels);
+  res.type = type;
   res.width = width;
   res.height = height;
-  res.channels = nchannels;
+  res.channels = channels;
 
   return res;
 }
@@ -28,10 +76,28 @@ void Image::resize(int new_width, int new_height) {
 
   if (new_width == this->width and new_height == this->height) { return; }
 
-  std::unique_ptr<float[]> new_pixels =
-          std::make_unique<float[]>(new_width * new_height * channels);
-  int err = stbir_resize_float(this->pixels.get(), this->width, this->height, 0, new_pixels.get(),
-                               new_width, new_height, 0, channels);
+  std::shared_ptr<unsigned char[]> new_pixels(
+          new unsigned char[(size_t) new_width * new_height * channels * pixelSize(type)]);
+  int err = 0;
+
+  switch (type) {
+    case PixelType::U8:
+      err = stbir_resize_uint8(pixels.get(), width, height, 0, new_pixels.get(), new_width,
+                               new_height, 0, channels);
+      break;
+    case PixelType::U16:
+      err = stbir_resize_uint16_generic(
+              data<uint16_t>(), width, height, 0,
+              reinterpret_cast<uint16_t*>(new_pixels.get()), new_width, new_height, 0, channels,
+              STBIR_ALPHA_CHANNEL_NONE, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT,
+              STBIR_COLORSPACE_LINEAR, nullptr);
+      break;
+    case PixelType::F32:
+      err = stbir_resize_float(data<float>(), width, height, 0,
+                               reinterpret_cast<float*>(new_pixels.get()), new_width, new_height,
+                               0, channels);
+      break;
+  }
 
   if (err == 0) { throw std::runtime_error("Error in stb while resizing image"); }
 
@@ -39,3 +105,21 @@ void Image::resize(int new_width, int new_height) {
   this->width = new_width;
   this->height = new_height;
 }
+
+void Image::toFloat(float* out) const {
+  size_t size = (size_t) width * height * channels;
+
+  switch (type) {
+    case PixelType::U8:
+      std::transform(data<uint8_t>(), data<uint8_t>() + size, out,
+                     [](uint8_t v) { return (float) v * (1.f / 255.f); });
+      break;
+    case PixelType::U16:
+      std::transform(data<uint16_t>(), data<uint16_t>() + size, out,
+                     [](uint16_t v) { return (float) v * (1.f / 65535.f); });
+      break;
+    case PixelType::F32:
+      std::copy(data<float>(), data<float>() + size, out);
+      break;
+  }
+}
@@ -1,17 +1,53 @@
-
-
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <optional>
+#include <type_traits>
 
 /**
  * @brief A simple image class, used to load images from disk and perform basic operations on them
+ * The pixels are kept in the type they are stored in the file : 8 bits images take one byte per
+ * value, and are only converted to float when they are used, see toFloat and ImageKernels.hpp
  */
 class Image {
 public:
+  enum class PixelType : uint8_t { U8, U16, F32 };
+
+  /**
+   * @return The size of one value of a channel
+   */
+  static constexpr size_t pixelSize(PixelType type) {
+    switch (type) {
+      case PixelType::U8:
+        return sizeof(uint8_t);
+      case PixelType::U16:
+        return sizeof(uint16_t);
+      case PixelType::F32:
+        return sizeof(float);
+    }
+    return 0;
+  }
+
   /**
-   * @brief Load an image from disk, optionally specifying the number of channelsy
+   * @return The PixelType of the values of type T
+   */
+  template<typename T>
+  static constexpr PixelType pixelTypeOf() {
+    static_assert(std::is_same_v<T, uint8_t> or std::is_same_v<T, uint16_t> or
+                          std::is_same_v<T, float>,
+                  "Image: pixels are stored as uint8_t, uint16_t or float");
+    if constexpr (std::is_same_v<T, uint8_t>) return PixelType::U8;
+    else if constexpr (std::is_same_v<T, uint16_t>)
+      return PixelType::U16;
+    else
+      return PixelType::F32;
+  }
+
+  /**
+   * @brief Load an image from disk, optionally specifying the number of channels
+   * 8 and 16 bits images are stored as U8 and U16, HDR images as F32
    * @param path The path to the image
    * @param nchannels The desired number of channels, 0 for automatic detection
    * @return An Image object if the image was successfully loaded, std::nullopt otherwise
@@ -19,18 +55,77 @@ public:
   static std::optional<Image> load(const std::filesystem::path& path, int nchannels = 0);
 
   /**
-   * @brief Resize the image inplace
+   * @brief Decode an image from its encoded file in memory (png, jpeg, ...), see load
+   * @param buffer The content of the file
+   * @param size The size of the file in bytes
+   * @param nchannels The desired number of channels, 0 for automatic detection
+   * @return An Image object if the image was successfully decoded, std::nullopt otherwise
+   */
+  static std::optional<Image> loadFromMemory(const unsigned char* buffer, size_t size,
+                                             int nchannels = 0);
+
+  /**
+   * @brief An image over pixels owned elsewhere, such as a mapped file. The image keeps them alive
+   * @param pixels The pixels, width * height * channels values of the given type
+   */
+  static Image fromShared(std::shared_ptr<unsigned char[]> pixels, PixelType type, int width,
+                          int height, int channels);
+
+  Image() = default;
+
+  // Images are moved, not copied : the pixels would be shared between the copies
+  Image(Image&&) = default;
+  Image& operator=(Image&&) = default;
+  Image(const Image&) = delete;
+  Image& operator=(const Image&) = delete;
+
+  /**
+   * @brief Resize the image inplace, keeping its pixel type
    * @param new_width the target width
    * @param new_height the target height
    */
   void resize(int new_width, int new_height);
 
+  /**
+   * @brief Convert the pixels to float, integer values being scaled to [0, 1]
+   * @param out width * height * channels floats, in the same interleaved layout
+   */
+  void toFloat(float* out) const;
+
   // Defined here for inlining purposes
 
   /**
-   * @return A pointer to the image data
+   * @return A pointer to the pixels, or nullptr if they are not stored as T
+   */
+  template<typename T>
+  T* data() {
+    return type == pixelTypeOf<T>() ? reinterpret_cast<T*>(pixels.get()) : nullptr;
+  }
+
+  /**
+   * @return A pointer to the pixels, or nullptr if they are not stored as T
+   */
+  template<typename T>
+  [[nodiscard]] const T* data() const {
+    return type == pixelTypeOf<T>() ? reinterpret_cast<const T*>(pixels.get()) : nullptr;
+  }
+
+  /**
+   * @return A pointer to the raw pixels, whatever their type
+   */
+  [[nodiscard]] const unsigned char* bytes() const { return pixels.get(); }
+
+  /**
+   * @return The size of the pixels in bytes
    */
-  float* data() { return pixels.get(); }
+  [[nodiscard]] size_t getByteSize() const {
+    return (size_t) width * height * channels * pixelSize(type);
+  }
+
+  /**
+   * @return The type the pixels are stored as
+   */
+  [[nodiscard]] PixelType getPixelType() const { return type; }
 
   /**
    * @return The width of the image. Multiply by getNChannels() to get the number of elements in a row
@@ -48,6 +143,17 @@ public:
   [[nodiscard]] int getNChannels() const { return channels; }
 
 private:
-  std::unique_ptr<float[]> pixels;
-  int width, height, channels;
+  /**
+   * @brief Take ownership of pixels decoded by stb_image, checking their number of channels
+   */
+  static std::optional<Image> fromDecoded(void* pixels, PixelType type, int width, int height,
+                                          int channels, int nchannels);
+
+  /**
+   * @brief Owned by the image, or by the mapping of a dataset cache
+   */
+  std::shared_ptr<unsigned char[]> pixels;
+  PixelType type = PixelType::U8;
+  int width = 0, height = 0, channels = 0;
 };
+
@@ -13,8 +13,11 @@ public:
    * @param image_path The path to the image, relative to the dataset root
    * @param unique_id The unique id of the image inside the dataset
    * @param label_id The id of the label of the image
+   * @param archive_entry The index of the image in the archive of the dataset, -1 if the image
+   * is a file on disk
    */
-  ImageInfo(const std::filesystem::path& image_path, int unique_id, int label_id);
+  ImageInfo(const std::filesystem::path& image_path, int unique_id, int label_id,
+            int archive_entry = -1);
 
   /**
    * @return The id of the label of this image
@@ -31,8 +34,14 @@ public:
    */
   [[nodiscard]] const std::filesystem::path& getPath() const;
 
+  /**
+   * @return The index of this image in Archive::getEntries(), -1 if the image is a file on disk
+   */
+  [[nodiscard]] int getArchiveEntry() const;
+
 private:
   std::filesystem::path image_path;
   int unique_id = -1;
   int label_id = -1;
+  int archive_entry = -1;
 };
@@ -0,0 +1,444 @@
+#pragma once
+#include "Image.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+/**
+ * @brief Image filters working directly on the pixels of an Image, float, 16 or 8 bits, without
+ * any conversion copy. Values are accumulated as floats in all cases, so integer pixels can be
+ * filtered straight into a float output : they are converted as they are read.
+ */
+namespace kernels {
+
+  /**
+   * @brief Strided view over the pixels of an image
+   * Element (x, y, c) is stored at data[y * row_stride + x * pixel_stride + c * channel_stride]
+   */
+  template<typename T>
+  struct ImageView {
+    T* data = nullptr;
+    int width = 0, height = 0, channels = 0;
+    std::ptrdiff_t pixel_stride = 0, row_stride = 0, channel_stride = 0;
+
+    /**
+     * @brief View over channels stored next to each other for each pixel (stb_image layout)
+     */
+    static ImageView interleaved(T* data, int width, int height, int channels) {
+      return {data, width, height, channels, channels, (std::ptrdiff_t) width * channels, 1};
+    }
+
+    /**
+     * @brief View over channels stored one plane after the other
+     */
+    static ImageView planar(T* data, int width, int height, int channels) {
+      return {data, width, height, channels, 1, width, (std::ptrdiff_t) width * height};
+    }
+
+    T& at(int x, int y, int c) const {
+      return data[y * row_stride + x * pixel_stride + c * channel_stride];
+    }
+
+    T* row(int y) const { return data + y * row_stride; }
+
+    /**
+     * @return True if the values of a row are contiguous, for a plane or for all the channels
+     * at once. Rows are then processed as dense spans of span_size() values
+     */
+    [[nodiscard]] bool hasDenseRows() const {
+      return pixel_stride == 1 or (channel_stride == 1 and pixel_stride == channels);
+    }
+
+    [[nodiscard]] int spanCount() const { return pixel_stride == 1 ? channels : 1; }
+
+    [[nodiscard]] int spanSize() const { return pixel_stride == 1 ? width : width * channels; }
+
+    [[nodiscard]] std::ptrdiff_t spanOffset(int span) const { return span * channel_stride; }
+
+    operator ImageView<const T>() const {
+      return {data, width, height, channels, pixel_stride, row_stride, channel_stride};
+    }
+  };
+
+  /**
+   * @return A view over the pixels of an image, which must be stored as T
+   */
+  template<typename T = float>
+  ImageView<T> view(Image& image) {
+    T* data = image.data<T>();
+    if (data == nullptr)
+      throw std::invalid_argument("kernels: the pixels of the image are stored as another type");
+    return ImageView<T>::interleaved(data, image.getWidth(), image.getHeight(),
+                                     image.getNChannels());
+  }
+
+  /**
+   * @return The output size of a valid sliding window
+   */
+  inline int outputSize(int size, int window, int stride) { return (size - window) / stride + 1; }
+
+  namespace detail {
+
+    template<typename T>
+    T fromFloat(float value) {
+      if constexpr (std::is_floating_point_v<T>) return value;
+      else {
+        constexpr float max = (float) std::numeric_limits<T>::max();
+        if (value <= 0.f) return 0;
+        if (value >= max) return std::numeric_limits<T>::max();
+        return (T) (value + 0.5f);
+      }
+    }
+
+#ifdef __SSE2__
+    inline __m128 load4(const float* p) { return _mm_loadu_ps(p); }
+
+    inline __m128 load4(const uint8_t* p) {
+      int32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      __m128i zero = _mm_setzero_si128();
+      __m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+      return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero));
+    }
+
+    inline __m128 load4(const uint16_t* p) {
+      __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+      return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, _mm_setzero_si128()));
+    }
+
+    template<typename T>
+    constexpr bool has_simd = std::is_same_v<T, float> or std::is_same_v<T, uint8_t> or
+                              std::is_same_v<T, uint16_t>;
+#else
+    template<typename T>
+    constexpr bool has_simd = false;
+#endif
+
+    /**
+     * @brief acc[i] += weight * src[i] for n values
+     */
+    template<typename T>
+    void axpy(float weight, const T* src, float* acc, int n) {
+      int i = 0;
+#ifdef __SSE2__
+      if constexpr (has_simd<T>) {
+        __m128 w = _mm_set1_ps(weight);
+        for (; i + 4 <= n; i += 4) {
+          _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(w, load4(src + i))));
+        }
+      }
+#endif
+      for (; i < n; i++) acc[i] += weight * (float) src[i];
+    }
+
+    /**
+     * @brief dst[i] = max(dst[i], src[i]) for n values
+     */
+    template<typename T>
+    void maxInPlace(const T* src, T* dst, int n) {
+      int i = 0;
+#ifdef __SSE2__
+      if constexpr (std::is_same_v<T, uint8_t>) {
+        for (; i + 16 <= n; i += 16) {
+          __m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+          __m128i b = _mm_loadu_si128((const __m128i*) (dst + i));
+          _mm_storeu_si128((__m128i*) (dst + i), _mm_max_epu8(a, b));
+        }
+      } else if constexpr (std::is_same_v<T, uint16_t>) {
+        // No unsigned 16 bits max before SSE4.1 : max(a, b) = (a -sat b) + b
+        for (; i + 8 <= n; i += 8) {
+          __m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+          __m128i b = _mm_loadu_si128((const __m128i*) (dst + i));
+          _mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epu16(_mm_subs_epu16(a, b), b));
+        }
+      } else if constexpr (std::is_same_v<T, float>) {
+        for (; i + 4 <= n; i += 4) {
+          _mm_storeu_ps(dst + i, _mm_max_ps(_mm_loadu_ps(src + i), _mm_loadu_ps(dst + i)));
+        }
+      }
+#endif
+      for (; i < n; i++) dst[i] = std::max(dst[i], src[i]);
+    }
+
+    template<typename T, typename U>
+    void checkOutput(const ImageView<const T>& in, const ImageView<U>& out, int window,
+                     int stride) {
+      if (stride < 1 or window > in.width or window > in.height or out.channels != in.channels or
+          out.width != outputSize(in.width, window, stride) or
+          out.height != outputSize(in.height, window, stride))
+        throw std::invalid_argument("kernels: output view does not match the filter geometry");
+    }
+
+  }// namespace detail
+
+  /**
+   * @brief Valid convolution of each channel with a ksize x ksize kernel
+   * Rows with contiguous values are processed as dense spans with SIMD, on float, u16 and u8 alike
+   * @param in The input image
+   * @param out The output image, of size outputSize(in.width, ksize, stride) x
+   * outputSize(in.height, ksize, stride) with the same number of channels. Integer outputs are
+   * rounded and clamped, a float output of an integer input gets the raw sums
+   * @param kernel The ksize * ksize weights, row major
+   * @param ksize The width and height of the kernel
+   * @param stride The step between two output pixels
+   */
+  template<typename T, typename U = T>
+  void convolve(ImageView<const T> in, ImageView<U> out, const float* kernel, int ksize,
+                int stride = 1) {
+    detail::checkOutput(in, out, ksize, stride);
+
+    if (stride == 1 and in.hasDenseRows() and out.hasDenseRows() and
+        in.pixel_stride == out.pixel_stride) {
+      // Dense path : tap (kx, ky) is the same span shifted by kx pixels
+      int n = out.spanSize();
+      std::vector<float> acc(n);
+
+      for (int y = 0; y < out.height; y++) {
+        for (int span = 0; span < out.spanCount(); span++) {
+          std::fill(acc.begin(), acc.end(), 0.f);
+
+          for (int ky = 0; ky < ksize; ky++) {
+            const T* src = in.row(y + ky) + in.spanOffset(span);
+            for (int kx = 0; kx < ksize; kx++) {
+              float w = kernel[ky * ksize + kx];
+              if (w != 0.f) detail::axpy(w, src + kx * in.pixel_stride, acc.data(), n);
+            }
+          }
+
+          U* dst = out.row(y) + out.spanOffset(span);
+          for (int i = 0; i < n; i++) dst[i] = detail::fromFloat<U>(acc[i]);
+        }
+      }
+      return;
+    }
+
+    for (int c = 0; c < out.channels; c++) {
+      for (int y = 0; y < out.height; y++) {
+        for (int x = 0; x < out.width; x++) {
+          float s = 0.f;
+          for (int ky = 0; ky < ksize; ky++) {
+            for (int kx = 0; kx < ksize; kx++) {
+              s += kernel[ky * ksize + kx] * (float) in.at(x * stride + kx, y * stride + ky, c);
+            }
+          }
+          out.at(x, y, c) = detail::fromFloat<U>(s);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief 3x3 kernel moved to the Winograd F(2x2, 3x3) domain, U = G g G^T
+   * Built once and reused for every image, the filter transform is not redone per call
+   */
+  struct WinogradFilter {
+    float u[4][4] = {};
+
+    explicit WinogradFilter(const float* kernel) {
+      float gg[4][3];
+      for (int j = 0; j < 3; j++) {
+        gg[0][j] = kernel[j];
+        gg[1][j] = 0.5f * (kernel[j] + kernel[3 + j] + kernel[6 + j]);
+        gg[2][j] = 0.5f * (kernel[j] - kernel[3 + j] + kernel[6 + j]);
+        gg[3][j] = kernel[6 + j];
+      }
+      for (int i = 0; i < 4; i++) {
+        u[i][0] = gg[i][0];
+        u[i][1] = 0.5f * (gg[i][0] + gg[i][1] + gg[i][2]);
+        u[i][2] = 0.5f * (gg[i][0] - gg[i][1] + gg[i][2]);
+        u[i][3] = gg[i][2];
+      }
+    }
+  };
+
+  /**
+   * @brief Valid 3x3 convolution of each float channel with Winograd F(2x2, 3x3)
+   * Each 2x2 output tile costs 16 products instead of 36. Four input rows are first combined
+   * column wise (B^T d) for a whole row of tiles, then every tile is finished row by row, so
+   * all the loops run over contiguous rows of tiles.
+   * With a single kernel the transforms cost about as much as the saved products, so this is
+   * on par with the SIMD path of convolve, which stays the default (see the benchmark target).
+   * Integer images always go through convolve
+   * @param in The input image
+   * @param out The output image, (in.width - 2) x (in.height - 2) with the same channels
+   * @param filter The transformed kernel
+   */
+  inline void convolveWinograd(ImageView<const float> in, ImageView<float> out,
+                               const WinogradFilter& filter) {
+    detail::checkOutput(in, out, 3, 1);
+
+    // Rows of the input tiles, padded with zeros past the image
+    int tiles_x = (out.width + 1) / 2;
+    int padded = 2 * tiles_x + 2;
+    std::vector<float> rows(4 * (size_t) padded), t(4 * (size_t) padded);
+    std::vector<float> y(4 * (size_t) tiles_x);
+
+    for (int c = 0; c < in.channels; c++) {
+      for (int ty = 0; 2 * ty < out.height; ty++) {
+        for (int r = 0; r < 4; r++) {
+          float* row = rows.data() + r * padded;
+          int yy = 2 * ty + r;
+          for (int x = 0; x < padded; x++) {
+            row[x] = (yy < in.height and x < in.width) ? in.at(x, yy, c) : 0.f;
+          }
+        }
+
+        // B^T d, on the four rows at once
+        const float *d0 = rows.data(), *d1 = d0 + padded, *d2 = d1 + padded, *d3 = d2 + padded;
+        float *t0 = t.data(), *t1 = t0 + padded, *t2 = t1 + padded, *t3 = t2 + padded;
+        for (int x = 0; x < padded; x++) {
+          t0[x] = d0[x] - d2[x];
+          t1[x] = d1[x] + d2[x];
+          t2[x] = d2[x] - d1[x];
+          t3[x] = d1[x] - d3[x];
+        }
+
+        // (B^T d) B, the products with U, and A^T m A accumulated row by row of the tile
+        std::fill(y.begin(), y.end(), 0.f);
+        float *y00 = y.data(), *y01 = y00 + tiles_x, *y10 = y01 + tiles_x, *y11 = y10 + tiles_x;
+        const float* tr[4] = {t0, t1, t2, t3};
+        constexpr float top[4] = {1.f, 1.f, 1.f, 0.f}, bottom[4] = {0.f, 1.f, -1.f, -1.f};
+
+        for (int i = 0; i < 4; i++) {
+          const float* ti = tr[i];
+          const float* u = filter.u[i];
+          for (int tx = 0; tx < tiles_x; tx++) {
+            const float* v = ti + 2 * tx;
+            float m0 = u[0] * (v[0] - v[2]);
+            float m1 = u[1] * (v[1] + v[2]);
+            float m2 = u[2] * (v[2] - v[1]);
+            float m3 = u[3] * (v[1] - v[3]);
+            float p0 = m0 + m1 + m2, p1 = m1 - m2 - m3;
+            y00[tx] += top[i] * p0;
+            y01[tx] += top[i] * p1;
+            y10[tx] += bottom[i] * p0;
+            y11[tx] += bottom[i] * p1;
+          }
+        }
+
+        for (int r = 0; r < 2 and 2 * ty + r < out.height; r++) {
+          const float* first = r == 0 ? y00 : y10;
+          const float* second = r == 0 ? y01 : y11;
+          for (int tx = 0; tx < tiles_x; tx++) {
+            out.at(2 * tx, 2 * ty + r, c) = first[tx];
+            if (2 * tx + 1 < out.width) out.at(2 * tx + 1, 2 * ty + r, c) = second[tx];
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Max pooling of each channel over window x window tiles
+   * The window rows are first reduced with vertical SIMD max, then each tile is reduced
+   * horizontally
+   */
+  template<typename T>
+  void maxPool(ImageView<const T> in, ImageView<T> out, int window, int stride) {
+    detail::checkOutput(in, out, window, stride);
+
+    if (in.hasDenseRows()) {
+      int n = in.spanSize();
+      std::vector<T> rows(n);
+
+      for (int y = 0; y < out.height; y++) {
+        for (int span = 0; span < in.spanCount(); span++) {
+          const T* first = in.row(y * stride) + in.spanOffset(span);
+          std::copy(first, first + n, rows.begin());
+          for (int ky = 1; ky < window; ky++) {
+            detail::maxInPlace(in.row(y * stride + ky) + in.spanOffset(span), rows.data(), n);
+          }
+
+          // One span holds either one channel, or all of them interleaved
+          int span_channels = in.pixel_stride == 1 ? 1 : in.channels;
+          for (int x = 0; x < out.width; x++) {
+            for (int c = 0; c < span_channels; c++) {
+              T m = rows[x * stride * in.pixel_stride + c];
+              for (int kx = 1; kx < window; kx++) {
+                m = std::max(m, rows[(x * stride + kx) * in.pixel_stride + c]);
+              }
+              out.at(x, y, span_channels == 1 ? span : c) = m;
+            }
+          }
+        }
+      }
+      return;
+    }
+
+    for (int c = 0; c < out.channels; c++) {
+      for (int y = 0; y < out.height; y++) {
+        for (int x = 0; x < out.width; x++) {
+          T m = in.at(x * stride, y * stride, c);
+          for (int ky = 0; ky < window; ky++) {
+            for (int kx = 0; kx < window; kx++) {
+              m = std::max(m, in.at(x * stride + kx, y * stride + ky, c));
+            }
+          }
+          out.at(x, y, c) = m;
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Average pooling of each channel over window x window tiles
+   * The window rows are first summed as floats with SIMD, then each tile is summed horizontally.
+   * Like convolve, the output can be float for an integer input
+   */
+  template<typename T, typename U = T>
+  void avgPool(ImageView<const T> in, ImageView<U> out, int window, int stride) {
+    detail::checkOutput(in, out, window, stride);
+    const float scale = 1.f / (float) (window * window);
+
+    if (in.hasDenseRows()) {
+      int n = in.spanSize();
+      std::vector<float> sums(n);
+
+      for (int y = 0; y < out.height; y++) {
+        for (int span = 0; span < in.spanCount(); span++) {
+          std::fill(sums.begin(), sums.end(), 0.f);
+          for (int ky = 0; ky < window; ky++) {
+            detail::axpy(1.f, in.row(y * stride + ky) + in.spanOffset(span), sums.data(), n);
+          }
+
+          int span_channels = in.pixel_stride == 1 ? 1 : in.channels;
+          for (int x = 0; x < out.width; x++) {
+            for (int c = 0; c < span_channels; c++) {
+              float s = 0.f;
+              for (int kx = 0; kx < window; kx++) {
+                s += sums[(x * stride + kx) * in.pixel_stride + c];
+              }
+              out.at(x, y, span_channels == 1 ? span : c) = detail::fromFloat<U>(s * scale);
+            }
+          }
+        }
+      }
+      return;
+    }
+
+    for (int c = 0; c < out.channels; c++) {
+      for (int y = 0; y < out.height; y++) {
+        for (int x = 0; x < out.width; x++) {
+          float s = 0.f;
+          for (int ky = 0; ky < window; ky++) {
+            for (int kx = 0; kx < window; kx++) {
+              s += (float) in.at(x * stride + kx, y * stride + ky, c);
+            }
+          }
+          out.at(x, y, c) = detail::fromFloat<U>(s * scale);
+        }
+      }
+    }
+  }
+
+}// namespace kernels
@@ -0,0 +1,302 @@
+#include "LazyDataset.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+  constexpr size_t nb_shards = 16;
+
+  /**
+   * @brief Failed loads after which an image is left out for good. A read error may be
+   * transient, a file being replaced or a network share being slow, it is worth a few retries
+   */
+  constexpr uint8_t max_failed_loads = 3;
+
+  /**
+   * @brief One part of the cache, holding the images at positions i % nb_shards == shard
+   */
+  struct Shard {
+    struct Entry {
+      std::shared_ptr<const Image> image;
+      std::list<size_t>::iterator lru_position;
+    };
+
+    std::mutex lock;
+    std::list<size_t> lru;// most recently used first
+    std::unordered_map<size_t, Entry> entries;
+    size_t bytes = 0;
+  };
+
+}// namespace
+
+struct LazyDataset::State {
+  State(std::shared_ptr<const DatasetInfo> info, std::vector<unsigned int> indices,
+        const Options& options)
+      : info(std::move(info)), indices(std::move(indices)), options(options),
+        failed_loads(std::make_unique<std::atomic<uint8_t>[]>(this->indices.size())) {
+    if (options.read_ahead > 0) ahead_thread = std::thread([this] { readAhead(); });
+  }
+
+  ~State() {
+    {
+      std::lock_guard guard(ahead_lock);
+      stop = true;
+    }
+    ahead_cond.notify_one();
+    if (ahead_thread.joinable()) ahead_thread.join();
+  }
+
+  /**
+   * @return The image if it is in the cache, marked as the most recently used
+   */
+  std::shared_ptr<const Image> lookup(size_t i) {
+    Shard& shard = shards[i % nb_shards];
+    std::lock_guard guard(shard.lock);
+
+    auto it = shard.entries.find(i);
+    if (it == shard.entries.end()) return nullptr;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_position);
+    return it->second.image;
+  }
+
+  /**
+   * @brief Decode an image and put it in the cache, evicting the least recently used ones
+   * An image read by two threads at once may be decoded twice, the first one is kept.
+   * Images that failed to load max_failed_loads times are not tried again
+   */
+  std::shared_ptr<const Image> load(size_t i) {
+    if (failed_loads[i].load(std::memory_order_relaxed) >= max_failed_loads) return nullptr;
+
+    std::shared_ptr<const Image> image = decode(i);
+    if (not image) {
+      failed_loads[i].fetch_add(1, std::memory_order_relaxed);
+      failures.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    size_t bytes = image->getByteSize();
+    loaded_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    loaded_images.fetch_add(1, std::memory_order_relaxed);
+
+    Shard& shard = shards[i % nb_shards];
+    std::lock_guard guard(shard.lock);
+
+    auto [it, inserted] = shard.entries.try_emplace(i);
+    if (not inserted) return it->second.image;
+
+    shard.lru.push_front(i);
+    it->second = {image, shard.lru.begin()};
+    shard.bytes += bytes;
+
+    // The images still held by the readers stay alive until they are released
+    size_t shard_budget = options.memory_budget / nb_shards;
+    while (shard.bytes > shard_budget and shard.lru.size() > 1) {
+      auto evicted = shard.entries.find(shard.lru.back());
+      shard.bytes -= evicted->second.image->getByteSize();
+      shard.entries.erase(evicted);
+      shard.lru.pop_back();
+      evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return image;
+  }
+
+  std::shared_ptr<const Image> decode(size_t i) {
+    const ImageInfo& image_info = info->getImagesInfo()[indices[i]];
+    std::optional<Image> image;
+
+    if (info->getArchive()) {
+      // Readers are reused from one load to the next, by whichever thread loads
+      std::unique_ptr<Archive::Reader> reader;
+      {
+        std::lock_guard guard(readers_lock);
+        if (not readers.empty()) {
+          reader = std::move(readers.back());
+          readers.pop_back();
+        }
+      }
+      if (not reader) reader = std::make_unique<Archive::Reader>(*info->getArchive());
+
+      thread_local std::vector<unsigned char> buffer;
+      if (reader->read(image_info.getArchiveEntry(), buffer))
+        image = Image::loadFromMemory(buffer.data(), buffer.size(), 1);
+
+      std::lock_guard guard(readers_lock);
+      readers.emplace_back(std::move(reader));
+    } else {
+      image = Image::load(image_info.getPath(), 1);
+    }
+
+    if (not image) {
+      spdlog::warn("LazyDataset: failed to load image {}", image_info.getPath().string());
+      return nullptr;
+    }
+
+    if (options.width > 0 and options.height > 0) image->resize(options.width, options.height);
+    return std::make_shared<const Image>(std::move(*image));
+  }
+
+  /**
+   * @return The number of images to decode ahead of the reads, so that they take at most half
+   * of the memory budget
+   */
+  size_t readAheadWindow() const {
+    size_t images = loaded_images.load(std::memory_order_relaxed);
+    if (images == 0) return options.read_ahead;
+
+    size_t average = std::max<size_t>(loaded_bytes.load(std::memory_order_relaxed) / images, 1);
+    return std::min(options.read_ahead, options.memory_budget / 2 / average);
+  }
+
+  /**
+   * @brief Body of the read-ahead thread : loads the images between ahead_next and ahead_end in
+   * the order of the reads
+   */
+  void readAhead() {
+    std::unique_lock lock(ahead_lock);
+    while (true) {
+      ahead_cond.wait(lock, [this] { return stop or ahead_next < ahead_end; });
+      if (stop) return;
+
+      size_t i = order[ahead_next++];
+      lock.unlock();
+      if (not lookup(i) and load(i)) read_ahead_count.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+  }
+
+  std::shared_ptr<const DatasetInfo> info;
+  std::vector<unsigned int> indices;
+  Options options;
+
+  std::array<Shard, nb_shards> shards;
+  std::unique_ptr<std::atomic<uint8_t>[]> failed_loads;
+
+  std::atomic<size_t> hits = 0, misses = 0, evictions = 0, failures = 0, read_ahead_count = 0;
+  std::atomic<size_t> loaded_bytes = 0, loaded_images = 0;
+
+  std::mutex readers_lock;
+  std::vector<std::unique_ptr<Archive::Reader>> readers;
+
+  std::mutex ahead_lock;
+  std::condition_variable ahead_cond;
+  std::vector<size_t> order;
+  size_t ahead_next = 0, ahead_end = 0;// positions in order left to read ahead
+  bool stop = false;
+  std::thread ahead_thread;
+};
+
+LazyDataset::LazyDataset() = default;
+
+LazyDataset::LazyDataset(const DatasetInfo& info, std::vector<unsigned int> indices,
+                         const Options& options)
+    : state(std::make_unique<State>(std::make_shared<const DatasetInfo>(info), std::move(indices),
+                                    options)) {}
+
+LazyDataset::LazyDataset(LazyDataset&&) noexcept = default;
+
+LazyDataset& LazyDataset::operator=(LazyDataset&&) noexcept = default;
+
+LazyDataset::~LazyDataset() = default;
+
+std::pair<LazyDataset, LazyDataset> LazyDataset::load_and_split(const DatasetInfo& info,
+                                                                float split_ratio, uint64_t seed,
+                                                                const Options& options,
+                                                                bool enforce_equal_distribution) {
+  std::vector<unsigned int> indices(info.getImagesInfo().size());
+  std::iota(indices.begin(), indices.end(), 0);
+  std::shuffle(indices.begin(), indices.end(), std::mt19937_64{seed});
+
+  auto split_index = (size_t) ((float) indices.size() * split_ratio);
+  std::vector<unsigned int> test(indices.begin(), indices.begin() + split_index);
+  std::vector<unsigned int> train(indices.begin() + split_index, indices.end());
+
+  if (enforce_equal_distribution) {
+    train = balanceLabels(train, info.getLabels().size(), [&info](unsigned int index) {
+      return info.getImagesInfo()[index].getLabelId();
+    });
+  }
+
+  // The budget is shared in proportion of the images, both sets share the DatasetInfo
+  auto shared_info = std::make_shared<const DatasetInfo>(info);
+  size_t total = std::max<size_t>(train.size() + test.size(), 1);
+  Options train_options = options, test_options = options;
+  train_options.memory_budget = options.memory_budget * train.size() / total;
+  test_options.memory_budget = options.memory_budget - train_options.memory_budget;
+
+  LazyDataset train_set, test_set;
+  train_set.state = std::make_unique<State>(shared_info, std::move(train), train_options);
+  test_set.state = std::make_unique<State>(shared_info, std::move(test), test_options);
+
+  return {std::move(train_set), std::move(test_set)};
+}
+
+std::shared_ptr<const Image> LazyDataset::get(size_t i) {
+  if (auto image = state->lookup(i)) {
+    state->hits.fetch_add(1, std::memory_order_relaxed);
+    return image;
+  }
+
+  state->misses.fetch_add(1, std::memory_order_relaxed);
+  return state->load(i);
+}
+
+void LazyDataset::setOrder(std::vector<size_t> order) {
+  std::lock_guard guard(state->ahead_lock);
+  state->order = std::move(order);
+  state->ahead_next = state->ahead_end = 0;
+}
+
+std::shared_ptr<const Image> LazyDataset::getInOrder(size_t position) {
+  size_t i;
+  {
+    std::lock_guard guard(state->ahead_lock);
+    i = state->order.at(position);
+
+    // When the reads catch up with the read-ahead, it skips to the next position
+    state->ahead_next = std::max(state->ahead_next, position + 1);
+    state->ahead_end = std::min(state->order.size(), position + 1 + state->readAheadWindow());
+  }
+  state->ahead_cond.notify_one();
+
+  return get(i);
+}
+
+int LazyDataset::getLabel(size_t i) const {
+  return state->info->getImagesInfo()[state->indices[i]].getLabelId();
+}
+
+int LazyDataset::getImageId(size_t i) const {
+  return state->info->getImagesInfo()[state->indices[i]].getUniqueId();
+}
+
+const std::vector<std::string>& LazyDataset::getLabelsNames() const {
+  return state->info->getLabels();
+}
+
+size_t LazyDataset::getSize() const { return state ? state->indices.size() : 0; }
+
+LazyDataset::Stats LazyDataset::getStats() const {
+  Stats stats;
+  if (not state) return stats;
+
+  stats.hits = state->hits.load(std::memory_order_relaxed);
+  stats.misses = state->misses.load(std::memory_order_relaxed);
+  stats.evictions = state->evictions.load(std::memory_order_relaxed);
+  stats.failures = state->failures.load(std::memory_order_relaxed);
+  stats.read_ahead = state->read_ahead_count.load(std::memory_order_relaxed);
+  for (auto& shard: state->shards) {
+    std::lock_guard guard(shard.lock);
+    stats.bytes += shard.bytes;
+  }
+  return stats;
+}
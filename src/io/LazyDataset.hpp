@@ -0,0 +1,127 @@
+#pragma once
+#include "DatasetInfo.hpp"
+#include "Image.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A dataset whose images are only loaded when they are accessed
+ * Only the ImageInfo of the images are kept, the decoded images go through a cache bounded by a
+ * memory budget, which evicts the least recently used ones. The cache is split in shards, each
+ * with its own lock, so that several threads can read the dataset at once.
+ * When the order of the accesses is known (the shuffle of an epoch), a background thread decodes
+ * the next images ahead of the reads
+ */
+class LazyDataset {
+public:
+  struct Options {
+    /**
+     * @brief Bytes of decoded images kept in the cache
+     */
+    size_t memory_budget = (size_t) 256 << 20;
+
+    /**
+     * @brief Number of images decoded ahead of the reads through getInOrder, 0 to disable
+     * The read-ahead is further bounded to half the memory budget
+     */
+    size_t read_ahead = 64;
+
+    /**
+     * @brief Size the images are resized to when they are loaded, 0 to keep their own size
+     */
+    int width = 0, height = 0;
+  };
+
+  /**
+   * @brief Cumulated counters of the cache
+   */
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t failures = 0;
+    size_t read_ahead = 0;// images decoded by the read-ahead thread
+    size_t bytes = 0;     // bytes currently held by the cache
+  };
+
+  /**
+   * @brief Construct an empty dataset
+   */
+  LazyDataset();
+
+  /**
+   * @brief A dataset over some images of a DatasetInfo. Nothing is loaded yet
+   * @param info The DatasetInfo associated with the dataset, copied
+   * @param indices The indices of the images of the dataset in info.getImagesInfo()
+   */
+  LazyDataset(const DatasetInfo& info, std::vector<unsigned int> indices, const Options& options);
+
+  LazyDataset(LazyDataset&&) noexcept;
+  LazyDataset& operator=(LazyDataset&&) noexcept;
+  ~LazyDataset();
+
+  /**
+   * @brief Shuffle the images of a DatasetInfo and split them into two lazy datasets for training
+   * and testing, the memory budget being shared between them in proportion of their size
+   * @param split_ratio The proportion of the images to use for testing
+   * @param seed The seed of the shuffle, the same seed gives the same split of the same dataset
+   * @param enforce_equal_distribution If true, the training set keeps the same number of images
+   * for each label, see balanceLabels
+   * @return One dataset for training, and one dataset for testing, in this order
+   */
+  static std::pair<LazyDataset, LazyDataset>
+  load_and_split(const DatasetInfo& info, float split_ratio, uint64_t seed,
+                 const Options& options, bool enforce_equal_distribution = false);
+
+  /**
+   * @brief The image at a position of the dataset, loaded if it is not in the cache
+   * The image stays valid as long as it is held, even once evicted
+   * @return nullptr if the image could not be loaded. It is tried again by the next reads, until
+   * it failed 3 times
+   */
+  std::shared_ptr<const Image> get(size_t i);
+
+  /**
+   * @brief Set the order the images will be read in through getInOrder, usually the shuffle of
+   * the epoch. Must not be called while getInOrder is
+   * @param order A permutation of the positions of the dataset
+   */
+  void setOrder(std::vector<size_t> order);
+
+  /**
+   * @brief get(order[position]), which moves the read-ahead to the next positions
+   */
+  std::shared_ptr<const Image> getInOrder(size_t position);
+
+  /**
+   * @return The id of the label of the image at a position of the dataset
+   */
+  [[nodiscard]] int getLabel(size_t i) const;
+
+  /**
+   * @return The unique id of the image at a position of the dataset
+   */
+  [[nodiscard]] int getImageId(size_t i) const;
+
+  /**
+   * @return The name of the labels
+   */
+  [[nodiscard]] const std::vector<std::string>& getLabelsNames() const;
+
+  /**
+   * @return the size of the dataset
+   */
+  [[nodiscard]] size_t getSize() const;
+
+  [[nodiscard]] Stats getStats() const;
+
+private:
+  /**
+   * @brief The cache and the read-ahead thread, which must not move with the dataset
+   */
+  struct State;
+  std::unique_ptr<State> state;
+};
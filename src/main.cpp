@@ -1,17 +1,21 @@
-#include "Dataset.hpp"
 #include "DatasetInfo.hpp"
+#include "DatasetView.hpp"
+#include "LazyDataset.hpp"
+#include "SampleSources.hpp"
+#include <ctime>
 #include <filesystem>
 #include <iostream>
 #include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
 
 // C headers
 
 extern "C" {
 #include "context.h"
-// #include "dataset_manager.h"
 #include "neural_network.h"
+#include "sample_source.h"
 #include "store.h"
-// #include "training.h"
 #include "type.h"
 }
 
@@ -37,12 +41,21 @@ int main(int argc, char* argv[]) {
 
   spdlog::info("Neural network trainer Version TBD");
 
-  if (argc < 2) {
-    spdlog::error("usage {} <config_file> (result_directory)", argv[0]);
+  // --resume continues the training stored in the storage directory of the config
+  bool resume = false;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--resume") resume = true;
+    else
+      args.emplace_back(argv[i]);
+  }
+
+  if (args.empty()) {
+    spdlog::error("usage {} [--resume] <config_file> (result_directory)", argv[0]);
     return 1;
   }
 
-  fs::path config_path(argv[1]);
+  fs::path config_path(args[0]);
 
   if (not fs::exists(config_path)) {
     spdlog::error("config file {} does not exist", config_path.string());
@@ -50,86 +63,118 @@ int main(int argc, char* argv[]) {
   }
 
   fs::path result_path;
-  if (argc > 2) {
-    result_path = argv[2];
+  if (args.size() > 1) {
+    result_path = args[1];
   } else {
     result_path = config_path.parent_path() / "results";
   }
 
   // TODO: Refactor the context into an experiment configuration
   Context context;
-  load_context(&context, config_path.string().c_str());
+  if (load_context(&context, config_path.string().c_str())) {
+    spdlog::error("invalid config {}", config_path.string());
+    return 1;
+  }
   info_context(&context);
-
-  // Placeholder
-  auto dataset_info = DatasetInfo::loadFromPath("../../dataset");
-  auto [training_set, testing_set] = Dataset::load_and_split(*dataset_info, 0.1, true);
-
-  spdlog::info("Training set size: {}", training_set.getSize());
-  spdlog::info("Testing set size: {}", testing_set.getSize());
-
-  exit(1);
-  /*
+  if (resume) spdlog::info("Resuming the training stored in {}", context.storage_dir);
 
   srand(time(NULL));
 
-  // char * train_dirs[] = { "../dataset/train/NonDemented", "../dataset/train/ModerateDemented"};
-  // char * test_dirs[]  = { "../dataset/test/NonDemented" , "../dataset/test/ModerateDemented"};
-
-  FILE* fpTrain = fopen(context.train_dat_path, "w");
-  FILE* fpTest = fopen(context.test_dat_path, "w");
-
-  int num_folder = 2;
-  int max_per_folder = context.max_per_folder;
-
-  // u64 nb_layers = 5;
-  // u64 neurons_per_layers[NB_MAX_LAYER] = {480,200,50,10,1,1};
-
-  // u64 nb_layers = 7;
-  // u64 neurons_per_layers[NB_MAX_LAYER] = {480,64,64,64,64,64,1,1};
-  // u64 epoch_max = 100;
-
-
-  // number of images
-  // for( int i = 0; i < 2; i++ ){
-  //     int num = count_file(trainDirs[i]);
-  //     printf(" file in %s :  %d\n", trainDirs[i],num);
-  // }
-
-  Dataset train_dataset;
-  Dataset test_dataset;
-
-  // TODO la taille du dataset est mise au max theorique d'element et non au nombre reel d'element
-  train_dataset.size = num_folder * max_per_folder;
-  test_dataset.size = num_folder * max_per_folder;
-  train_dataset.images = (mri_image*) malloc(train_dataset.size * sizeof(mri_image));
-  test_dataset.images = (mri_image*) malloc(test_dataset.size * sizeof(mri_image));
-
-  // u64 * random_pattern = malloc( num_folder * max_per_folder * sizeof(u64));
-
-  // fill dataset
-  u64 train_dataset_size =
-          (u64) load_dataset(context.train_dirs, num_folder, &train_dataset, max_per_folder);
-  u64 test_dataset_size =
-          (u64) load_dataset(context.test_dirs, num_folder, &test_dataset, max_per_folder);
-
-  printf("Dataset filled with %llu images\n", train_dataset_size);
-  printf("Test dataset filled with %llu images\n", test_dataset_size);
-
+  // a resumed training appends its epochs to the results of the previous run
+  FILE* fp_train = fopen(context.train_dat_path, resume ? "a" : "w");
+  FILE* fp_test = fopen(context.test_dat_path, resume ? "a" : "w");
+  if (not fp_train or not fp_test) {
+    spdlog::error("cannot open the results files {} and {}", context.train_dat_path,
+                  context.test_dat_path);
+    return 1;
+  }
 
-  //  Initialise The NN
-  Layer** neural_network = init_neural_network(context.topology, context.nn_size);
+  //  Initialise The NN, or restore it with the progress of its training
+  TrainingState state;
+  Layer** neural_network = nullptr;
+  if (resume) {
+    neural_network = load_neural_network(&context, &state);
+    if (not neural_network) {
+      spdlog::error("no model to resume in {}", context.storage_dir);
+      return 1;
+    }
+    spdlog::info("{} epochs already done", state.epoch);
+  } else {
+    neural_network = init_neural_network_from_context(&context);
+    init_training_state(&state);
+  }
+  size_t input_size = neural_network[0]->size;
 
+  // Placeholder
+  auto dataset_info = DatasetInfo::loadFromPath("../../dataset");
+  if (not dataset_info) {
+    spdlog::error("cannot read the dataset");
+    return 1;
+  }
 
-  train(&context, &train_dataset, &test_dataset, neural_network, fpTest, fpTrain);
+  int trained = 0;
+  if (context.memory_mb > 0) {
+    // the images are loaded as the training reaches them, within the memory budget
+    LazyDataset::Options options;
+    options.memory_budget = (size_t) context.memory_mb << 20;
+    options.read_ahead = context.read_ahead;
+    options.width = context.width;
+    options.height = context.height;
+    auto [training_set, testing_set] =
+            LazyDataset::load_and_split(*dataset_info, 0.1, context.split_seed, options, true);
+
+    spdlog::info("Training set size: {}", training_set.getSize());
+    spdlog::info("Testing set size: {}", testing_set.getSize());
+
+    fitCrop(context.pipeline, training_set);
+
+    // the next batches are loaded and preprocessed while the network trains on the current one
+    BatchLoader::Options loader_options;
+    loader_options.input_size = input_size;
+    LoaderSamples training_samples(training_set, context.pipeline, loader_options);
+    LoaderSamples testing_samples(testing_set, context.pipeline, loader_options);
+    SampleSource train_source = training_samples.source();
+    SampleSource test_source = testing_samples.source();
+
+    trained = train_samples(&context, &train_source, &test_source, neural_network, &state,
+                            fp_train, fp_test);
+
+    auto stats = training_samples.getStats();
+    spdlog::info("Training batches: {} samples, {} left out, {} ms waiting for the loader",
+                 stats.samples, stats.failures,
+                 std::chrono::duration_cast<std::chrono::milliseconds>(stats.consumer_stall)
+                         .count());
+  } else {
+    // the images are loaded once, and cached with the results for the later runs to map them.
+    // Both sets are views over them
+    auto [training_set, testing_set] =
+            DatasetView::load_and_split(*dataset_info, 0.1, context.split_seed, true,
+                                        result_path / "cache");
+
+    spdlog::info("Training set size: {}", training_set.getSize());
+    spdlog::info("Testing set size: {}", testing_set.getSize());
+
+    fitCrop(context.pipeline, training_set);
+    ViewSamples training_samples(training_set, context.pipeline, input_size);
+    ViewSamples testing_samples(testing_set, context.pipeline, input_size);
+    if (training_samples.getFailures() + testing_samples.getFailures() > 0) {
+      spdlog::warn("{} images do not match the inputs of the network, they are left out",
+                   training_samples.getFailures() + testing_samples.getFailures());
+    }
+    SampleSource train_source = training_samples.source();
+    SampleSource test_source = testing_samples.source();
+
+    trained = train_samples(&context, &train_source, &test_source, neural_network, &state,
+                            fp_train, fp_test);
+  }
 
-  fclose(fpTrain);
-  fclose(fpTest);
-  store_neural_network(&context, neural_network);
+  fclose(fp_train);
+  fclose(fp_test);
+  if (trained) store_neural_network(&context, neural_network, &state);
 
+  free_training_state(&state);
   free_neural_network(neural_network, context.nn_size);
-  free_dataset(&train_dataset);
-  free_dataset(&test_dataset);
   free_context(&context);
-   */
+
+  return trained ? 0 : 1;
 }
@@ -45,6 +45,8 @@ int main(int argc, char* argv[]) {
   u64 counter = (u64) load_dataset(dirs, num_folder, dataset, max_per_folder);
 
   printf("dataset filled : %llu\n", counter);
+  for (u64 i = 0; i < counter; i++) { random_pattern[i] = i; }
+  u64 rng = (u64) time(NULL);
 
 
   //  Initialise The NN
@@ -60,7 +62,7 @@ int main(int argc, char* argv[]) {
     f64 err = 0.0f;
 
     // randomize dataset
-    shuffle(counter, random_pattern);
+    shuffle(counter, random_pattern, &rng);
 
     //
     for (u64 np = 0; np < counter; np++) {
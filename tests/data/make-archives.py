@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Writes the archives read by test-archive, in the directory of this script.
+
+Every archive holds the same files, see test-archive.cpp:
+  images/a/0.bin   the bytes 0 to 255, stored
+  images/b/1.bin   "brain " 100 times, deflated
+The tar has a third file whose path is too long for a tar header, it goes in a pax record.
+The hostile zips are valid zips whose central directory lies about the sizes, the hostile tar
+has valid headers but a malformed pax record.
+"""
+import io
+import os
+import struct
+import tarfile
+import zipfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+STORED = bytes(range(256))
+DEFLATED = b"brain " * 100
+LONG_NAME = "images/" + "long" * 30 + "/2.bin"
+
+
+def make_zip():
+    buffer = io.BytesIO()
+    with zipfile.ZipFile(buffer, "w") as archive:
+        for name, data, method in [("images/a/0.bin", STORED, zipfile.ZIP_STORED),
+                                   ("images/b/1.bin", DEFLATED, zipfile.ZIP_DEFLATED)]:
+            info = zipfile.ZipInfo(name, date_time=(2024, 1, 1, 0, 0, 0))
+            info.compress_type = method
+            archive.writestr(info, data)
+    return bytearray(buffer.getvalue())
+
+
+def make_zip64():
+    # zipfile only writes the zip64 records past its limits, which are lowered for the sizes,
+    # the offsets and the number of entries to all go through them
+    limits = zipfile.ZIP64_LIMIT, zipfile.ZIP_FILECOUNT_LIMIT
+    zipfile.ZIP64_LIMIT, zipfile.ZIP_FILECOUNT_LIMIT = 0, 0
+    try:
+        data = make_zip()
+    finally:
+        zipfile.ZIP64_LIMIT, zipfile.ZIP_FILECOUNT_LIMIT = limits
+
+    # zipfile still writes the values in the end of central directory record when they fit,
+    # the readers must take them from the zip64 record when they are set to their maximum
+    end = len(data) - 22
+    struct.pack_into("<HHII", data, end + 8, 0xffff, 0xffff, 0xffffffff, 0xffffffff)
+    return data
+
+
+def central_header(data, name):
+    """Offset of the central directory header of a file"""
+    return next(i for i in range(len(data))
+                if data.startswith(b"PK\x01\x02", i) and data[i + 46:i + 46 + len(name)] == name.encode())
+
+
+def patch_sizes(data, name, compressed_size=None, size=None):
+    header = central_header(data, name)
+    if compressed_size is not None: struct.pack_into("<I", data, header + 20, compressed_size)
+    if size is not None: struct.pack_into("<I", data, header + 24, size)
+    return data
+
+
+def patch_zip64_size(data, name, size):
+    # the zip64 extra field follows the name : id, length, then the size and the compressed size
+    header = central_header(data, name)
+    extra = header + 46 + len(name)
+    assert struct.unpack_from("<H", data, extra)[0] == 1
+    struct.pack_into("<Q", data, extra + 4, size)
+    return data
+
+
+def make_tar():
+    buffer = io.BytesIO()
+    with tarfile.open(fileobj=buffer, mode="w", format=tarfile.PAX_FORMAT) as archive:
+        for name, data in [("images/a/0.bin", STORED), ("images/b/1.bin", DEFLATED),
+                           (LONG_NAME, STORED)]:
+            info = tarfile.TarInfo(name)
+            info.size = len(data)
+            info.mtime = 0
+            archive.addfile(info, io.BytesIO(data))
+    return buffer.getvalue()
+
+
+def make_hostile_tar(records):
+    # tarfile writes the pax header as given when the archive itself is not a pax one
+    buffer = io.BytesIO()
+    with tarfile.open(fileobj=buffer, mode="w", format=tarfile.USTAR_FORMAT) as archive:
+        info = tarfile.TarInfo("pax")
+        info.type = tarfile.XHDTYPE
+        info.size = len(records)
+        archive.addfile(info, io.BytesIO(records))
+        info = tarfile.TarInfo("images/a/0.bin")
+        info.size = len(STORED)
+        archive.addfile(info, io.BytesIO(STORED))
+    return buffer.getvalue()
+
+
+archives = {
+    "images.zip": make_zip(),
+    "images64.zip": make_zip64(),
+    "images-pax.tar": make_tar(),
+    # inflates far past the deflate ratio
+    "hostile-ratio.zip": patch_sizes(make_zip(), "images/b/1.bin", size=0xfffffff0),
+    # compressed content past the end of the file
+    "hostile-end.zip": patch_sizes(make_zip(), "images/a/0.bin", compressed_size=0x10000000),
+    # a stored entry whose size is not its compressed size
+    "hostile-stored.zip": patch_sizes(make_zip(), "images/a/0.bin", size=0x7fffffff),
+    # a zip64 size of 2^62 bytes
+    "hostile-zip64.zip": patch_zip64_size(make_zip64(), "images/b/1.bin", 1 << 62),
+    # a pax record too short to hold its own length, its space and its newline
+    "hostile-pax.tar": make_hostile_tar(b"1\n"),
+}
+for name, data in archives.items():
+    with open(os.path.join(HERE, name), "wb") as file:
+        file.write(data)
@@ -0,0 +1,25 @@
+#include "dataset-fixture.hpp"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "stb_image_write.h"
+
+namespace fs = std::filesystem;
+
+fs::path writeDataset(const char* name, int nb_images, int side) {
+  std::string dir = std::string(name) + "-XXXXXX";
+  if (mkdtemp(dir.data()) == nullptr) return {};
+
+  fs::path root = fs::absolute(dir);
+  fs::create_directory(root / "a");
+  fs::create_directory(root / "b");
+
+  for (int k = 0; k < nb_images; k++) {
+    std::vector<unsigned char> pixels(side * side, (unsigned char) k);
+    fs::path path = root / (k % 2 ? "b" : "a") / (std::to_string(k) + ".png");
+    stbi_write_png(path.c_str(), side, side, 1, pixels.data(), side);
+  }
+  return root;
+}
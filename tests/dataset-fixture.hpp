@@ -0,0 +1,16 @@
+#pragma once
+#include <filesystem>
+
+// Datasets of small images written on disk for the tests of the io library.
+// Image k of a dataset is the square gray image whose every pixel is k, named k.png, in the
+// directory a of the label a when k is even and in b otherwise : its pixels tell which image
+// it is, wherever the dataset moved it
+
+/**
+ * @brief Write a dataset in a new temporary directory of the working directory
+ * @param name The prefix of the directory
+ * @param nb_images The number of images, at most 256
+ * @param side The width and height of the images
+ * @return The absolute path of the directory, empty if it could not be created
+ */
+std::filesystem::path writeDataset(const char* name, int nb_images, int side);
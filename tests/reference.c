@@ -0,0 +1,209 @@
+#include "reference.h"
+
+#include <math.h>
+
+static f64 ref_sigmoid(f64 x) { return 1 / (1 + exp(-x)); }
+
+static f64 ref_d_sigmoid(f64 x) { return x * (1 - x); }
+
+/*  Convolution, one output pixel at a time (the original convolution_5X5 loop) */
+void ref_convolution(const u8* image, u8* output, size_t height, size_t width,
+                     const u8* kernel_filter, size_t kernel_size, u32 divisor, int stride,
+                     int dilation) {
+  size_t span = (kernel_size - 1) * dilation + 1;
+  size_t out_height = (height - span) / stride + 1;
+  size_t out_width = (width - span) / stride + 1;
+
+  for (u64 i = 0; i < out_height; i++) {
+    for (u64 j = 0; j < out_width; j++) {
+
+      u64 s = 0;
+      for (size_t ik = 0; ik < kernel_size; ik++) {
+        for (size_t jk = 0; jk < kernel_size; jk++) {
+          u64 filter_idx = ik * kernel_size + jk;
+          u64 image_idx = (i * stride + ik * dilation) * width + (j * stride + jk * dilation);
+          s += image[image_idx] * kernel_filter[filter_idx];
+        }
+      }
+
+      output[i * out_width + j] = (u8) (s / divisor);
+    }
+  }
+}
+
+/*  Maxpool, one tile at a time */
+void ref_max_pool(const u8* image, u8* output, size_t height, size_t width, size_t window,
+                  size_t stride) {
+  size_t out_height = (height - window) / stride + 1;
+  size_t out_width = (width - window) / stride + 1;
+
+  for (u64 i = 0; i < out_height; i++) {
+    for (u64 j = 0; j < out_width; j++) {
+
+      u8 max = 0;
+      for (u64 ik = 0; ik < window; ik++) {
+        for (u64 jk = 0; jk < window; jk++) {
+          u8 val = image[(i * stride + ik) * width + (j * stride + jk)];
+          if (val > max) max = val;
+        }
+      }
+
+      output[i * out_width + j] = max;
+    }
+  }
+}
+
+/*  Avgpool, one tile at a time */
+void ref_avg_pool(const u8* image, u8* output, size_t height, size_t width, size_t window,
+                  size_t stride) {
+  size_t out_height = (height - window) / stride + 1;
+  size_t out_width = (width - window) / stride + 1;
+
+  for (u64 i = 0; i < out_height; i++) {
+    for (u64 j = 0; j < out_width; j++) {
+
+      u64 sum = 0;
+      for (u64 ik = 0; ik < window; ik++) {
+        for (u64 jk = 0; jk < window; jk++) {
+          sum += image[(i * stride + ik) * width + (j * stride + jk)];
+        }
+      }
+
+      output[i * out_width + j] = (u8) (sum / (window * window));
+    }
+  }
+}
+
+/*  Dense forward pass, one neuron of the next layer at a time */
+void ref_compute_layer(const f64* weights, const f64* bias, const f64* neurons, u64 size,
+                       f64* next_neurons, u64 next_size) {
+  for (u64 j = 0; j < next_size; j++) {
+    f64 s = bias[j];
+    for (u64 i = 0; i < size; i++) { s += weights[j * size + i] * neurons[i]; }
+    next_neurons[j] = ref_sigmoid(s);
+  }
+}
+
+/*  Dense error deltas, one neuron at a time */
+void ref_compute_delta(const f64* weights, const f64* neurons, u64 size,
+                       const f64* next_delta_neurons, u64 next_size, f64* delta_neurons) {
+  for (u64 i = 0; i < size; i++) {
+    f64 s = 0.0;
+    for (u64 j = 0; j < next_size; j++) { s += weights[j * size + i] * next_delta_neurons[j]; }
+    delta_neurons[i] = s * ref_d_sigmoid(neurons[i]);
+  }
+}
+
+/*  Dense weights update, with momentum */
+void ref_backpropagate(f64* weights, f64* bias, f64* delta_weights, f64* delta_bias,
+                       const f64* neurons, u64 size, const f64* next_delta_neurons,
+                       u64 next_size, f64 eta_, f64 alpha_) {
+  for (u64 j = 0; j < next_size; j++) {
+    delta_bias[j] = eta_ * next_delta_neurons[j] + alpha_ * delta_bias[j];
+    bias[j] += delta_bias[j];
+    for (u64 i = 0; i < size; i++) {
+      delta_weights[j * size + i] =
+              eta_ * neurons[i] * next_delta_neurons[j] + alpha_ * delta_weights[j * size + i];
+      weights[j * size + i] += delta_weights[j * size + i];
+    }
+  }
+}
+
+/*  Convolution layer forward pass, one output neuron at a time */
+void ref_compute_conv_layer(const f64* weights, const f64* bias, const f64* neurons,
+                            u64 channels, u64 height, u64 width, u64 filters, u64 kernel,
+                            u64 stride, f64* next_neurons) {
+  u64 out_height = (height - kernel) / stride + 1;
+  u64 out_width = (width - kernel) / stride + 1;
+
+  for (u64 f = 0; f < filters; f++) {
+    for (u64 oy = 0; oy < out_height; oy++) {
+      for (u64 ox = 0; ox < out_width; ox++) {
+
+        f64 s = bias[f];
+        for (u64 c = 0; c < channels; c++) {
+          for (u64 ki = 0; ki < kernel; ki++) {
+            for (u64 kj = 0; kj < kernel; kj++) {
+              f64 w = weights[((f * channels + c) * kernel + ki) * kernel + kj];
+              s += w * neurons[(c * height + oy * stride + ki) * width + ox * stride + kj];
+            }
+          }
+        }
+
+        next_neurons[(f * out_height + oy) * out_width + ox] = ref_sigmoid(s);
+      }
+    }
+  }
+}
+
+/*  Convolution layer error deltas, gathered for each input neuron from the outputs
+    whose window covers it */
+void ref_compute_conv_delta(const f64* weights, const f64* neurons, u64 channels, u64 height,
+                            u64 width, u64 filters, u64 kernel, u64 stride,
+                            const f64* next_delta_neurons, f64* delta_neurons) {
+  u64 out_height = (height - kernel) / stride + 1;
+  u64 out_width = (width - kernel) / stride + 1;
+
+  for (u64 c = 0; c < channels; c++) {
+    for (u64 y = 0; y < height; y++) {
+      for (u64 x = 0; x < width; x++) {
+
+        f64 s = 0.0;
+        for (u64 f = 0; f < filters; f++) {
+          for (u64 ki = 0; ki < kernel && ki <= y; ki++) {
+            for (u64 kj = 0; kj < kernel && kj <= x; kj++) {
+              u64 oy = y - ki;
+              u64 ox = x - kj;
+              if (oy % stride || ox % stride) continue;
+              oy /= stride;
+              ox /= stride;
+              if (oy >= out_height || ox >= out_width) continue;
+
+              f64 w = weights[((f * channels + c) * kernel + ki) * kernel + kj];
+              s += w * next_delta_neurons[(f * out_height + oy) * out_width + ox];
+            }
+          }
+        }
+
+        u64 i = (c * height + y) * width + x;
+        delta_neurons[i] = s * ref_d_sigmoid(neurons[i]);
+      }
+    }
+  }
+}
+
+/*  Convolution layer filters update, with momentum */
+void ref_backpropagate_conv(f64* weights, f64* bias, f64* delta_weights, f64* delta_bias,
+                            const f64* neurons, u64 channels, u64 height, u64 width, u64 filters,
+                            u64 kernel, u64 stride, const f64* next_delta_neurons, f64 eta_,
+                            f64 alpha_) {
+  u64 out_height = (height - kernel) / stride + 1;
+  u64 out_width = (width - kernel) / stride + 1;
+  u64 pixels = out_height * out_width;
+
+  for (u64 f = 0; f < filters; f++) {
+    for (u64 c = 0; c < channels; c++) {
+      for (u64 ki = 0; ki < kernel; ki++) {
+        for (u64 kj = 0; kj < kernel; kj++) {
+
+          f64 s = 0.0;
+          for (u64 oy = 0; oy < out_height; oy++) {
+            for (u64 ox = 0; ox < out_width; ox++) {
+              f64 x = neurons[(c * height + oy * stride + ki) * width + ox * stride + kj];
+              s += x * next_delta_neurons[(f * out_height + oy) * out_width + ox];
+            }
+          }
+
+          u64 w = ((f * channels + c) * kernel + ki) * kernel + kj;
+          delta_weights[w] = eta_ * s + alpha_ * delta_weights[w];
+          weights[w] += delta_weights[w];
+        }
+      }
+    }
+
+    f64 s = 0.0;
+    for (u64 p = 0; p < pixels; p++) { s += next_delta_neurons[f * pixels + p]; }
+    delta_bias[f] = eta_ * s + alpha_ * delta_bias[f];
+    bias[f] += delta_bias[f];
+  }
+}
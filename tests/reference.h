@@ -0,0 +1,42 @@
+#pragma once
+#include <stdlib.h>
+
+#include "../src/type.h"
+
+// Golden references of the differential tests.
+// Plain scalar versions of the kernels, written like the original per pixel loops so that
+// any optimized rewrite (SIMD, batched, tiled, gemm, Winograd, FFT) can be checked against them.
+// Images are row-major u8, outputs are packed and "valid" (no padding)
+
+// out_height x out_width convolution, each output is (sum of weights * pixels) / divisor
+void ref_convolution(const u8* image, u8* output, size_t height, size_t width,
+                     const u8* kernel_filter, size_t kernel_size, u32 divisor, int stride,
+                     int dilation);
+
+// window x window tiles every stride pixels, the average is rounded down
+void ref_max_pool(const u8* image, u8* output, size_t height, size_t width, size_t window,
+                  size_t stride);
+void ref_avg_pool(const u8* image, u8* output, size_t height, size_t width, size_t window,
+                  size_t stride);
+
+// dense layers, weights are next_size x size
+void ref_compute_layer(const f64* weights, const f64* bias, const f64* neurons, u64 size,
+                       f64* next_neurons, u64 next_size);
+void ref_compute_delta(const f64* weights, const f64* neurons, u64 size,
+                       const f64* next_delta_neurons, u64 next_size, f64* delta_neurons);
+void ref_backpropagate(f64* weights, f64* bias, f64* delta_weights, f64* delta_bias,
+                       const f64* neurons, u64 size, const f64* next_delta_neurons,
+                       u64 next_size, f64 eta_, f64 alpha_);
+
+// convolution layers, channels x height x width inputs, weights are
+// filters x channels x kernel x kernel
+void ref_compute_conv_layer(const f64* weights, const f64* bias, const f64* neurons,
+                            u64 channels, u64 height, u64 width, u64 filters, u64 kernel,
+                            u64 stride, f64* next_neurons);
+void ref_compute_conv_delta(const f64* weights, const f64* neurons, u64 channels, u64 height,
+                            u64 width, u64 filters, u64 kernel, u64 stride,
+                            const f64* next_delta_neurons, f64* delta_neurons);
+void ref_backpropagate_conv(f64* weights, f64* bias, f64* delta_weights, f64* delta_bias,
+                            const f64* neurons, u64 channels, u64 height, u64 width, u64 filters,
+                            u64 kernel, u64 stride, const f64* next_delta_neurons, f64 eta_,
+                            f64 alpha_);
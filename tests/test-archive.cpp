@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "Archive.hpp"
+
+// cmocka comes last : its fail() macro would replace std::ios::fail in the C++ headers
+extern "C" {
+#include <cmocka.h>
+}
+
+// Tests of the archive readers on the fixtures of data/, written by data/make-archives.py.
+// Every archive holds a stored file and a deflated one, the tar holds a third file whose path
+// only fits in a pax record
+
+static const std::string long_name = [] {
+  std::string name = "images/";
+  for (int i = 0; i < 30; i++) name += "long";
+  return name + "/2.bin";
+}();
+
+static std::vector<unsigned char> stored_content() {
+  std::vector<unsigned char> content(256);
+  for (size_t i = 0; i < content.size(); i++) content[i] = (unsigned char) i;
+  return content;
+}
+
+static std::vector<unsigned char> deflated_content() {
+  std::vector<unsigned char> content;
+  for (int i = 0; i < 100; i++) content.insert(content.end(), {'b', 'r', 'a', 'i', 'n', ' '});
+  return content;
+}
+
+static std::string fixture(const char* name) { return std::string(ARCHIVES_DIR "/") + name; }
+
+/**
+ * @brief Read the entry of an archive named name, and check its content
+ */
+static void assert_entry(const Archive& archive, const std::string& name,
+                         const std::vector<unsigned char>& content) {
+  const auto& entries = archive.getEntries();
+  auto it = std::find_if(entries.begin(), entries.end(),
+                         [&name](const Archive::Entry& entry) { return entry.name == name; });
+  assert_true(it != entries.end());
+  assert_int_equal(it->size, content.size());
+
+  Archive::Reader reader(archive);
+  std::vector<unsigned char> buffer;
+  assert_true(reader.read(it - entries.begin(), buffer));
+  assert_true(buffer == content);
+}
+
+/*  A zip with a stored and a deflated file */
+static void test_zip(void**) {
+  auto archive = Archive::open(fixture("images.zip"));
+  assert_true(archive.has_value());
+  assert_int_equal(archive->getEntries().size(), 2);
+
+  assert_true(archive->getEntries()[0].method == Archive::Method::Stored);
+  assert_true(archive->getEntries()[1].method == Archive::Method::Deflate);
+  assert_entry(*archive, "images/a/0.bin", stored_content());
+  assert_entry(*archive, "images/b/1.bin", deflated_content());
+}
+
+/*  The same zip, the sizes, offsets and directory found through the zip64 records */
+static void test_zip64(void**) {
+  auto archive = Archive::open(fixture("images64.zip"));
+  assert_true(archive.has_value());
+  assert_int_equal(archive->getEntries().size(), 2);
+
+  assert_entry(*archive, "images/a/0.bin", stored_content());
+  assert_entry(*archive, "images/b/1.bin", deflated_content());
+}
+
+/*  A pax tar, one path given by a pax record */
+static void test_pax(void**) {
+  auto archive = Archive::open(fixture("images-pax.tar"));
+  assert_true(archive.has_value());
+  assert_int_equal(archive->getEntries().size(), 3);
+
+  assert_entry(*archive, "images/a/0.bin", stored_content());
+  assert_entry(*archive, "images/b/1.bin", deflated_content());
+  assert_entry(*archive, long_name, stored_content());
+}
+
+/*  Zips whose central directory gives sizes the content can not have, a tar whose pax record
+    can not hold its own length */
+static void test_hostile_sizes(void**) {
+  for (const char* name: {"hostile-ratio.zip", "hostile-end.zip", "hostile-stored.zip",
+                          "hostile-zip64.zip", "hostile-pax.tar"}) {
+    assert_false(Archive::open(fixture(name)).has_value());
+  }
+}
+
+int main() {
+  const struct CMUnitTest archive_tests[] = {
+          cmocka_unit_test(test_zip),
+          cmocka_unit_test(test_zip64),
+          cmocka_unit_test(test_pax),
+          cmocka_unit_test(test_hostile_sizes),
+  };
+
+  return cmocka_run_group_tests_name("archive", archive_tests, NULL, NULL);
+}
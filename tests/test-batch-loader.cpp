@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BatchLoader.hpp"
+#include "DatasetInfo.hpp"
+#include "LazyDataset.hpp"
+#include "dataset-fixture.hpp"
+
+// cmocka comes last : its fail() macro would replace std::ios::fail in the C++ headers
+extern "C" {
+#include <cmocka.h>
+}
+
+// Tests of the BatchLoader on a small dataset of 4x4 images written in a temporary directory
+// (see dataset-fixture.hpp).
+// Every pixel of image k is k : the inputs of a sample, k / 255, tell which image they come from
+
+#define NB_IMAGES 45
+#define SIDE 4
+#define INPUT_SIZE (SIDE * SIDE)
+
+namespace fs = std::filesystem;
+
+struct Fixture {
+  fs::path dir;
+  LazyDataset dataset;
+  std::vector<int> codes;// the pixels of each image of the dataset, -1 for the broken one
+};
+
+static int create_dataset(void** state) {
+  fs::path dir = writeDataset("batch-loader", NB_IMAGES, SIDE);
+  if (dir.empty()) return -1;
+
+  auto* fixture = new Fixture;
+  fixture->dir = dir;
+
+  // an image that does not decode, left out of its batch
+  FILE* broken = fopen((fixture->dir / "b" / "broken.png").c_str(), "w");
+  fputs("not a png", broken);
+  fclose(broken);
+
+  auto info = DatasetInfo::loadFromPath(fixture->dir);
+  std::vector<unsigned int> indices(info->getImagesInfo().size());
+  std::iota(indices.begin(), indices.end(), 0);
+  fixture->dataset = LazyDataset(*info, std::move(indices), LazyDataset::Options());
+
+  for (size_t i = 0; i < fixture->dataset.getSize(); i++) {
+    auto image = fixture->dataset.get(i);
+    fixture->codes.push_back(image ? image->data<unsigned char>()[0] : -1);
+  }
+
+  *state = fixture;
+  return 0;
+}
+
+static int remove_dataset(void** state) {
+  auto* fixture = static_cast<Fixture*>(*state);
+  fs::remove_all(fixture->dir);
+  delete fixture;
+  return 0;
+}
+
+static std::vector<size_t> shuffled_order(size_t size, unsigned seed) {
+  std::vector<size_t> order(size);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(seed));
+  return order;
+}
+
+/**
+ * @brief Read the batches of the epoch, checking every sample against the image it comes from
+ * @param max_batches Stop after that many batches, the epoch is then left unfinished
+ * @return The positions of the samples read
+ */
+static std::vector<size_t> read_epoch(BatchLoader& loader, const Fixture& fixture,
+                                      size_t max_batches = SIZE_MAX) {
+  std::vector<size_t> read;
+  const Batch* batch;
+  for (size_t b = 0; b < max_batches and (batch = loader.next()); b++) {
+    assert_int_equal(batch->inputs.size(), batch->size() * INPUT_SIZE);
+    assert_int_equal(batch->positions.size(), batch->size());
+
+    for (size_t k = 0; k < batch->size(); k++) {
+      size_t position = batch->positions[k];
+      assert_int_equal(batch->labels[k], fixture.dataset.getLabel(position));
+      for (size_t j = 0; j < INPUT_SIZE; j++) {
+        float input = batch->inputs[k * INPUT_SIZE + j];
+        assert_int_equal(std::lround(input * 255), fixture.codes[position]);
+      }
+      read.push_back(position);
+    }
+  }
+  return read;
+}
+
+/**
+ * @return The positions of the order whose image loads, in order
+ */
+static std::vector<size_t> loaded(const std::vector<size_t>& order, const Fixture& fixture) {
+  std::vector<size_t> res;
+  for (size_t position: order) {
+    if (fixture.codes[position] >= 0) res.push_back(position);
+  }
+  return res;
+}
+
+/*  Every batch comes in the order of the epoch, whatever the number of producers */
+static void test_epoch_order(void** state) {
+  auto& fixture = *static_cast<Fixture*>(*state);
+
+  for (size_t nb_threads = 1; nb_threads <= 4; nb_threads++) {
+    BatchLoader::Options options;
+    options.batch_size = 4;
+    options.nb_threads = nb_threads;
+    options.capacity = 2;
+    options.input_size = INPUT_SIZE;
+    BatchLoader loader(fixture.dataset, options);
+
+    for (unsigned epoch = 0; epoch < 3; epoch++) {
+      std::vector<size_t> order = shuffled_order(fixture.dataset.getSize(), epoch);
+      loader.startEpoch(order);
+
+      std::vector<size_t> read = read_epoch(loader, fixture);
+      assert_true(read == loaded(order, fixture));
+
+      // the end of the epoch is sticky
+      assert_null(loader.next());
+      assert_null(loader.next());
+    }
+
+    auto stats = loader.getStats();
+    assert_int_equal(stats.failures, 3);
+    assert_int_equal(stats.samples, 3 * (fixture.dataset.getSize() - 1));
+  }
+}
+
+/*  An epoch stopped in its middle by the next one, or by the destruction of the loader */
+static void test_stop_mid_epoch(void** state) {
+  auto& fixture = *static_cast<Fixture*>(*state);
+
+  BatchLoader::Options options;
+  options.batch_size = 3;
+  options.nb_threads = 3;
+  options.capacity = 3;
+  options.input_size = INPUT_SIZE;
+
+  {
+    BatchLoader loader(fixture.dataset, options);
+    for (size_t stop = 0; stop < 5; stop++) {
+      std::vector<size_t> order = shuffled_order(fixture.dataset.getSize(), stop);
+      loader.startEpoch(order);
+
+      std::vector<size_t> read = read_epoch(loader, fixture, stop);
+      std::vector<size_t> expected = loaded({order.begin(), order.begin() + 3 * stop}, fixture);
+      assert_true(read == expected);
+    }
+
+    // the next epoch starts from its first batch
+    std::vector<size_t> order = shuffled_order(fixture.dataset.getSize(), 42);
+    loader.startEpoch(order);
+    assert_true(read_epoch(loader, fixture) == loaded(order, fixture));
+  }
+
+  // destroyed while the producers wait for a free slot
+  BatchLoader loader(fixture.dataset, options);
+  loader.startEpoch(shuffled_order(fixture.dataset.getSize(), 7));
+  read_epoch(loader, fixture, 1);
+}
+
+/*  The samples the preprocessing rejects are left out of their batch, an empty batch is skipped */
+static void test_preprocess(void** state) {
+  auto& fixture = *static_cast<Fixture*>(*state);
+
+  BatchLoader::Options options;
+  options.batch_size = 2;
+  options.nb_threads = 2;
+  options.input_size = INPUT_SIZE;
+
+  // keeps the images of a multiple of 5
+  BatchLoader loader(fixture.dataset, options, [](const Image& image, float* inputs) {
+    if (image.data<unsigned char>()[0] % 5 != 0) return false;
+    image.toFloat(inputs);
+    return true;
+  });
+
+  std::vector<size_t> order = shuffled_order(fixture.dataset.getSize(), 3);
+  loader.startEpoch(order);
+  std::vector<size_t> read = read_epoch(loader, fixture);
+
+  std::vector<size_t> expected;
+  for (size_t position: loaded(order, fixture)) {
+    if (fixture.codes[position] % 5 == 0) expected.push_back(position);
+  }
+  assert_true(read == expected);
+  assert_int_equal(loader.getStats().failures, fixture.dataset.getSize() - expected.size());
+}
+
+int main() {
+  const struct CMUnitTest batch_loader_tests[] = {
+          cmocka_unit_test_setup_teardown(test_epoch_order, create_dataset, remove_dataset),
+          cmocka_unit_test_setup_teardown(test_stop_mid_epoch, create_dataset, remove_dataset),
+          cmocka_unit_test_setup_teardown(test_preprocess, create_dataset, remove_dataset),
+  };
+
+  return cmocka_run_group_tests_name("batch loader", batch_loader_tests, NULL, NULL);
+}
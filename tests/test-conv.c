@@ -5,7 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#include "image_processing.h"
+#include "convolution_layer.h"
 
 static void test_convolutions(void** state) {
 
@@ -20,23 +20,53 @@ static void test_convolutions(void** state) {
                                      0, 0, 0, 2, 0, 2, 0, 2, 0, 0, 0, 2};
 
 
-  unsigned char* res = malloc(sizeof(unsigned char));
+  unsigned char* image = malloc(25 * sizeof(unsigned char));
+  unsigned char* buffer = malloc(25 * sizeof(unsigned char));
+  size_t height = 5, width = 5;
 
   // check with the kernel_five_1
-  convolution_5X5(img, 5, 5, kernel_five_1, 1, res);
-  assert_int_equal(2, res[0]);
+  memcpy(image, img, 25);
+  convolution_5X5(&image, &buffer, &height, &width, kernel_five_1, 1);
+  assert_int_equal(1, height);
+  assert_int_equal(1, width);
+  assert_int_equal(2, image[0]);
 
   // check with the kernel_five_2
-  convolution_5X5(img, 5, 5, kernel_five_2, 1, res);
-  assert_int_equal(4, res[0]);
+  height = 5, width = 5;
+  memcpy(image, img, 25);
+  convolution_5X5(&image, &buffer, &height, &width, kernel_five_2, 1);
+  assert_int_equal(4, image[0]);
 
-  free(res);
+  free(image);
+  free(buffer);
+}
+
+static void test_max_pool(void** state) {
+
+  unsigned char img[16] = {1, 7, 0, 0, 3, 2, 0, 9, 4, 4, 5, 6, 4, 4, 8, 7};
+
+  unsigned char* image = malloc(16 * sizeof(unsigned char));
+  unsigned char* buffer = malloc(16 * sizeof(unsigned char));
+  size_t height = 4, width = 4;
+
+  memcpy(image, img, 16);
+  max_pool_2X2(&image, &buffer, &height, &width);
+  assert_int_equal(2, height);
+  assert_int_equal(2, width);
+  assert_int_equal(7, image[0]);
+  assert_int_equal(9, image[1]);
+  assert_int_equal(4, image[2]);
+  assert_int_equal(8, image[3]);
+
+  free(image);
+  free(buffer);
 }
 
 int main(void) {
   int result = 0;
   const struct CMUnitTest tests[] = {
           cmocka_unit_test(test_convolutions),
+          cmocka_unit_test(test_max_pool),
   };
   result |= cmocka_run_group_tests_name("convolution", tests, NULL, NULL);
 
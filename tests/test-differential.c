@@ -0,0 +1,551 @@
+#include <cmocka.h>
+#include <float.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../src/type.h"
+#include "conv_layer.h"
+#include "neural_network.h"
+#include "pipeline.h"
+#include "reference.h"
+
+// Differential tests : the optimized kernels are run on random sizes, strides and values and
+// compared to the scalar references of reference.c.
+// Integer image filters must match bit for bit. Floating point layers sum in a different order,
+// they must stay within a few ulps per term of the magnitude of the sums they compute
+
+#define SEED 1234
+#define RUNS 100
+
+static u64 random_in(u64 min, u64 max) { return min + (u64) rand() % (max - min + 1); }
+
+static f64 random_f64(f64 min, f64 max) { return min + (max - min) * rand() / (f64) RAND_MAX; }
+
+static u8* random_image(size_t size) {
+  u8* image = malloc(size);
+  for (size_t i = 0; i < size; i++) image[i] = (u8) rand();
+  return image;
+}
+
+static void fill_f64(f64* values, u64 size, f64 min, f64 max) {
+  for (u64 i = 0; i < size; i++) values[i] = random_f64(min, max);
+}
+
+/*  Fails unless |expected - actual| <= ulps * eps * magnitude, where magnitude bounds the
+    absolute values summed to compute expected */
+static void assert_close(const char* what, u64 run, u64 i, f64 expected, f64 actual,
+                         f64 magnitude, f64 ulps) {
+  f64 tolerance = ulps * DBL_EPSILON * magnitude;
+  if (fabs(expected - actual) > tolerance) {
+    fail_msg("%s, run %llu, value %llu : expected %.17g, got %.17g (tolerance %g)", what, run, i,
+             expected, actual, tolerance);
+  }
+}
+
+//
+// Image filters
+//
+
+static void test_convolution(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    size_t kernel_size = random_in(1, 7);
+    int stride = random_in(1, 3);
+    int dilation = random_in(1, 2);
+    size_t span = (kernel_size - 1) * dilation + 1;
+    size_t height = random_in(span, span + 80);
+    size_t width = random_in(span, span + 80);
+    size_t out_height = (height - span) / stride + 1;
+    size_t out_width = (width - span) / stride + 1;
+
+    u8 kernel_filter[49];
+    for (size_t k = 0; k < kernel_size * kernel_size; k++) kernel_filter[k] = rand() % 4 ? rand() : 0;
+    u32 divisor = random_in(1, 2000);
+
+    u8* image = random_image(height * width);
+    u8* buffer = malloc(height * width);
+    u8* expected = malloc(out_height * out_width);
+    ref_convolution(image, expected, height, width, kernel_filter, kernel_size, divisor, stride,
+                    dilation);
+
+    size_t h = height, w = width;
+    convolution(&image, &buffer, &h, &w, kernel_filter, kernel_size, divisor, stride, dilation);
+    assert_int_equal(out_height, h);
+    assert_int_equal(out_width, w);
+    assert_memory_equal(expected, image, out_height * out_width);
+
+    free(image);
+    free(buffer);
+    free(expected);
+  }
+}
+
+static void test_convolution_5X5(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    int stride = random_in(1, 2);
+    size_t height = random_in(5, 100);
+    size_t width = random_in(5, 100);
+    size_t out_height = (height - 5) / stride + 1;
+    size_t out_width = (width - 5) / stride + 1;
+
+    u8 kernel_filter[25];
+    for (size_t k = 0; k < 25; k++) kernel_filter[k] = random_in(0, 3);
+
+    u8* image = random_image(height * width);
+    u8* buffer = malloc(height * width);
+    u8* expected = malloc(out_height * out_width);
+    ref_convolution(image, expected, height, width, kernel_filter, 5, 9, stride, 1);
+
+    size_t h = height, w = width;
+    convolution_5X5(&image, &buffer, &h, &w, kernel_filter, stride);
+    assert_int_equal(out_height, h);
+    assert_int_equal(out_width, w);
+    assert_memory_equal(expected, image, out_height * out_width);
+
+    free(image);
+    free(buffer);
+    free(expected);
+  }
+}
+
+static void test_pools(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    size_t window = random_in(1, 6);
+    size_t stride = random_in(1, 5);
+    size_t height = random_in(window, window + 90);
+    size_t width = random_in(window, window + 90);
+    size_t out_size = ((height - window) / stride + 1) * ((width - window) / stride + 1);
+
+    u8* image = random_image(height * width);
+    u8* copy = malloc(height * width);
+    u8* buffer = malloc(height * width);
+    u8* expected = malloc(out_size);
+
+    for (int average = 0; average < 2; average++) {
+      size_t h = height, w = width;
+      memcpy(copy, image, height * width);
+
+      if (average) {
+        ref_avg_pool(image, expected, height, width, window, stride);
+        avg_pool(&copy, &buffer, &h, &w, window, stride);
+      } else {
+        ref_max_pool(image, expected, height, width, window, stride);
+        max_pool(&copy, &buffer, &h, &w, window, stride);
+      }
+      assert_int_equal(out_size, h * w);
+      assert_memory_equal(expected, copy, out_size);
+    }
+
+    free(image);
+    free(copy);
+    free(buffer);
+    free(expected);
+  }
+}
+
+static void test_pools_2X2(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    size_t height = random_in(2, 100);
+    size_t width = random_in(2, 100);
+    size_t out_size = (height / 2) * (width / 2);
+
+    u8* image = random_image(height * width);
+    u8* copy = malloc(height * width);
+    u8* buffer = malloc(height * width);
+    u8* expected = malloc(out_size);
+
+    for (int average = 0; average < 2; average++) {
+      size_t h = height, w = width;
+      memcpy(copy, image, height * width);
+
+      if (average) {
+        ref_avg_pool(image, expected, height, width, 2, 2);
+        avg_pool_2X2(&copy, &buffer, &h, &w);
+      } else {
+        ref_max_pool(image, expected, height, width, 2, 2);
+        max_pool_2X2(&copy, &buffer, &h, &w);
+      }
+      assert_int_equal(out_size, h * w);
+      assert_memory_equal(expected, copy, out_size);
+    }
+
+    free(image);
+    free(copy);
+    free(buffer);
+    free(expected);
+  }
+}
+
+/*  Every lane of the batched filters must match the reference on its own image */
+static void test_batched_filters(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    u64 count = random_in(1, FILTER_BATCH);
+    size_t kernel_size = random_in(1, 5);
+    int stride = random_in(1, 2);
+    int dilation = random_in(1, 2);
+    size_t span = (kernel_size - 1) * dilation + 1;
+    size_t height = random_in(span + 1, span + 50);
+    size_t width = random_in(span + 1, span + 50);
+    size_t size = height * width;
+
+    u8 kernel_filter[25];
+    for (size_t k = 0; k < kernel_size * kernel_size; k++) kernel_filter[k] = rand();
+    u32 divisor = random_in(1, 3000);
+
+    u8* images[FILTER_BATCH];
+    for (u64 b = 0; b < count; b++) images[b] = random_image(size);
+
+    u8* batch = malloc(size * FILTER_BATCH);
+    u8* buffer = malloc(size * FILTER_BATCH);
+    u8* expected = malloc(size);
+    interleave_batch((const u8* const*) images, count, size, batch);
+
+    for (int filter = 0; filter < 3; filter++) {
+      size_t out_height, out_width;
+
+      if (filter == 0) {
+        out_height = (height - span) / stride + 1;
+        out_width = (width - span) / stride + 1;
+        convolution_batch(batch, buffer, height, width, kernel_filter, kernel_size, divisor,
+                          stride, dilation);
+      } else {
+        out_height = height / 2;
+        out_width = width / 2;
+        if (filter == 1) max_pool_2X2_batch(batch, buffer, height, width);
+        else
+          avg_pool_2X2_batch(batch, buffer, height, width);
+      }
+
+      for (u64 b = 0; b < count; b++) {
+        if (filter == 0)
+          ref_convolution(images[b], expected, height, width, kernel_filter, kernel_size,
+                          divisor, stride, dilation);
+        else if (filter == 1)
+          ref_max_pool(images[b], expected, height, width, 2, 2);
+        else
+          ref_avg_pool(images[b], expected, height, width, 2, 2);
+
+        for (size_t p = 0; p < out_height * out_width; p++) {
+          if (buffer[p * FILTER_BATCH + b] != expected[p]) {
+            fail_msg("filter %d, run %llu, image %llu, pixel %zu : expected %d, got %d", filter,
+                     run, b, p, expected[p], buffer[p * FILTER_BATCH + b]);
+          }
+        }
+      }
+    }
+
+    for (u64 b = 0; b < count; b++) free(images[b]);
+    free(batch);
+    free(buffer);
+    free(expected);
+  }
+}
+
+/*  The FFT path of the filter banks rounds differently, outputs may be off by one */
+static void test_filter_bank_fft(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS / 4; run++) {
+    FilterBank bank = {0};
+    bank.size = random_in(1, 3);
+    bank.kernels = calloc(bank.size, sizeof(Kernel));
+    for (u64 k = 0; k < bank.size; k++) {
+      u64 size = 2 * random_in(0, 8) + 1;
+      if (k % 2) gaussian_kernel(&bank.kernels[k], size, random_in(1, 5));
+      else
+        gabor_kernel(&bank.kernels[k], size, random_in(2, 5), random_f64(0, 3.14), random_in(4, 11),
+                     0.5f, 0);
+    }
+
+    u64 kernel_size = filter_bank_kernel_size(&bank);
+    size_t height = random_in(kernel_size, kernel_size + 120);
+    size_t width = random_in(kernel_size, kernel_size + 120);
+    size_t plane = (height - kernel_size + 1) * (width - kernel_size + 1);
+
+    u8* image = random_image(height * width);
+    u8* expected = malloc(plane * bank.size);
+    u8* output = malloc(plane * bank.size);
+    apply_filter_bank_direct(image, expected, height, width, &bank, 1, plane);
+    apply_filter_bank_fft(image, output, height, width, &bank, 1, plane);
+
+    for (size_t i = 0; i < plane * bank.size; i++) {
+      if (abs(expected[i] - output[i]) > 1) {
+        fail_msg("run %llu, value %zu : expected %d, got %d", run, i, expected[i], output[i]);
+      }
+    }
+
+    // The cached spectra give the same result, for the first image and after a smaller one
+    BankFft fft;
+    init_bank_fft(&fft);
+    bank.fft = &fft;
+    u8* cached = malloc(plane * bank.size);
+    apply_filter_bank_fft(image, cached, height, width, &bank, 1, plane);
+    assert_memory_equal(output, cached, plane * bank.size);
+    apply_filter_bank_fft(image, cached, kernel_size, kernel_size, &bank, 1, 1);
+    apply_filter_bank_fft(image, cached, height, width, &bank, 1, plane);
+    assert_memory_equal(output, cached, plane * bank.size);
+    free_bank_fft(&fft);
+    free(cached);
+
+    for (u64 k = 0; k < bank.size; k++) free_kernel(&bank.kernels[k]);
+    free(bank.kernels);
+    free(image);
+    free(expected);
+    free(output);
+  }
+}
+
+static void add_random_stage(Pipeline* pipeline) {
+  const char* names[] = {"convolution_5X5", "convolution_3X3", "max_pool_2X2",
+                         "avg_pool_2X2",    "max_pool",        "avg_pool"};
+  Stage stage;
+
+  stage_from_name(names[random_in(0, 5)], &stage);
+  if (stage.type == STAGE_CONVOLUTION_5X5 || stage.type == STAGE_CONVOLUTION_3X3) {
+    stage.stride = random_in(1, 2);
+    stage.dilation = random_in(1, 2);
+  } else if (stage.type == STAGE_MAX_POOL || stage.type == STAGE_AVG_POOL) {
+    stage.window = random_in(1, 4);
+    stage.stride = random_in(1, 3);
+  }
+  pipeline_add_stage(pipeline, &stage);
+}
+
+/*  The tiled and the batched pipelines must produce the features of the plain one */
+static void test_pipelines(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS / 2; run++) {
+    size_t width = random_in(30, 300);
+    size_t height = random_in(30, 300);
+    FeatureShape input = {width, height, 1};
+
+    Pipeline pipeline;
+    init_pipeline(&pipeline);
+    pipeline.tile_bytes = 1 << 30;// no implicit tiling of the reference
+    u64 stages = random_in(1, 4);
+    for (u64 i = 0; i < stages; i++) add_random_stage(&pipeline);
+    if (check_pipeline(&pipeline, input)) {
+      free_pipeline(&pipeline);
+      continue;
+    }
+
+    FeatureShape output = pipeline_output_shape(&pipeline, input);
+    size_t features = output.width * output.height * output.channels;
+    size_t buffer_size = pipeline_buffer_size(&pipeline, input);
+
+    u64 count = random_in(2, FILTER_BATCH);
+    u8* images[FILTER_BATCH];
+    u8* expected[FILTER_BATCH];
+    u8* image = malloc(buffer_size);
+    u8* buffer = malloc(buffer_size);
+    for (u64 b = 0; b < count; b++) {
+      images[b] = random_image(width * height);
+      memcpy(image, images[b], width * height);
+      expected[b] = apply_pipeline(&pipeline, image, buffer, width, height);
+    }
+
+    u8* tiled = apply_pipeline_tiled(&pipeline, images[0], width, height, random_in(2048, 65536));
+    assert_memory_equal(expected[0], tiled, features);
+    free(tiled);
+
+    if (pipeline_supports_batch(&pipeline)) {
+      u8* inputs[FILTER_BATCH];
+      apply_pipeline_batch(&pipeline, (const u8* const*) images, count, width, height, inputs);
+      for (u64 b = 0; b < count; b++) {
+        assert_memory_equal(expected[b], inputs[b], features);
+        free(inputs[b]);
+      }
+    }
+
+    for (u64 b = 0; b < count; b++) {
+      free(images[b]);
+      free(expected[b]);
+    }
+    free(image);
+    free(buffer);
+    free_pipeline(&pipeline);
+  }
+}
+
+//
+// Neural network layers
+//
+
+static Layer** create_dense_pair(u64 size, u64 next_size) {
+  Layer** layers = malloc(2 * sizeof(Layer*));
+  layers[0] = create_layer(size, next_size);
+  layers[1] = create_layer(next_size, 1);
+
+  fill_f64(layers[0]->weights, size * next_size, -0.5, 0.5);
+  fill_f64(layers[0]->bias, next_size, -0.5, 0.5);
+  fill_f64(layers[0]->delta_weights, size * next_size, -0.1, 0.1);
+  fill_f64(layers[0]->delta_bias, next_size, -0.1, 0.1);
+  fill_f64(layers[0]->neurons, size, 0.0, 1.0);
+  fill_f64(layers[1]->delta_neurons, next_size, -0.5, 0.5);
+  return layers;
+}
+
+static void test_dense_layers(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    u64 size = random_in(1, 300);
+    u64 next_size = random_in(1, 40);
+    Layer** layers = create_dense_pair(size, next_size);
+    Layer* layer = layers[0];
+    Layer* next = layers[1];
+
+    f64* expected = malloc((size * next_size + size + next_size) * sizeof(f64));
+    f64* weights = malloc(size * next_size * sizeof(f64));
+    f64* delta_weights = malloc(size * next_size * sizeof(f64));
+    f64* bias = malloc(next_size * sizeof(f64));
+    f64* delta_bias = malloc(next_size * sizeof(f64));
+
+    // |weights| <= 0.5, neurons in [0, 1], |deltas| <= 0.5
+    ref_compute_layer(layer->weights, layer->bias, layer->neurons, size, expected, next_size);
+    compute_layer(layer, next);
+    for (u64 j = 0; j < next_size; j++) {
+      assert_close("compute_layer", run, j, expected[j], next->neurons[j], 0.5 * size + 0.5,
+                   size + 1);
+    }
+
+    ref_compute_delta(layer->weights, layer->neurons, size, next->delta_neurons, next_size,
+                      expected);
+    compute_delta(layer, next);
+    for (u64 i = 0; i < size; i++) {
+      assert_close("compute_delta", run, i, expected[i], layer->delta_neurons[i],
+                   0.25 * next_size, next_size + 1);
+    }
+
+    memcpy(weights, layer->weights, size * next_size * sizeof(f64));
+    memcpy(delta_weights, layer->delta_weights, size * next_size * sizeof(f64));
+    memcpy(bias, layer->bias, next_size * sizeof(f64));
+    memcpy(delta_bias, layer->delta_bias, next_size * sizeof(f64));
+    ref_backpropagate(weights, bias, delta_weights, delta_bias, layer->neurons, size,
+                      next->delta_neurons, next_size, 0.3, 0.9);
+    backpropagate(layer, next, 0.3, 0.9);
+    for (u64 i = 0; i < size * next_size; i++) {
+      assert_close("backpropagate weights", run, i, weights[i], layer->weights[i], 1.0, 4);
+    }
+    for (u64 j = 0; j < next_size; j++) {
+      assert_close("backpropagate bias", run, j, bias[j], layer->bias[j], 1.0, 4);
+    }
+
+    free(expected);
+    free(weights);
+    free(delta_weights);
+    free(bias);
+    free(delta_bias);
+    free_neural_network(layers, 2);
+  }
+}
+
+/*  im2col and Winograd (3x3, stride 1, enough channels) against the direct convolution */
+static void test_conv_layers(void** state) {
+  srand(SEED);
+
+  for (u64 run = 0; run < RUNS; run++) {
+    u64 channels = random_in(1, 2 * WINOGRAD_MIN_CHANNELS);
+    u64 filters = random_in(1, 8);
+    u64 kernel = (run % 2) ? 3 : random_in(1, 5);
+    u64 stride = (run % 2) ? 1 : random_in(1, 3);
+    u64 height = random_in(kernel, kernel + 20);
+    u64 width = random_in(kernel, kernel + 20);
+    u64 out_height = (height - kernel) / stride + 1;
+    u64 out_width = (width - kernel) / stride + 1;
+    u64 size = channels * height * width;
+    u64 out_size = filters * out_height * out_width;
+    u64 patch = channels * kernel * kernel;
+
+    Layer** layers = malloc(2 * sizeof(Layer*));
+    layers[0] = create_conv_layer(channels, height, width, filters, kernel, stride);
+    layers[1] = create_layer(out_size, 1);
+    Layer* layer = layers[0];
+    Layer* next = layers[1];
+
+    fill_f64(layer->weights, filters * patch, -0.5, 0.5);
+    fill_f64(layer->bias, filters, -0.5, 0.5);
+    fill_f64(layer->delta_weights, filters * patch, -0.1, 0.1);
+    fill_f64(layer->delta_bias, filters, -0.1, 0.1);
+    fill_f64(layer->neurons, size, 0.0, 1.0);
+    fill_f64(next->delta_neurons, out_size, -0.5, 0.5);
+
+    f64* expected = malloc((size > out_size ? size : out_size) * sizeof(f64));
+    f64* weights = malloc(filters * patch * sizeof(f64));
+    f64* delta_weights = malloc(filters * patch * sizeof(f64));
+    f64* bias = malloc(filters * sizeof(f64));
+    f64* delta_bias = malloc(filters * sizeof(f64));
+
+    // the Winograd transforms scale the magnitudes by at most 4 on each side
+    f64 ulps = layer->conv->winograd ? 16.0 * (patch + 1) : patch + 1;
+    ref_compute_conv_layer(layer->weights, layer->bias, layer->neurons, channels, height, width,
+                           filters, kernel, stride, expected);
+    compute_conv_layer(layer, next);
+    for (u64 i = 0; i < out_size; i++) {
+      assert_close("compute_conv_layer", run, i, expected[i], next->neurons[i],
+                   0.5 * patch + 0.5, ulps);
+    }
+
+    ref_compute_conv_delta(layer->weights, layer->neurons, channels, height, width, filters,
+                           kernel, stride, next->delta_neurons, expected);
+    compute_conv_delta(layer, next);
+    for (u64 i = 0; i < size; i++) {
+      assert_close("compute_conv_delta", run, i, expected[i], layer->delta_neurons[i],
+                   0.25 * filters * kernel * kernel, filters * kernel * kernel + 1);
+    }
+
+    memcpy(weights, layer->weights, filters * patch * sizeof(f64));
+    memcpy(delta_weights, layer->delta_weights, filters * patch * sizeof(f64));
+    memcpy(bias, layer->bias, filters * sizeof(f64));
+    memcpy(delta_bias, layer->delta_bias, filters * sizeof(f64));
+    ref_backpropagate_conv(weights, bias, delta_weights, delta_bias, layer->neurons, channels,
+                           height, width, filters, kernel, stride, next->delta_neurons, 0.3, 0.9);
+    backpropagate_conv(layer, next, 0.3, 0.9);
+    for (u64 i = 0; i < filters * patch; i++) {
+      assert_close("backpropagate_conv weights", run, i, weights[i], layer->weights[i],
+                   0.15 * out_height * out_width + 1.0, out_height * out_width + 4);
+    }
+    for (u64 f = 0; f < filters; f++) {
+      assert_close("backpropagate_conv bias", run, f, bias[f], layer->bias[f],
+                   0.15 * out_height * out_width + 1.0, out_height * out_width + 4);
+    }
+
+    free(expected);
+    free(weights);
+    free(delta_weights);
+    free(bias);
+    free(delta_bias);
+    free_neural_network(layers, 2);
+  }
+}
+
+int main(void) {
+  int result = 0;
+  const struct CMUnitTest filters[] = {
+          cmocka_unit_test(test_convolution),     cmocka_unit_test(test_convolution_5X5),
+          cmocka_unit_test(test_pools),           cmocka_unit_test(test_pools_2X2),
+          cmocka_unit_test(test_batched_filters), cmocka_unit_test(test_filter_bank_fft),
+          cmocka_unit_test(test_pipelines),
+  };
+  const struct CMUnitTest layers[] = {
+          cmocka_unit_test(test_dense_layers),
+          cmocka_unit_test(test_conv_layers),
+  };
+  result |= cmocka_run_group_tests_name("image filters", filters, NULL, NULL);
+  result |= cmocka_run_group_tests_name("layers", layers, NULL, NULL);
+
+  return result;
+}
@@ -0,0 +1,173 @@
+#include <cmath>
+#include <csetjmp>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "ImageKernels.hpp"
+
+// cmocka comes last : its fail() macro would replace std::ios::fail in the C++ headers
+extern "C" {
+#include <cmocka.h>
+
+#include "reference.h"
+}
+
+// Differential tests of the templated image kernels of the io library against the scalar
+// references of reference.c, for every pixel type and layout.
+// Pixels and weights are small integers : the float sums of the kernels are exact, so they must
+// match the integer references bit for bit
+
+#define SEED 1234
+#define RUNS 100
+
+using kernels::ImageView;
+
+static int random_in(int min, int max) { return min + rand() % (max - min + 1); }
+
+/**
+ * @brief A random image of width x height x channels u8 values, channels interleaved or planar
+ */
+struct TestImage {
+  int width, height, channels;
+  bool planar;
+  std::vector<u8> pixels;
+
+  TestImage(int width, int height, int channels, bool planar)
+      : width(width), height(height), channels(channels), planar(planar),
+        pixels((size_t) width * height * channels) {
+    for (u8& p: pixels) p = (u8) rand();
+  }
+
+  template<typename T>
+  ImageView<T> view(T* data) const {
+    return planar ? ImageView<T>::planar(data, width, height, channels)
+                  : ImageView<T>::interleaved(data, width, height, channels);
+  }
+
+  template<typename T>
+  std::vector<T> as() const {
+    return {pixels.begin(), pixels.end()};
+  }
+
+  /**
+   * @return The values of one channel, row-major, as the references take them
+   */
+  std::vector<u8> plane(int c) const {
+    std::vector<u8> res((size_t) width * height);
+    auto in = view(pixels.data());
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) res[(size_t) y * width + x] = in.at(x, y, c);
+    }
+    return res;
+  }
+};
+
+/*  Convolutions of u8 and float images, into raw float sums */
+static void test_convolve(void**) {
+  srand(SEED);
+
+  for (int run = 0; run < RUNS; run++) {
+    int ksize = random_in(1, 7);
+    int stride = random_in(1, 2);
+    TestImage image(random_in(ksize, ksize + 80), random_in(ksize, ksize + 80), random_in(1, 4),
+                    rand() % 2);
+    int out_width = kernels::outputSize(image.width, ksize, stride);
+    int out_height = kernels::outputSize(image.height, ksize, stride);
+
+    u8 weights[49];
+    float kernel[49];
+    for (int k = 0; k < ksize * ksize; k++) {
+      weights[k] = (u8) (rand() % 4 ? rand() : 0);
+      kernel[k] = weights[k];
+    }
+    u32 divisor = random_in(1, 2000);
+
+    // Outputs are stored like their input : interleaved or planar
+    TestImage output(out_width, out_height, image.channels, image.planar);
+    std::vector<float> from_u8((size_t) out_width * out_height * image.channels);
+    std::vector<float> from_float(from_u8.size());
+
+    std::vector<float> floats = image.as<float>();
+    kernels::convolve<u8, float>(image.view<const u8>(image.pixels.data()),
+                                 output.view(from_u8.data()), kernel, ksize, stride);
+    kernels::convolve<float>(image.view<const float>(floats.data()), output.view(from_float.data()),
+                             kernel, ksize, stride);
+
+    std::vector<u8> expected((size_t) out_width * out_height);
+    for (int c = 0; c < image.channels; c++) {
+      std::vector<u8> plane = image.plane(c);
+      ref_convolution(plane.data(), expected.data(), image.height, image.width, weights, ksize,
+                      divisor, stride, 1);
+
+      for (int y = 0; y < out_height; y++) {
+        for (int x = 0; x < out_width; x++) {
+          u8 e = expected[(size_t) y * out_width + x];
+          assert_int_equal(e, (u8) ((u64) output.view(from_u8.data()).at(x, y, c) / divisor));
+          assert_int_equal(e, (u8) ((u64) output.view(from_float.data()).at(x, y, c) / divisor));
+        }
+      }
+    }
+  }
+}
+
+/*  Max pooling of u8 and u16 images, average pooling of u8 images into floats */
+static void test_pools(void**) {
+  srand(SEED);
+
+  for (int run = 0; run < RUNS; run++) {
+    int window = random_in(1, 6);
+    int stride = random_in(1, 5);
+    TestImage image(random_in(window, window + 90), random_in(window, window + 90),
+                    random_in(1, 4), rand() % 2);
+    int out_width = kernels::outputSize(image.width, window, stride);
+    int out_height = kernels::outputSize(image.height, window, stride);
+    size_t out_size = (size_t) out_width * out_height * image.channels;
+
+    // Outputs are stored like their input : interleaved or planar
+    TestImage output(out_width, out_height, image.channels, image.planar);
+    std::vector<u8> max_u8(out_size);
+    std::vector<uint16_t> max_u16(out_size);
+    std::vector<float> average(out_size);
+
+    std::vector<uint16_t> wide = image.as<uint16_t>();
+    kernels::maxPool<u8>(image.view<const u8>(image.pixels.data()), output.view(max_u8.data()),
+                         window, stride);
+    kernels::maxPool<uint16_t>(image.view<const uint16_t>(wide.data()),
+                               output.view(max_u16.data()), window, stride);
+    kernels::avgPool<u8, float>(image.view<const u8>(image.pixels.data()),
+                                output.view(average.data()), window, stride);
+
+    std::vector<u8> expected_max((size_t) out_width * out_height);
+    std::vector<u8> expected_avg(expected_max.size());
+    for (int c = 0; c < image.channels; c++) {
+      std::vector<u8> plane = image.plane(c);
+      ref_max_pool(plane.data(), expected_max.data(), image.height, image.width, window, stride);
+      ref_avg_pool(plane.data(), expected_avg.data(), image.height, image.width, window, stride);
+
+      for (int y = 0; y < out_height; y++) {
+        for (int x = 0; x < out_width; x++) {
+          size_t i = (size_t) y * out_width + x;
+          assert_int_equal(expected_max[i], output.view(max_u8.data()).at(x, y, c));
+          assert_int_equal(expected_max[i], output.view(max_u16.data()).at(x, y, c));
+
+          // The references round the average down. An average is at least 1 / window^2 away
+          // from the next integer, far more than the error of the float scaling
+          float a = output.view(average.data()).at(x, y, c);
+          assert_int_equal(expected_avg[i], (int) std::floor(a + 1e-3f));
+        }
+      }
+    }
+  }
+}
+
+int main() {
+  const struct CMUnitTest kernels_tests[] = {
+          cmocka_unit_test(test_convolve),
+          cmocka_unit_test(test_pools),
+  };
+
+  return cmocka_run_group_tests_name("image kernels", kernels_tests, NULL, NULL);
+}
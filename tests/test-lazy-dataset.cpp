@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DatasetInfo.hpp"
+#include "LazyDataset.hpp"
+#include "dataset-fixture.hpp"
+
+// cmocka comes last : its fail() macro would replace std::ios::fail in the C++ headers
+extern "C" {
+#include <cmocka.h>
+}
+
+// Tests of the cache of the LazyDataset on 64 images of 4x4 pixels, 16 bytes each, written in a
+// temporary directory (see dataset-fixture.hpp). Every pixel of image k is k.
+// The cache has 16 shards, the image at position i going to the shard i % 16
+
+#define NB_IMAGES 64
+#define SIDE 4
+#define IMAGE_BYTES (SIDE * SIDE)
+#define NB_SHARDS 16
+
+namespace fs = std::filesystem;
+
+struct Fixture {
+  fs::path dir;
+  std::optional<DatasetInfo> info;
+};
+
+static int create_dataset(void** state) {
+  fs::path dir = writeDataset("lazy-dataset", NB_IMAGES, SIDE);
+  if (dir.empty()) return -1;
+
+  auto* fixture = new Fixture;
+  fixture->dir = dir;
+  fixture->info = DatasetInfo::loadFromPath(fixture->dir);
+  *state = fixture;
+  return 0;
+}
+
+static int remove_dataset(void** state) {
+  auto* fixture = static_cast<Fixture*>(*state);
+  fs::remove_all(fixture->dir);
+  delete fixture;
+  return 0;
+}
+
+/**
+ * @return A dataset of all the images, in the order of the DatasetInfo
+ */
+static LazyDataset open_dataset(const Fixture& fixture, const LazyDataset::Options& options) {
+  std::vector<unsigned int> indices(fixture.info->getImagesInfo().size());
+  std::iota(indices.begin(), indices.end(), 0);
+  return {*fixture.info, std::move(indices), options};
+}
+
+static const fs::path& image_path(const Fixture& fixture, size_t i) {
+  return fixture.info->getImagesInfo()[i].getPath();
+}
+
+/**
+ * @brief Check that an image is the one at position i of the dataset
+ */
+static void assert_image(const std::shared_ptr<const Image>& image, const Fixture& fixture,
+                         size_t i) {
+  assert_non_null(image.get());
+  int code = std::stoi(image_path(fixture, i).stem().string());
+  for (int p = 0; p < IMAGE_BYTES; p++) assert_int_equal(image->data<unsigned char>()[p], code);
+}
+
+/*  Each shard keeps its most recently used images within its part of the budget */
+static void test_lru_eviction(void** state) {
+  auto& fixture = *static_cast<Fixture*>(*state);
+
+  // two images per shard
+  LazyDataset::Options options;
+  options.memory_budget = NB_SHARDS * 2 * IMAGE_BYTES;
+  options.read_ahead = 0;
+  LazyDataset dataset = open_dataset(fixture, options);
+
+  // positions 0, 16, 32 and 48 share the first shard
+  auto first = dataset.get(0);
+  dataset.get(16);
+  assert_image(dataset.get(0), fixture, 0);// 0 becomes the most recently used
+  dataset.get(32);                         // evicts 16
+  auto stats = dataset.getStats();
+  assert_int_equal(stats.misses, 3);
+  assert_int_equal(stats.hits, 1);
+  assert_int_equal(stats.evictions, 1);
+  assert_int_equal(stats.bytes, 2 * IMAGE_BYTES);
+
+  assert_image(dataset.get(0), fixture, 0);
+  assert_image(dataset.get(32), fixture, 32);
+  assert_int_equal(dataset.getStats().hits, 3);
+
+  assert_image(dataset.get(16), fixture, 16);// evicts 0
+  assert_image(dataset.get(48), fixture, 48);// evicts 32
+  stats = dataset.getStats();
+  assert_int_equal(stats.misses, 5);
+  assert_int_equal(stats.evictions, 3);
+
+  // an evicted image stays valid while it is held
+  assert_image(first, fixture, 0);
+
+  // the whole dataset fills every shard to its budget, and no further
+  for (size_t i = 0; i < dataset.getSize(); i++) {
+    assert_image(dataset.get(i), fixture, i);
+    assert_true(dataset.getStats().bytes <= options.memory_budget);
+  }
+  stats = dataset.getStats();
+  assert_int_equal(stats.bytes, options.memory_budget);
+
+  // the 4 reads of the first shard evict, the 2 last reads of the other shards do
+  assert_int_equal(stats.evictions, 3 + 4 + (NB_SHARDS - 1) * 2);
+}
+
+/*  Reads racing the read-ahead thread on the same images all get the instance of the cache */
+static void test_read_ahead(void** state) {
+  auto& fixture = *static_cast<Fixture*>(*state);
+
+  LazyDataset::Options options;
+  options.read_ahead = 8;
+  LazyDataset dataset = open_dataset(fixture, options);
+
+  std::vector<size_t> order(dataset.getSize());
+  std::iota(order.begin(), order.end(), 0);
+  std::mt19937 rng(1234);
+  size_t misses = 0;
+
+  for (int epoch = 0; epoch < 4; epoch++) {
+    std::shuffle(order.begin(), order.end(), rng);
+    dataset.setOrder(order);
+
+    // the other threads read the same images as the training, without the read-ahead
+    std::vector<std::thread> readers;
+    std::vector<std::vector<std::shared_ptr<const Image>>> read(3);
+    for (auto& images: read) {
+      readers.emplace_back([&dataset, &order, &images] {
+        for (size_t i: order) images.push_back(dataset.get(i));
+      });
+    }
+
+    for (size_t p = 0; p < order.size(); p++) {
+      auto image = dataset.getInOrder(p);
+      assert_image(image, fixture, order[p]);
+      assert_true(image == dataset.get(order[p]));
+    }
+    for (auto& reader: readers) reader.join();
+
+    for (auto& images: read) {
+      for (size_t p = 0; p < order.size(); p++) assert_true(images[p] == dataset.get(order[p]));
+    }
+
+    // once loaded in the first epoch, every image stays in the cache
+    auto stats = dataset.getStats();
+    assert_int_equal(stats.hits + stats.misses, (size_t) (epoch + 1) * 8 * NB_IMAGES);
+    assert_int_equal(stats.evictions, 0);
+    assert_int_equal(stats.failures, 0);
+    if (epoch == 0) misses = stats.misses;
+    assert_int_equal(stats.misses, misses);
+  }
+}
+
+/*  A failed load is tried again by the next reads, a few times only */
+static void test_failed_load(void** state) {
+  auto& fixture = *static_cast<Fixture*>(*state);
+
+  LazyDataset::Options options;
+  options.read_ahead = 0;
+  LazyDataset dataset = open_dataset(fixture, options);
+
+  // a file missing for a moment
+  fs::path path = image_path(fixture, 0);
+  fs::rename(path, fixture.dir / "moved.png");
+  assert_null(dataset.get(0).get());
+  fs::rename(fixture.dir / "moved.png", path);
+  assert_image(dataset.get(0), fixture, 0);
+  assert_int_equal(dataset.getStats().failures, 1);
+
+  // a corrupted file is given up after 3 tries
+  FILE* file = fopen(image_path(fixture, 1).c_str(), "w");
+  fputs("not a png", file);
+  fclose(file);
+  for (int read = 0; read < 5; read++) assert_null(dataset.get(1).get());
+  assert_int_equal(dataset.getStats().failures, 1 + 3);
+}
+
+int main() {
+  const struct CMUnitTest lazy_dataset_tests[] = {
+          cmocka_unit_test_setup_teardown(test_lru_eviction, create_dataset, remove_dataset),
+          cmocka_unit_test_setup_teardown(test_read_ahead, create_dataset, remove_dataset),
+          cmocka_unit_test_setup_teardown(test_failed_load, create_dataset, remove_dataset),
+  };
+
+  return cmocka_run_group_tests_name("lazy dataset", lazy_dataset_tests, NULL, NULL);
+}
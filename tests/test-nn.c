@@ -6,12 +6,15 @@
 #include <stdio.h>
 
 #include "../src/type.h"
-#include "nn.h"
+#include "neural_network.h"
 
 static void test_nn(void** state) {
 
-  Layer* layer1 = createLayer(10, 10);
-  Layer* layer2 = createLayer(10, 10);
+  Layer** layers = malloc(2 * sizeof(Layer*));
+  layers[0] = create_layer(10, 10);
+  layers[1] = create_layer(10, 10);
+  Layer* layer1 = layers[0];
+  Layer* layer2 = layers[1];
 
   u64 size = 10;
   u64 next_size = 10;
@@ -31,7 +34,7 @@ static void test_nn(void** state) {
     layer2->neurons[i] = 0;
   }
 
-  computeLayer(layer1, layer2);
+  compute_layer(layer1, layer2);
   float eps = 0.001;
   assert_float_equal(sigmoid(1), layer2->neurons[0], eps);
 
@@ -50,27 +53,12 @@ static void test_nn(void** state) {
     layer1->neurons[i] = 10;
     layer2->neurons[i] = 0;
   }
-  computeLayer(layer1, layer2);
+  compute_layer(layer1, layer2);
   assert_float_equal(sigmoid(0), layer2->neurons[0], eps);
 
 
   // free
-  free(layer1->bias);
-  free(layer1->neurons);
-  free(layer1->weights);
-
-  free(layer1->delta_neurons);
-  free(layer1->delta_weights);
-  free(layer1->delta_bias);
-
-
-  free(layer2->bias);
-  free(layer2->neurons);
-  free(layer2->weights);
-
-  free(layer2->delta_neurons);
-  free(layer2->delta_weights);
-  free(layer2->delta_bias);
+  free_neural_network(layers, 2);
 }
 
 
@@ -85,12 +73,14 @@ static void test_sigmoid(void** state) {
 
 int main(void) {
   int result = 0;
-  const struct CMUnitTest tests[] = {
+  const struct CMUnitTest nn_tests[] = {
           cmocka_unit_test(test_nn),
+  };
+  const struct CMUnitTest sigmoid_tests[] = {
           cmocka_unit_test(test_sigmoid),
   };
-  result |= cmocka_run_group_tests_name("nn", tests, NULL, NULL);
-  result |= cmocka_run_group_tests_name("sigmoid", tests, NULL, NULL);
+  result |= cmocka_run_group_tests_name("nn", nn_tests, NULL, NULL);
+  result |= cmocka_run_group_tests_name("sigmoid", sigmoid_tests, NULL, NULL);
 
   return result;
 }
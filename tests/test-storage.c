@@ -1,38 +1,510 @@
 #include <cmocka.h>
+#include <dirent.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "../src/type.h"
-#include "nn.h"
+#include "checkpoint.h"
+#include "neural_network.h"
 #include "store.h"
 
+// 2 x 6 x 6 inputs, a 3x3 convolution layer with 4 filters, then 64 -> 20 -> 3 -> 1
+static int neurons_per_layers[6] = {72, 64, 20, 3, 1, 0};
+static ConvSpec conv_spec = {4, 3, 1};
+
+static void init_storage_context(Context* context, char* storage_dir) {
+  memset(context, 0, sizeof(Context));
+  context->storage_dir = storage_dir;
+  context->topology = neurons_per_layers;
+  context->nn_size = 5;
+  context->conv = &conv_spec;
+  context->conv_size = 1;
+  context->input_width = 6;
+  context->input_height = 6;
+  context->input_channels = 2;
+}
+
+// Every test works in its own storage directory, removed with everything in it afterwards
+static int create_storage_dir(void** state) {
+  char* storage_dir = strdup("storage-XXXXXX");
+  if (mkdtemp(storage_dir) == NULL) {
+    free(storage_dir);
+    return -1;
+  }
+  *state = storage_dir;
+  return 0;
+}
+
+static int remove_storage_dir(void** state) {
+  char* storage_dir = *state;
+
+  DIR* dir = opendir(storage_dir);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+      char path[1024];
+      snprintf(path, sizeof(path), "%s/%s", storage_dir, entry->d_name);
+      unlink(path);
+    }
+    closedir(dir);
+  }
+
+  int res = rmdir(storage_dir);
+  free(storage_dir);
+  return res;
+}
+
+#define storage_test(f) cmocka_unit_test_setup_teardown(f, create_storage_dir, remove_storage_dir)
+
+static void rename_model(const char* storage_dir, const char* from, const char* to) {
+  char from_path[1024], to_path[1024];
+  snprintf(from_path, sizeof(from_path), "%s/%s", storage_dir, from);
+  snprintf(to_path, sizeof(to_path), "%s/%s", storage_dir, to);
+  assert_int_equal(0, rename(from_path, to_path));
+}
+
+static void assert_same_values(const f64* expected, const f64* actual, u64 size) {
+  assert_memory_equal(expected, actual, size * sizeof(f64));
+}
+
 static void test_storage(void** state) {
-  u64 nb_layers = 4;
-  u64 neurons_per_layers[10] = {10, 20, 3, 1, 1};
-  u64 input_size = neurons_per_layers[0];
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  Layer** nn1 = init_neural_network_from_context(&context);
+  for (u64 i = 0; i < (u64) context.nn_size; i++) {
+    for (u64 j = 0; j < nn1[i]->size; j++) {
+      nn1[i]->neurons[j] = rand() / (f64) RAND_MAX;
+      nn1[i]->delta_neurons[j] = rand() / (f64) RAND_MAX - 0.5;
+    }
+  }
+
+  assert_int_equal(1, store_neural_network(&context, nn1, NULL));
+
+  Layer** nn2 = load_neural_network(&context, NULL);
+  assert_non_null(nn2);
+
+  // the round trip is exact
+  for (u64 i = 0; i < (u64) context.nn_size - 1; i++) {
+    u64 next_size = context.topology[i + 1];
+    u64 weights_size = layer_weights_size(nn1[i], next_size);
+    u64 bias_size = layer_bias_size(nn1[i], next_size);
+
+    assert_same_values(nn1[i]->weights, nn2[i]->weights, weights_size);
+    assert_same_values(nn1[i]->delta_weights, nn2[i]->delta_weights, weights_size);
+    assert_same_values(nn1[i]->bias, nn2[i]->bias, bias_size);
+    assert_same_values(nn1[i]->delta_bias, nn2[i]->delta_bias, bias_size);
+    assert_same_values(nn1[i]->neurons, nn2[i]->neurons, nn1[i]->size);
+    assert_same_values(nn1[i]->delta_neurons, nn2[i]->delta_neurons, nn1[i]->size);
+  }
+
+  free_neural_network(nn1, context.nn_size);
+  free_neural_network(nn2, context.nn_size);
+}
+
+static void test_storage_mismatch(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
 
-  Layer** nn1 = Init_Neural_network(neurons_per_layers, nb_layers);
+  Layer** nn = init_neural_network_from_context(&context);
+  assert_int_equal(1, store_neural_network(&context, nn, NULL));
+  free_neural_network(nn, context.nn_size);
+
+  // another topology
+  neurons_per_layers[2] = 21;
+  assert_null(load_neural_network(&context, NULL));
+  neurons_per_layers[2] = 20;
+
+  // a file of an older version of the format, whose header was shorter
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", storage_dir, MODEL_FILE);
+  FILE* fp = fopen(path, "r+b");
+  assert_non_null(fp);
+  u32 version = 2;
+  fseek(fp, offsetof(ModelHeader, version), SEEK_SET);
+  fwrite(&version, sizeof(version), 1, fp);
+  fflush(fp);
+  assert_null(load_neural_network(&context, NULL));
+  assert_null(load_inference_network(&context, MODEL_FILE));
+  version = MODEL_VERSION;
+  fseek(fp, offsetof(ModelHeader, version), SEEK_SET);
+  fwrite(&version, sizeof(version), 1, fp);
+  fflush(fp);
+
+  // a truncated file
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  assert_int_equal(0, truncate(path, size - 8));
+  assert_null(load_neural_network(&context, NULL));
+
+  // a file which is not a model
+  fp = fopen(path, "wb");
+  fprintf(fp, "0.500000\n");
+  fclose(fp);
+  assert_null(load_neural_network(&context, NULL));
+}
+
+static void test_mapped_storage(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  Layer** nn = init_neural_network_from_context(&context);
+  assert_int_equal(1, store_neural_network(&context, nn, NULL));
+
+  MappedModel model;
+  assert_int_equal(1, map_neural_network(&context, MODEL_FILE, &model));
+  assert_int_equal(context.nn_size, model.nb_layers);
+
+  // the weights are read in place
+  for (u64 i = 0; i < (u64) context.nn_size - 1; i++) {
+    assert_true((const u8*) model.layers[i]->weights >= model.data);
+    assert_true((const u8*) model.layers[i]->weights < model.data + model.size);
+    assert_int_equal(0, (uintptr_t) model.layers[i]->weights % MODEL_ALIGNMENT);
+    assert_null(model.layers[i]->delta_weights);
+  }
+
+  // and give the outputs of the trained network
+  for (u64 j = 0; j < nn[0]->size; j++) {
+    nn[0]->neurons[j] = rand() / (f64) RAND_MAX;
+    model.layers[0]->neurons[j] = nn[0]->neurons[j];
+  }
+  forward_compute(context.nn_size, nn);
+  forward_compute(context.nn_size, model.layers);
+  assert_same_values(nn[context.nn_size - 1]->neurons,
+                     model.layers[context.nn_size - 1]->neurons, 1);
+
+  unmap_neural_network(&model);
+  free_neural_network(nn, context.nn_size);
+
+  // another topology
+  neurons_per_layers[3] = 4;
+  assert_int_equal(0, map_neural_network(&context, MODEL_FILE, &model));
+  neurons_per_layers[3] = 3;
+}
+
+static void test_checkpoint(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  Layer** nn = init_neural_network_from_context(&context);
+  f64 weight = nn[1]->weights[0];
+
+  u64 permutation[5] = {3, 1, 4, 0, 2};
+  TrainingState training = {7, 42, 5, permutation};
+
+  Checkpointer checkpointer;
+  init_checkpointer(&checkpointer, &context);
+  assert_int_equal(1, checkpoint(&checkpointer, nn, &training));
+
+  // the snapshot is not affected by the training going on
+  nn[1]->weights[0] = weight + 1.0;
+  permutation[0] = 0;
+  training.epoch = 8;
+  free_checkpointer(&checkpointer);
+  assert_int_equal(1, checkpointer.written);
+
+  TrainingState loaded_training;
+  Layer** loaded = load_neural_network(&context, &loaded_training);
+  assert_non_null(loaded);
+  assert_true(loaded[1]->weights[0] == weight);
+  assert_same_values(nn[0]->weights, loaded[0]->weights, layer_weights_size(nn[0], 64));
+  assert_int_equal(7, loaded_training.epoch);
+  assert_int_equal(3, loaded_training.permutation[0]);
+
+  free_training_state(&loaded_training);
+  free_neural_network(nn, context.nn_size);
+  free_neural_network(loaded, context.nn_size);
+}
 
-  store_nn("storage", nn1, nb_layers, neurons_per_layers);
+/*  Whether the second checkpoint is skipped or not, the latest network is stored */
+static void test_skipped_checkpoint(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  Layer** nn = init_neural_network_from_context(&context);
+  f64 weight = nn[1]->weights[0];
+
+  u64 permutation[5] = {3, 1, 4, 0, 2};
+  TrainingState training = {7, 42, 5, permutation};
+
+  Checkpointer checkpointer;
+  init_checkpointer(&checkpointer, &context);
+  assert_int_equal(1, checkpoint(&checkpointer, nn, &training));
+
+  // most likely skipped, the first snapshot is still written
+  nn[1]->weights[0] = weight + 1.0;
+  training.epoch = 8;
+  checkpoint(&checkpointer, nn, &training);
+  free_checkpointer(&checkpointer);
+  assert_int_equal(2, checkpointer.written);
+  assert_int_equal(0, checkpointer.failed);
+
+  TrainingState loaded_training;
+  Layer** loaded = load_neural_network(&context, &loaded_training);
+  assert_non_null(loaded);
+  assert_true(loaded[1]->weights[0] == weight + 1.0);
+  assert_int_equal(8, loaded_training.epoch);
+
+  free_training_state(&loaded_training);
+  free_neural_network(nn, context.nn_size);
+  free_neural_network(loaded, context.nn_size);
+}
+
+static void test_training_state(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  u64 patterns = 1000;
+  TrainingState training;
+  init_training_state(&training);
+  training.size = patterns;
+  training.permutation = malloc(patterns * sizeof(u64));
+  for (u64 i = 0; i < patterns; i++) training.permutation[i] = i;
+  shuffle(patterns, training.permutation, &training.rng);
+  training.epoch = 1;
+
+  Layer** nn = init_neural_network_from_context(&context);
+  assert_int_equal(1, store_neural_network(&context, nn, &training));
+
+  TrainingState resumed;
+  Layer** loaded = load_neural_network(&context, &resumed);
+  assert_non_null(loaded);
+  assert_int_equal(training.epoch, resumed.epoch);
+  assert_int_equal(training.rng, resumed.rng);
+  assert_int_equal(patterns, resumed.size);
+  assert_memory_equal(training.permutation, resumed.permutation, patterns * sizeof(u64));
+
+  // the resumed training visits the patterns in the same order as the interrupted one
+  for (int epoch = 0; epoch < 3; epoch++) {
+    shuffle(patterns, training.permutation, &training.rng);
+    shuffle(patterns, resumed.permutation, &resumed.rng);
+    assert_memory_equal(training.permutation, resumed.permutation, patterns * sizeof(u64));
+  }
+
+  free_training_state(&resumed);
+  free_neural_network(loaded, context.nn_size);
+
+  // a model stored without its state resumes from a new training
+  assert_int_equal(1, store_neural_network(&context, nn, NULL));
+  loaded = load_neural_network(&context, &resumed);
+  assert_non_null(loaded);
+  assert_int_equal(0, resumed.epoch);
+  assert_null(resumed.permutation);
+
+  free_training_state(&training);
+  free_neural_network(nn, context.nn_size);
+  free_neural_network(loaded, context.nn_size);
+}
+
+static long file_size(const char* storage_dir, const char* file_name) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", storage_dir, file_name);
+  FILE* fp = fopen(path, "rb");
+  assert_non_null(fp);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+static void test_compressed_storage(void** state) {
+  char* storage_dir = *state;
+
+  // a dense network large enough to span several blocks
+  static int dense_layers[4] = {1024, 512, 1, 0};
+  Context context;
+  init_storage_context(&context, storage_dir);
+  context.topology = dense_layers;
+  context.nn_size = 3;
+  context.conv_size = 0;
+
+  Layer** nn = init_neural_network_from_context(&context);
+  for (u64 i = 0; i < (u64) context.nn_size; i++) {
+    for (u64 j = 0; j < nn[i]->size; j++) {
+      nn[i]->neurons[j] = rand() / (f64) RAND_MAX;
+      nn[i]->delta_neurons[j] = 0.0;
+    }
+  }
+  u64 permutation[3] = {2, 0, 1};
+  TrainingState training = {4, 1234, 3, permutation};
+
+  assert_int_equal(1, store_neural_network(&context, nn, &training));
+  long raw_size = file_size(storage_dir, MODEL_FILE);
+  assert_true(raw_size > 2 * MODEL_CHUNK);
+
+  context.compression = 1;
+  assert_int_equal(1, store_neural_network(&context, nn, &training));
+  long compressed_size = file_size(storage_dir, MODEL_FILE);
+  assert_true(compressed_size < raw_size);
+
+  // the round trip is exact
+  TrainingState loaded_training;
+  Layer** loaded = load_neural_network(&context, &loaded_training);
+  assert_non_null(loaded);
+  for (u64 i = 0; i < (u64) context.nn_size - 1; i++) {
+    u64 next_size = context.topology[i + 1];
+    assert_same_values(nn[i]->weights, loaded[i]->weights, layer_weights_size(nn[i], next_size));
+    assert_same_values(nn[i]->delta_bias, loaded[i]->delta_bias, layer_bias_size(nn[i], next_size));
+    assert_same_values(nn[i]->neurons, loaded[i]->neurons, nn[i]->size);
+  }
+  assert_int_equal(4, loaded_training.epoch);
+  assert_memory_equal(permutation, loaded_training.permutation, sizeof(permutation));
+  free_training_state(&loaded_training);
+  free_neural_network(loaded, context.nn_size);
+
+  loaded = load_inference_network(&context, MODEL_FILE);
+  assert_non_null(loaded);
+  assert_same_values(nn[1]->weights, loaded[1]->weights, layer_weights_size(nn[1], 1));
+  free_neural_network(loaded, context.nn_size);
+
+  // compressed models can not be mapped
+  MappedModel model;
+  assert_int_equal(0, map_neural_network(&context, MODEL_FILE, &model));
+
+  // a corrupted block
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", storage_dir, MODEL_FILE);
+  FILE* fp = fopen(path, "r+b");
+  assert_non_null(fp);
+  fseek(fp, compressed_size / 2, SEEK_SET);
+  int byte = fgetc(fp);
+  fseek(fp, compressed_size / 2, SEEK_SET);
+  fputc(byte ^ 0xff, fp);
+  fclose(fp);
+  assert_null(load_neural_network(&context, NULL));
+
+  // a truncated file
+  assert_int_equal(1, store_neural_network(&context, nn, &training));
+  assert_int_equal(0, truncate(path, compressed_size - 1));
+  assert_null(load_neural_network(&context, NULL));
+
+  free_neural_network(nn, context.nn_size);
+}
+
+static void test_export(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  Layer** nn = init_neural_network_from_context(&context);
+  assert_int_equal(1, store_neural_network(&context, nn, NULL));
+  long model_size = file_size(storage_dir, MODEL_FILE);
+
+  // relative precision of each dtype, and the smallest value kept (subnormals are coarser)
+  ModelDtype dtypes[4] = {MODEL_F64, MODEL_F32, MODEL_F16, MODEL_BF16};
+  f64 precisions[4] = {0.0, 0x1p-24, 0x1p-11, 0x1p-8};
+  f64 smallest[4] = {0.0, 0x1p-149, 0x1p-25, 0x1p-133};
+
+  for (int d = 0; d < 4; d++) {
+    assert_int_equal(1, export_neural_network(&context, nn, dtypes[d]));
+    // weights and bias only, the other arrays were two thirds of the model
+    assert_true(file_size(storage_dir, EXPORT_FILE) * 3 < model_size * (d == 0 ? 2 : 1));
+
+    Layer** loaded = load_inference_network(&context, EXPORT_FILE);
+    assert_non_null(loaded);
+    for (u64 i = 0; i < (u64) context.nn_size - 1; i++) {
+      u64 next_size = context.topology[i + 1];
+      for (u64 j = 0; j < layer_weights_size(nn[i], next_size); j++) {
+        f64 error = fabs(nn[i]->weights[j] - loaded[i]->weights[j]);
+        assert_true(error <= precisions[d] * fabs(nn[i]->weights[j]) + smallest[d]);
+      }
+      for (u64 j = 0; j < layer_bias_size(nn[i], next_size); j++) {
+        f64 error = fabs(nn[i]->bias[j] - loaded[i]->bias[j]);
+        assert_true(error <= precisions[d] * fabs(nn[i]->bias[j]) + smallest[d]);
+      }
+    }
+    free_neural_network(loaded, context.nn_size);
+
+    // only f64 exports can be mapped
+    MappedModel model;
+    assert_int_equal(d == 0, map_neural_network(&context, EXPORT_FILE, &model));
+    unmap_neural_network(&model);
+  }
+
+  // the export can not be trained from
+  rename_model(storage_dir, EXPORT_FILE, MODEL_FILE);
+  assert_null(load_neural_network(&context, NULL));
+
+  free_neural_network(nn, context.nn_size);
+}
+
+static void test_export_rounding(void** state) {
+  char* storage_dir = *state;
+
+  Context context;
+  init_storage_context(&context, storage_dir);
+
+  // value, f16 and bf16 roundings (to nearest, ties to even)
+  f64 values[][3] = {
+          {1.0, 1.0, 1.0},
+          {-0.0, -0.0, -0.0},
+          {65504.0, 65504.0, 65536.0},
+          {65520.0, INFINITY, 65536.0},
+          {-1e6, -INFINITY, -999424.0},
+          {0x1p-24, 0x1p-24, 0x1p-24},
+          {0x1p-25, 0.0, 0x1p-25},
+          {0x1.8p-25, 0x1p-24, 0x1.8p-25},
+          {1.0 + 0x1p-11, 1.0, 1.0},
+          {1.0 + 0x3p-11, 1.0 + 0x1p-9, 1.0},
+          {1.0 + 0x1p-8, 1.0 + 0x1p-8, 1.0},
+          {1.0 + 0x3p-8, 1.0 + 0x3p-8, 1.0 + 0x1p-6},
+          {0.1, 0x1.998p-4, 0x1.9ap-4},
+  };
+  u64 count = sizeof(values) / sizeof(values[0]);
 
-  Layer** nn2 = load_nn("storage", nb_layers, neurons_per_layers);
+  Layer** nn = init_neural_network_from_context(&context);
+  for (u64 j = 0; j < count; j++) nn[1]->weights[j] = values[j][0];
 
-  float eps = 0.001;
-  assert_float_equal(nn1[0]->weights[0], nn2[0]->weights[0], eps);
-  assert_float_equal(nn1[1]->weights[0], nn2[1]->weights[0], eps);
-  assert_float_equal(nn1[1]->weights[5], nn2[1]->weights[5], eps);
+  for (int d = 0; d < 2; d++) {
+    assert_int_equal(1, export_neural_network(&context, nn, d ? MODEL_BF16 : MODEL_F16));
+    Layer** loaded = load_inference_network(&context, EXPORT_FILE);
+    assert_non_null(loaded);
+    for (u64 j = 0; j < count; j++) {
+      if (loaded[1]->weights[j] != values[j][1 + d] ||
+          signbit(loaded[1]->weights[j]) != signbit(values[j][1 + d])) {
+        fail_msg("%s of %a is %a, expected %a", d ? "bf16" : "f16", values[j][0],
+                 loaded[1]->weights[j], values[j][1 + d]);
+      }
+    }
+    free_neural_network(loaded, context.nn_size);
+  }
 
-  free_all(nn1, nb_layers);
-  free_all(nn2, nb_layers);
+  free_neural_network(nn, context.nn_size);
 }
 
 int main(void) {
   int result = 0;
   const struct CMUnitTest tests[] = {
-          cmocka_unit_test(test_storage),
+          storage_test(test_storage),
+          storage_test(test_storage_mismatch),
+          storage_test(test_mapped_storage),
+          storage_test(test_checkpoint),
+          storage_test(test_skipped_checkpoint),
+          storage_test(test_training_state),
+          storage_test(test_compressed_storage),
+          storage_test(test_export),
+          storage_test(test_export_rounding),
   };
   result |= cmocka_run_group_tests_name("storage", tests, NULL, NULL);
 